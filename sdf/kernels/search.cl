@@ -213,18 +213,20 @@ real brute_force_test(
 
 // -----------------------------------------------------------------------------
 
+// Squared distance from pos to the surface, or max_sq_dist if it is larger
+// (every node farther than max_sq_dist is pruned)
 real squared_dist_point(
 	const __global real * vertices,
 	const __global uint * facets,
 	const __global real * min_corners,
 	const __global real * max_corners,
-	const real3 pos, const uint nb_facets)
+	const real3 pos, const uint nb_facets, const real max_sq_dist)
 {
 	const real sq_hint = get_nearest_facet_hint(
 		vertices, facets, min_corners, max_corners, nb_facets, pos);
 	return nearest_facet_iterative(
 		vertices, facets, min_corners, max_corners,
-		pos, sq_hint, nb_facets);
+		pos, min(sq_hint, max_sq_dist), nb_facets);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -245,7 +247,8 @@ __kernel void squared_dist(
 	const uint3 layer_offset,
 	const real3 origin,
 	const real spacing,
-	const uint nb_facets)
+	const uint nb_facets,
+	const real max_sq_dist)
 {
 	for (size_t z = get_global_id(2); z < layer_size.z; z += get_global_size(2)) {
 		for (size_t y = get_global_id(1); y < layer_size.y; y += get_global_size(1)) {
@@ -254,7 +257,7 @@ __kernel void squared_dist(
 				const real3 pos = voxel_center(layer_coord, origin, spacing);
 				//const real sq_dist = brute_force_test(
 				const real sq_dist = squared_dist_point(
-					vertices, facets, min_corners, max_corners, pos, nb_facets);
+					vertices, facets, min_corners, max_corners, pos, nb_facets, max_sq_dist);
 				const size_t idx = x + layer_size.x * (y + layer_size.y * z);
 				layer_sq_dist[idx] = sq_dist;
 			}
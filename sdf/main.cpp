@@ -21,11 +21,16 @@
 #include <boost/compute/core.hpp>
 #include <boost/compute/container.hpp>
 #include "mesh_AABB.h"
+#include "mesh_leaf_AABB.h"
+#include "mesh_pseudonormals.h"
+#include "voxel_grid.h"
 #include <omp.h>
 #include <set>
 #include <queue>
 #include <limits>
 #include <type_traits>
+#include <memory>
+#include <sstream>
 // -----------------------------------------------------------------------------
 namespace compute = boost::compute;
 ////////////////////////////////////////////////////////////////////////////////
@@ -46,6 +51,14 @@ namespace GEO {
 		CmdLine::declare_arg("zslab", 5, "number of slices to be computed on the GPU (opencl)");
 		CmdLine::declare_arg("use_gpu", true, "use gpu kernels to speedup computation (opencl)");
 		CmdLine::declare_arg("check_result", false, "check resulting values against the CPU version (opencl)");
+		CmdLine::declare_arg("narrow_band", 0, "exact distances only within this many voxels of the surface, fast sweeping elsewhere (cpu, 0 = everywhere)");
+		CmdLine::declare_arg("leaf_size", 8, "max number of triangles in a leaf of the aabb tree (cpu)");
+		CmdLine::declare_arg("sparse", false, "only store the bricks within narrow_band voxels of the surface, saved as .sdfb (cpu)");
+		CmdLine::declare_arg("sign", "raycast", "inside/outside test: raycast (parity along Z rays, separate pass) or pseudonormal (from the nearest facet, cpu)");
+		CmdLine::declare_arg("channels", "", "extra outputs of the distance pass, comma separated among facet, closest_point, offset, barycentric (cpu)");
+		CmdLine::declare_arg("truncation", 0.0, "clamp distances to this many voxels, not searching the surface any farther (0 = exact distances everywhere)");
+		CmdLine::declare_arg("lipschitz_tolerance", 0.0, "skip the query at a voxel when its distance is known within this many voxels from its neighbors (cpu)");
+		CmdLine::declare_arg("brick_size", 8, "size of the bricks of the sparse grid, and of the blocks sharing one tree traversal (cpu, 0 = one traversal per voxel)");
 	}
 
 	void get_point_facet_nearest_point(
@@ -98,6 +111,7 @@ class AABBTreeOpenCL {
 
 	cl_uint m_nb_facets;
 	cl_uint3 m_layer_size;
+	real m_max_sq_dist;
 
 	compute::extents<3> m_local_work_size;
 	compute::extents<3> m_global_work_size;
@@ -108,6 +122,7 @@ public:
 		compute::context &ctx, compute::command_queue &queue);
 
 	void set_layer_size(int nx, int ny, int nz = 1);
+	void set_truncation(double truncation);
 	void compute_layer(float *raw_layer, GEO::vec3 origin, real spacing, int oz, int nz);
 };
 
@@ -125,6 +140,7 @@ AABBTreeOpenCL<real>::AABBTreeOpenCL(
 	, cl_xyz_max(3*aabb_tree.bboxes_.size(), ctx)
 	, cl_layer_sq_dist(ctx)
 	, m_nb_facets(M.facets.nb())
+	, m_max_sq_dist(std::numeric_limits<real>::max())
 	, m_local_work_size(GEO::CmdLine::get_arg_int("local_work_size"))
 {
 	using namespace GEO;
@@ -199,6 +215,13 @@ void AABBTreeOpenCL<real>::set_layer_size(int nx, int ny, int nz) {
 		<< " x " << m_global_work_size[1] << " x " << m_global_work_size[2] << std::endl;
 }
 
+// Distances larger than `truncation` are clamped to it, and the search prunes
+// every node farther than that (0 = exact distances everywhere)
+template<typename real>
+void AABBTreeOpenCL<real>::set_truncation(double truncation) {
+	m_max_sq_dist = (truncation > 0.0 ? (real) (truncation * truncation) : std::numeric_limits<real>::max());
+}
+
 template<typename real> struct cl_helper;
 template<> struct cl_helper<float>  { typedef cl_float3 real3; };
 template<> struct cl_helper<double> { typedef cl_double3 real3; };
@@ -215,7 +238,7 @@ void AABBTreeOpenCL<real>::compute_layer(
 	offset.s[0] = 0; offset.s[1] = 0; offset.s[2] = oz;
 	// Set kernel arguments and execute
 	m_dist_kernel.set_args(cl_vertices, cl_facets, cl_xyz_min, cl_xyz_max,
-		cl_layer_sq_dist, m_layer_size, offset, orig, spacing, m_nb_facets);
+		cl_layer_sq_dist, m_layer_size, offset, orig, spacing, m_nb_facets, m_max_sq_dist);
 	m_queue.enqueue_nd_range_kernel(m_dist_kernel, compute::extents<3>(0),
 		m_global_work_size, m_local_work_size);
 	// Copy data back to host memory
@@ -232,73 +255,6 @@ void AABBTreeOpenCL<real>::compute_layer(
 
 ////////////////////////////////////////////////////////////////////////////////
 
-typedef std::array<int, 3> Vec3i;
-
-class VoxelGrid {
-private:
-	// Member data
-	std::vector<float> m_data;
-	GEO::vec3 m_origin;
-	double m_spacing; // voxel size (in mm)
-	Vec3i m_grid_size;
-
-public:
-	// Interface
-	VoxelGrid(GEO::vec3 origin, GEO::vec3 extent, double voxel_size, int padding);
-
-	Vec3i grid_size() const { return m_grid_size; }
-	int num_voxels() const { return m_grid_size[0] * m_grid_size[1]  * m_grid_size[2]; }
-
-	GEO::vec3 origin() const { return m_origin; }
-	double spacing() const { return m_spacing; }
-
-	Vec3i index3_from_index(int idx) const;
-	int index_from_index3(Vec3i vx) const;
-
-	GEO::vec3 voxel_center(int x, int y, int z) const;
-
-	float & at(int idx) { return m_data[idx]; }
-	const float * rawbuf() const { return m_data.data(); }
-	float * raw_layer(int z) { return m_data.data() + z * m_grid_size[1] * m_grid_size[0]; }
-};
-
-////////////////////////////////////////////////////////////////////////////////
-
-VoxelGrid::VoxelGrid(GEO::vec3 origin, GEO::vec3 extent, double spacing, int padding)
-	: m_origin(origin)
-	, m_spacing(spacing)
-{
-	m_origin -= padding * spacing * GEO::vec3(1, 1, 1);
-	m_grid_size[0] = (int) std::floor(extent[0] / spacing) + 2 * padding;
-	m_grid_size[1] = (int) std::floor(extent[1] / spacing) + 2 * padding;
-	m_grid_size[2] = (int) std::floor(extent[2] / spacing) + 2 * padding;
-	m_data.assign(m_grid_size[0] * m_grid_size[1] * m_grid_size[2], 1.0f);
-	GEO::Logger::out("Voxels") << "Grid size: "
-		<< m_grid_size[0] << " x " << m_grid_size[1] << " x " << m_grid_size[2] << std::endl;
-}
-
-GEO::vec3 VoxelGrid::voxel_center(int x, int y, int z) const {
-	GEO::vec3 pos;
-	pos[0] = (x + 0.5) * m_spacing;
-	pos[1] = (y + 0.5) * m_spacing;
-	pos[2] = (z + 0.5) * m_spacing;
-	return pos + m_origin;
-}
-
-Vec3i VoxelGrid::index3_from_index(int idx) const {
-	return {{
-		idx % m_grid_size[0],
-		(idx / m_grid_size[0]) % m_grid_size[1],
-		(idx / m_grid_size[0]) / m_grid_size[1],
-	}};
-}
-
-int VoxelGrid::index_from_index3(Vec3i vx) const {
-	return (vx[2] * m_grid_size[1] + vx[1]) * m_grid_size[0] + vx[0];
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
 template<typename real>
 void compute_unsigned_distance_field_gpu(const GEO::Mesh &M,
 	const GEO::MeshFacetsAABB &aabb_tree, VoxelGrid &voxels)
@@ -317,6 +273,8 @@ void compute_unsigned_distance_field_gpu(const GEO::Mesh &M,
 	const Vec3i size = voxels.grid_size();
 	int nz = GEO::CmdLine::get_arg_int("zslab");
 	gpu_tree.set_layer_size(size[0], size[1], nz);
+	const double truncation = GEO::CmdLine::get_arg_double("truncation") * voxels.spacing();
+	gpu_tree.set_truncation(truncation);
 	try {
 		GEO::ProgressTask task("Sqdist (GPU)", 100);
 		for (int z = 0; z < size[2]; z += nz) {
@@ -337,7 +295,10 @@ void compute_unsigned_distance_field_gpu(const GEO::Mesh &M,
 			for (int idx = 0; idx < voxels.num_voxels(); ++idx) {
 				Vec3i vox = voxels.index3_from_index(idx);
 				GEO::vec3 pos = voxels.voxel_center(vox[0], vox[1], vox[2]);
-				const double sq_dist = aabb_tree.squared_distance(pos);
+				double sq_dist = aabb_tree.squared_distance(pos);
+				if (truncation > 0.0) {
+					sq_dist = std::min(sq_dist, (double) (real) (truncation * truncation));
+				}
 				if (strict && voxels.at(idx) != (float) std::sqrt(sq_dist)) {
 					std::cout << voxels.at(idx) << " " << (float) std::sqrt(sq_dist)
 						<< ' ' << voxels.at(idx) - (float) std::sqrt(sq_dist) << std::endl;
@@ -373,8 +334,54 @@ Vec3i morton_to_index3(size_t x) {
 
 // -----------------------------------------------------------------------------
 
+// Distance at a voxel from its nearest facet f, signed by the pseudonormal of
+// the feature of f nearest to the voxel if pseudonormals are given, and
+// clamped to the truncation distance if any (f is NO_FACET when there is no
+// facet within that distance)
+inline float voxel_distance(const GEO::MeshFacetsPseudonormals *pseudonormals,
+	const GEO::vec3 &query, GEO::index_t f, double sq_dist, float truncation)
+{
+	if (f == GEO::NO_FACET) {
+		return truncation;
+	}
+	float dist = (pseudonormals ? (float) pseudonormals->signed_distance(query, f) : (float) std::sqrt(sq_dist));
+	if (truncation > 0.0f) {
+		dist = std::max(-truncation, std::min(dist, truncation));
+	}
+	return dist;
+}
+
+// Record the nearest facet f of a voxel and its nearest point in the output
+// channels, if any. There is none if f is NO_FACET or farther than the
+// truncation distance (it may not be the nearest one then).
+inline void record_nearest_facet(const GEO::Mesh &M, VoxelChannels *channels, int idx,
+	const GEO::vec3 &query, GEO::index_t f, const GEO::vec3 &nearest_point, double sq_dist, float truncation)
+{
+	if (!channels) {
+		return;
+	}
+	if (f == GEO::NO_FACET || (truncation > 0.0f && sq_dist > (double) truncation * truncation)) {
+		channels->set_none(idx);
+		return;
+	}
+	GEO::vec3 lambda;
+	if (channels->has(VoxelChannels::BARYCENTRIC)) {
+		const GEO::vec3 &p1 = GEO::Geom::mesh_vertex(M, M.facets.vertex(f, 0));
+		const GEO::vec3 &p2 = GEO::Geom::mesh_vertex(M, M.facets.vertex(f, 1));
+		const GEO::vec3 &p3 = GEO::Geom::mesh_vertex(M, M.facets.vertex(f, 2));
+		GEO::vec3 p;
+		GEO::Geom::point_triangle_squared_distance(query, p1, p2, p3, p, lambda[0], lambda[1], lambda[2]);
+	}
+	channels->set(idx, (int32_t) f, query, nearest_point, lambda);
+}
+
+// -----------------------------------------------------------------------------
+
+// Distances are signed if pseudonormals are given (see voxel_distance()), and
+// the nearest facets are recorded in the channels if given
 void compute_unsigned_distance_field_cpu(const GEO::Mesh &M,
-	const GEO::MeshFacetsAABB &aabb_tree, VoxelGrid &voxels)
+	const GEO::MeshFacetsLeafAABB &aabb_tree, VoxelGrid &voxels,
+	const GEO::MeshFacetsPseudonormals *pseudonormals = nullptr, VoxelChannels *channels = nullptr)
 {
 
 	try {
@@ -393,10 +400,16 @@ void compute_unsigned_distance_field_cpu(const GEO::Mesh &M,
 			voxels.at(idx) = (float) std::sqrt(sq_dist);
 		}
 	#elif 1
+		const float h = (float) voxels.spacing();
+		const float tolerance = (float) (GEO::CmdLine::get_arg_double("lipschitz_tolerance") * h);
+		const float truncation = (float) (GEO::CmdLine::get_arg_double("truncation") * h);
+		const double max_sq_dist = (truncation > 0.0f ? (double) truncation * truncation : GEO::Numeric::max_float64());
 		GEO::index_t prev_facet = GEO::NO_FACET;
 		double sq_dist = std::numeric_limits<double>::max();
 		GEO::vec3 nearest_point;
-		#pragma omp parallel for private(prev_facet, sq_dist, nearest_point)
+		int prev_idx = -1;
+		float prev_lower = 0.0f; // lower bound of the distance at prev_idx
+		#pragma omp parallel for firstprivate(prev_facet, sq_dist, nearest_point, prev_idx, prev_lower)
 		for (int idx = 0; idx < voxels.num_voxels(); ++idx) {
 			if (omp_get_thread_num() == 0) {
 				task.progress((int) (100.0 * idx / voxels.num_voxels() * omp_get_num_threads()));
@@ -406,9 +419,31 @@ void compute_unsigned_distance_field_cpu(const GEO::Mesh &M,
 			GEO::vec3 query = voxels.voxel_center(vox[0], vox[1], vox[2]);
 			if (prev_facet != GEO::NO_FACET) {
 				GEO::get_point_facet_nearest_point(M, query, prev_facet, nearest_point, sq_dist);
+				// The distance is 1-Lipschitz, so it is at least the one of the
+				// previous voxel minus h (when this thread computed it)
+				if (vox[0] > 0 && prev_idx == idx - 1) {
+					const float upper = (float) std::sqrt(sq_dist);
+					const float lower = prev_lower - h;
+					if (upper - lower <= tolerance) {
+						voxels.at(idx) = voxel_distance(pseudonormals, query, prev_facet, sq_dist, truncation);
+						record_nearest_facet(M, channels, idx, query, prev_facet, nearest_point, sq_dist, truncation);
+						prev_idx = idx;
+						prev_lower = lower;
+						continue;
+					}
+				}
 			}
-			aabb_tree.nearest_facet_with_hint(query, prev_facet, nearest_point, sq_dist);
-			voxels.at(idx) = (float) std::sqrt(sq_dist);
+			if (prev_facet == GEO::NO_FACET || sq_dist > max_sq_dist) {
+				// No facet is known within the truncation distance: search
+				// from the root, pruning every node farther than that
+				prev_facet = aabb_tree.nearest_facet_within(query, max_sq_dist, nearest_point, sq_dist);
+			} else {
+				aabb_tree.nearest_facet_with_hint(query, prev_facet, nearest_point, sq_dist);
+			}
+			voxels.at(idx) = voxel_distance(pseudonormals, query, prev_facet, sq_dist, truncation);
+			record_nearest_facet(M, channels, idx, query, prev_facet, nearest_point, sq_dist, truncation);
+			prev_idx = idx;
+			prev_lower = (float) std::sqrt(sq_dist);
 		}
 	#else
 
@@ -421,7 +456,7 @@ void compute_unsigned_distance_field_cpu(const GEO::Mesh &M,
 		GEO::index_t prev_facet = GEO::NO_FACET;
 		double sq_dist = std::numeric_limits<double>::max();
 		GEO::vec3 nearest_point;
-		#pragma omp parallel for private(prev_facet, sq_dist, nearest_point)
+		#pragma omp parallel for firstprivate(prev_facet, sq_dist, nearest_point)
 		for (size_t idx = 0; idx < upper3; ++idx) {
 			if (omp_get_thread_num() == 0) {
 				task.progress((int) (100.0 * idx / upper3 * omp_get_num_threads()));
@@ -447,6 +482,365 @@ void compute_unsigned_distance_field_cpu(const GEO::Mesh &M,
 	}
 }
 
+// -----------------------------------------------------------------------------
+
+// Blocks of at most this many voxels along each axis are scanned voxel by voxel
+const int SCAN_BLOCK_SIZE = 4;
+
+// Distance beyond which the nearest facet of a voxel is not needed
+double max_block_distance(float truncation) {
+	return (truncation > 0.0f ? (double) truncation : GEO::Numeric::max_float64());
+}
+
+GEO::Box block_box(GEO::vec3 first, double spacing, Vec3i dims) {
+	GEO::Box box;
+	for (int c = 0; c < 3; ++c) {
+		box.xyz_min[c] = first[c];
+		box.xyz_max[c] = first[c] + (dims[c] - 1) * spacing;
+	}
+	return box;
+}
+
+// Exact unsigned distances at a block of dims[0] x dims[1] x dims[2] voxels,
+// whose first voxel center is `first`, from the candidate facets of the block
+// in levels[depth]. Large blocks are split in octants, whose candidates are
+// filtered from the ones of the block into levels[depth + 1].
+//
+// Within a block, the nearest facet of the previous voxel gives an upper bound
+// of the distance (tighter than the Lipschitz bound d(neighbor) + h), which
+// seeds the scan. Since the distance is 1-Lipschitz, it is also at least
+// d(neighbor) - h for the neighbors already computed. When both bounds are
+// within `tolerance`, the upper bound is taken and the scan is skipped (the
+// lower bound of such a voxel, rather than its value, bounds its neighbors).
+//
+// With a truncation distance, the candidates only cover the voxels nearer
+// than that: a block without candidates, or a voxel whose lower bound reaches
+// the truncation distance, is set to it without any query.
+//
+// Distances are signed if pseudonormals are given (see voxel_distance()). The
+// nearest facets are recorded in the channels if given, voxel (x, y, z) of the
+// block being channel_offset + z * stride_z + y * stride_y + x.
+void compute_block_distances(const GEO::MeshFacetsLeafAABB &aabb_tree,
+	const GEO::MeshFacetsPseudonormals *pseudonormals,
+	GEO::vec3 first, double spacing, Vec3i dims, float *out, int stride_y, int stride_z,
+	VoxelChannels *channels, int channel_offset, float tolerance, float truncation, std::vector<GEO::MeshFacetsLeafAABB::BlockCandidates> &levels, size_t depth)
+{
+	const GEO::MeshFacetsLeafAABB::BlockCandidates &candidates = levels[depth];
+	if (truncation > 0.0f && candidates.packets.empty()) {
+		for (int z = 0; z < dims[2]; ++z) {
+			for (int y = 0; y < dims[1]; ++y) {
+				std::fill_n(out + z * stride_z + y * stride_y, dims[0], truncation);
+				for (int x = 0; channels && x < dims[0]; ++x) {
+					channels->set_none(channel_offset + z * stride_z + y * stride_y + x);
+				}
+			}
+		}
+		return;
+	}
+	if (std::max(dims[0], std::max(dims[1], dims[2])) <= SCAN_BLOCK_SIZE) {
+		const float h = (float) spacing;
+		const int ny = SCAN_BLOCK_SIZE;
+		const int nz = SCAN_BLOCK_SIZE * SCAN_BLOCK_SIZE;
+		float lower_bound[SCAN_BLOCK_SIZE * SCAN_BLOCK_SIZE * SCAN_BLOCK_SIZE];
+		GEO::index_t hint = GEO::NO_FACET;
+		GEO::vec3 nearest_point;
+		double sq_dist;
+		for (int z = 0; z < dims[2]; ++z) {
+			for (int y = 0; y < dims[1]; ++y) {
+				for (int x = 0; x < dims[0]; ++x) {
+					const GEO::vec3 query = first + spacing * GEO::vec3(x, y, z);
+					const int offset = z * stride_z + y * stride_y + x;
+					float *value = out + offset;
+					float *lower = lower_bound + z * nz + y * ny + x;
+					*lower = 0.0f;
+					if (x > 0) { *lower = std::max(*lower, lower[-1] - h); }
+					if (y > 0) { *lower = std::max(*lower, lower[-ny] - h); }
+					if (z > 0) { *lower = std::max(*lower, lower[-nz] - h); }
+					if (truncation > 0.0f && *lower >= truncation) {
+						*value = truncation;
+						if (channels) { channels->set_none(channel_offset + offset); }
+						continue;
+					}
+					if (hint != GEO::NO_FACET) {
+						GEO::get_point_facet_nearest_point(aabb_tree.mesh(), query, hint, nearest_point, sq_dist);
+						const float upper = (float) std::sqrt(sq_dist);
+						if (upper - *lower <= tolerance) {
+							*value = voxel_distance(pseudonormals, query, hint, sq_dist, truncation);
+							record_nearest_facet(aabb_tree.mesh(), channels, channel_offset + offset, query,
+								hint, nearest_point, sq_dist, truncation);
+							continue;
+						}
+					}
+					aabb_tree.nearest_facet_in_block_with_hint(query, candidates, hint, nearest_point, sq_dist);
+					// Beyond the truncation distance, the nearest facet among the
+					// candidates only bounds the distance from above
+					*lower = (float) std::sqrt(sq_dist);
+					if (truncation > 0.0f) { *lower = std::min(*lower, truncation); }
+					*value = voxel_distance(pseudonormals, query, hint, sq_dist, truncation);
+					record_nearest_facet(aabb_tree.mesh(), channels, channel_offset + offset, query,
+						hint, nearest_point, sq_dist, truncation);
+				}
+			}
+		}
+		return;
+	}
+
+	const Vec3i half = {{(dims[0] + 1) / 2, (dims[1] + 1) / 2, (dims[2] + 1) / 2}};
+	for (int octant = 0; octant < 8; ++octant) {
+		Vec3i lo, sub;
+		for (int c = 0; c < 3; ++c) {
+			const bool upper = ((octant >> c) & 1) != 0;
+			lo[c] = (upper ? half[c] : 0);
+			sub[c] = (upper ? dims[c] - half[c] : half[c]);
+		}
+		if (sub[0] == 0 || sub[1] == 0 || sub[2] == 0) { continue; }
+
+		const GEO::vec3 sub_first = first + spacing * GEO::vec3(lo[0], lo[1], lo[2]);
+		aabb_tree.refine_block_candidates(block_box(sub_first, spacing, sub), candidates, levels[depth + 1],
+			max_block_distance(truncation));
+		const int sub_offset = lo[2] * stride_z + lo[1] * stride_y + lo[0];
+		compute_block_distances(aabb_tree, pseudonormals, sub_first, spacing, sub,
+			out + sub_offset, stride_y, stride_z, channels, channel_offset + sub_offset, tolerance, truncation,
+			levels, depth + 1);
+	}
+}
+
+// Same as above, collecting the candidates of the whole block from the tree.
+// The traversal is shared by all the voxels of the block.
+void compute_block_distances(const GEO::MeshFacetsLeafAABB &aabb_tree,
+	const GEO::MeshFacetsPseudonormals *pseudonormals,
+	GEO::vec3 first, double spacing, Vec3i dims, float *out, int stride_y, int stride_z,
+	VoxelChannels *channels, int channel_offset, float tolerance, float truncation,
+	std::vector<GEO::MeshFacetsLeafAABB::BlockCandidates> &levels)
+{
+	size_t num_levels = 1;
+	for (int n = std::max(dims[0], std::max(dims[1], dims[2])); n > SCAN_BLOCK_SIZE; n = (n + 1) / 2) {
+		++num_levels;
+	}
+	if (levels.size() < num_levels) { levels.resize(num_levels); }
+	aabb_tree.get_block_candidates(block_box(first, spacing, dims), levels[0], max_block_distance(truncation));
+	compute_block_distances(aabb_tree, pseudonormals, first, spacing, dims, out, stride_y, stride_z,
+		channels, channel_offset, tolerance, truncation, levels, 0);
+}
+
+// Same as compute_unsigned_distance_field_cpu(), one block of brick_size^3
+// voxels at a time
+void compute_unsigned_distance_field_bricks(const GEO::MeshFacetsLeafAABB &aabb_tree,
+	VoxelGrid &voxels, int brick_size, const GEO::MeshFacetsPseudonormals *pseudonormals = nullptr,
+	VoxelChannels *channels = nullptr)
+{
+	const Vec3i size = voxels.grid_size();
+	const Vec3i num_bricks = {{
+		(size[0] + brick_size - 1) / brick_size,
+		(size[1] + brick_size - 1) / brick_size,
+		(size[2] + brick_size - 1) / brick_size,
+	}};
+	const int total = num_bricks[0] * num_bricks[1] * num_bricks[2];
+	const float tolerance = (float) (GEO::CmdLine::get_arg_double("lipschitz_tolerance") * voxels.spacing());
+	const float truncation = (float) (GEO::CmdLine::get_arg_double("truncation") * voxels.spacing());
+
+	try {
+		GEO::ProgressTask task("Sqdist (bricks)", 100);
+
+		std::vector<GEO::MeshFacetsLeafAABB::BlockCandidates> levels;
+		#pragma omp parallel for firstprivate(levels) schedule(dynamic)
+		for (int brick = 0; brick < total; ++brick) {
+			if (omp_get_thread_num() == 0) {
+				task.progress((int) (100.0 * brick / total * omp_get_num_threads()));
+			}
+
+			const Vec3i lo = {{
+				(brick % num_bricks[0]) * brick_size,
+				((brick / num_bricks[0]) % num_bricks[1]) * brick_size,
+				((brick / num_bricks[0]) / num_bricks[1]) * brick_size,
+			}};
+			const Vec3i dims = {{
+				std::min(brick_size, size[0] - lo[0]),
+				std::min(brick_size, size[1] - lo[1]),
+				std::min(brick_size, size[2] - lo[2]),
+			}};
+			const int first = voxels.index_from_index3(lo);
+			compute_block_distances(aabb_tree, pseudonormals, voxels.voxel_center(lo[0], lo[1], lo[2]),
+				voxels.spacing(), dims, &voxels.at(first), size[0], size[0] * size[1],
+				channels, first, tolerance, truncation, levels);
+		}
+	} catch(const GEO::TaskCanceled&) {
+		// Do early cleanup
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+// Range of voxels whose center may lie within `band` voxels of a facet, from
+// the bounding box of the facet (clamped to the grid)
+void facet_voxel_range(const GEO::Mesh &M, GEO::index_t f, GEO::vec3 origin, double spacing,
+	Vec3i size, int band, Vec3i &lo, Vec3i &hi)
+{
+	for (int c = 0; c < 3; ++c) {
+		double vmin = std::numeric_limits<double>::max();
+		double vmax = -vmin;
+		for (GEO::index_t lv = 0; lv < M.facets.nb_vertices(f); ++lv) {
+			const double x = M.vertices.point(M.facets.vertex(f, lv))[c];
+			vmin = std::min(vmin, x);
+			vmax = std::max(vmax, x);
+		}
+		// Voxel centers are at origin + (i + 0.5) * spacing
+		vmin = (vmin - origin[c]) / spacing - 0.5;
+		vmax = (vmax - origin[c]) / spacing - 0.5;
+		lo[c] = std::max(0, (int) std::floor(vmin) - band);
+		hi[c] = std::min(size[c] - 1, (int) std::ceil(vmax) + band);
+	}
+}
+
+// Mark the voxels whose center may lie within `band` voxels of the surface, by
+// rasterizing the bounding box of each facet
+void mark_narrow_band(const GEO::Mesh &M, const VoxelGrid &voxels, int band,
+	std::vector<char> &in_band)
+{
+	const Vec3i size = voxels.grid_size();
+	in_band.assign(voxels.num_voxels(), 0);
+	for (GEO::index_t f = 0; f < M.facets.nb(); ++f) {
+		Vec3i lo, hi;
+		facet_voxel_range(M, f, voxels.origin(), voxels.spacing(), size, band, lo, hi);
+		for (int z = lo[2]; z <= hi[2]; ++z) {
+			for (int y = lo[1]; y <= hi[1]; ++y) {
+				for (int x = lo[0]; x <= hi[0]; ++x) {
+					in_band[voxels.index_from_index3({{x, y, z}})] = 1;
+				}
+			}
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+// Godunov upwind update of the Eikonal equation |grad u| = 1 at a voxel, from
+// the smallest neighbor value along each axis
+inline float eikonal_update(float a, float b, float c, float h) {
+	if (a > b) { std::swap(a, b); }
+	if (b > c) { std::swap(b, c); }
+	if (a > b) { std::swap(a, b); }
+	float x = a + h;
+	if (x > b) {
+		x = 0.5f * (a + b + std::sqrt(2.0f * h * h - (a - b) * (a - b)));
+		if (x > c) {
+			const float s = a + b + c;
+			const float d = s * s - 3.0f * (a * a + b * b + c * c - h * h);
+			x = (s + std::sqrt(std::max(d, 0.0f))) / 3.0f;
+		}
+	}
+	return x;
+}
+
+// -----------------------------------------------------------------------------
+
+// Fill the voxels outside the band by fast sweeping (Zhao 2005). In each of
+// the 8 sweep directions, a voxel depends on its predecessors along X, Y and Z.
+// Rows along X are swept sequentially, and the rows of a same diagonal
+// y+z = const are independent, so they are processed in parallel.
+void fast_sweeping(VoxelGrid &voxels, const std::vector<char> &frozen, int max_rounds) {
+	const Vec3i size = voxels.grid_size();
+	const int nx = size[0];
+	const int ny = size[1];
+	const int nz = size[2];
+	const float h = (float) voxels.spacing();
+	const float inf = std::numeric_limits<float>::max();
+	float *u = voxels.raw_layer(0);
+
+	for (int round = 0; round < max_rounds; ++round) {
+		// Number of voxels that changed by more than a small fraction of a voxel
+		int num_changed = 0;
+		for (int dir = 0; dir < 8; ++dir) {
+			const bool rx = (dir & 1) != 0;
+			const bool ry = (dir & 2) != 0;
+			const bool rz = (dir & 4) != 0;
+			for (int level = 0; level < ny + nz - 1; ++level) {
+				#pragma omp parallel for reduction(+:num_changed)
+				for (int j = std::max(0, level - nz + 1); j < std::min(ny, level + 1); ++j) {
+					const int y = (ry ? ny - 1 - j : j);
+					const int z = (rz ? nz - 1 - (level - j) : level - j);
+					const int row = (z * ny + y) * nx;
+					for (int i = 0; i < nx; ++i) {
+						const int x = (rx ? nx - 1 - i : i);
+						const int idx = row + x;
+						if (frozen[idx]) { continue; }
+						const float a = std::min(x > 0 ? u[idx - 1] : inf, x + 1 < nx ? u[idx + 1] : inf);
+						const float b = std::min(y > 0 ? u[idx - nx] : inf, y + 1 < ny ? u[idx + nx] : inf);
+						const float c = std::min(z > 0 ? u[idx - nx * ny] : inf, z + 1 < nz ? u[idx + nx * ny] : inf);
+						if (std::min(a, std::min(b, c)) == inf) { continue; }
+						const float v = eikonal_update(a, b, c, h);
+						if (v < u[idx]) {
+							num_changed += (u[idx] - v > 1e-3f * h);
+							u[idx] = v;
+						}
+					}
+				}
+			}
+		}
+		GEO::Logger::out("Sweeping") << "Round " << round << ": "
+			<< num_changed << " voxels updated" << std::endl;
+		if (num_changed == 0) { break; }
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+// Exact unsigned distances within `band` voxels of the surface, propagated by
+// fast sweeping everywhere else (and clamped to the truncation distance)
+void compute_unsigned_distance_field_narrow_band(const GEO::Mesh &M,
+	const GEO::MeshFacetsLeafAABB &aabb_tree, VoxelGrid &voxels, int band)
+{
+	const float truncation = (float) (GEO::CmdLine::get_arg_double("truncation") * voxels.spacing());
+	const double max_sq_dist = (truncation > 0.0f ? (double) truncation * truncation : GEO::Numeric::max_float64());
+
+	std::vector<char> in_band;
+	mark_narrow_band(M, voxels, band, in_band);
+	size_t num_band = std::count(in_band.begin(), in_band.end(), 1);
+	GEO::Logger::out("Narrow band") << num_band << " / " << voxels.num_voxels()
+		<< " voxels within " << band << " voxels of the surface" << std::endl;
+
+	try {
+		GEO::ProgressTask task("Sqdist (narrow band)", 100);
+
+		GEO::index_t prev_facet = GEO::NO_FACET;
+		double sq_dist = std::numeric_limits<double>::max();
+		GEO::vec3 nearest_point;
+		#pragma omp parallel for firstprivate(prev_facet, sq_dist, nearest_point)
+		for (int idx = 0; idx < voxels.num_voxels(); ++idx) {
+			if (omp_get_thread_num() == 0) {
+				task.progress((int) (100.0 * idx / voxels.num_voxels() * omp_get_num_threads()));
+			}
+			if (!in_band[idx]) {
+				voxels.at(idx) = std::numeric_limits<float>::max();
+				continue;
+			}
+
+			Vec3i vox = voxels.index3_from_index(idx);
+			GEO::vec3 query = voxels.voxel_center(vox[0], vox[1], vox[2]);
+			if (prev_facet != GEO::NO_FACET) {
+				GEO::get_point_facet_nearest_point(M, query, prev_facet, nearest_point, sq_dist);
+			}
+			if (prev_facet == GEO::NO_FACET || sq_dist > max_sq_dist) {
+				prev_facet = aabb_tree.nearest_facet_within(query, max_sq_dist, nearest_point, sq_dist);
+			} else {
+				aabb_tree.nearest_facet_with_hint(query, prev_facet, nearest_point, sq_dist);
+			}
+			voxels.at(idx) = (float) std::sqrt(sq_dist);
+		}
+	} catch(const GEO::TaskCanceled&) {
+		// Do early cleanup
+	}
+
+	fast_sweeping(voxels, in_band, 4);
+
+	if (truncation > 0.0f) {
+		#pragma omp parallel for
+		for (int idx = 0; idx < voxels.num_voxels(); ++idx) {
+			voxels.at(idx) = std::min(voxels.at(idx), truncation);
+		}
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 // calculate twice signed area of triangle (0,0)-(x1,y1)-(x2,y2)
@@ -569,6 +963,151 @@ void compute_sign(const GEO::Mesh &M,
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Allocate the bricks that may contain a voxel within `band` voxels of the
+// surface, by rasterizing the bounding box of each facet at the brick level.
+// The background magnitude is set to the band width, a lower bound of the
+// distance at any voxel of a brick that is not allocated.
+void allocate_narrow_band_bricks(const GEO::Mesh &M, SparseVoxelGrid &voxels, int band) {
+	voxels.set_background((float) (band * voxels.spacing()));
+
+	const Vec3i size = voxels.grid_size();
+	const int bs = voxels.brick_size();
+	std::vector<char> in_band(voxels.num_bricks()[0] * voxels.num_bricks()[1] * voxels.num_bricks()[2], 0);
+	for (GEO::index_t f = 0; f < M.facets.nb(); ++f) {
+		Vec3i lo, hi;
+		facet_voxel_range(M, f, voxels.origin(), voxels.spacing(), size, band, lo, hi);
+		for (int bz = lo[2] / bs; bz <= hi[2] / bs; ++bz) {
+			for (int by = lo[1] / bs; by <= hi[1] / bs; ++by) {
+				for (int bx = lo[0] / bs; bx <= hi[0] / bs; ++bx) {
+					in_band[voxels.brick_from_index3({{bx, by, bz}})] = 1;
+				}
+			}
+		}
+	}
+	// Allocate in brick order, so that the file is laid out like the grid
+	for (int brick = 0; brick < (int) in_band.size(); ++brick) {
+		if (in_band[brick]) {
+			voxels.allocate_brick(brick);
+		}
+	}
+	GEO::Logger::out("Narrow band") << voxels.num_allocated_bricks() << " / " << in_band.size()
+		<< " bricks within " << band << " voxels of the surface" << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+
+// Exact unsigned distances at the voxels of the allocated bricks, each brick
+// sharing one tree traversal (see compute_block_distances()). They are signed
+// if pseudonormals are given.
+void compute_unsigned_distance_field_sparse(const GEO::MeshFacetsLeafAABB &aabb_tree,
+	SparseVoxelGrid &voxels, const GEO::MeshFacetsPseudonormals *pseudonormals = nullptr)
+{
+	const Vec3i size = voxels.grid_size();
+	const int bs = voxels.brick_size();
+	const int num_bricks = voxels.num_allocated_bricks();
+	const float tolerance = (float) (GEO::CmdLine::get_arg_double("lipschitz_tolerance") * voxels.spacing());
+	const float truncation = (float) (GEO::CmdLine::get_arg_double("truncation") * voxels.spacing());
+
+	try {
+		GEO::ProgressTask task("Sqdist (sparse)", 100);
+
+		std::vector<GEO::MeshFacetsLeafAABB::BlockCandidates> levels;
+		#pragma omp parallel for firstprivate(levels) schedule(dynamic)
+		for (int k = 0; k < num_bricks; ++k) {
+			if (omp_get_thread_num() == 0) {
+				task.progress((int) (100.0 * k / num_bricks * omp_get_num_threads()));
+			}
+
+			const Vec3i b = voxels.index3_from_brick(voxels.allocated_brick(k));
+			const Vec3i lo = {{b[0] * bs, b[1] * bs, b[2] * bs}};
+			// Voxels of the last bricks may lie outside the grid
+			const Vec3i dims = {{
+				std::min(bs, size[0] - lo[0]),
+				std::min(bs, size[1] - lo[1]),
+				std::min(bs, size[2] - lo[2]),
+			}};
+			compute_block_distances(aabb_tree, pseudonormals, voxels.voxel_center(lo[0], lo[1], lo[2]),
+				voxels.spacing(), dims, voxels.brick_data(k), bs, bs * bs, nullptr, 0, tolerance, truncation, levels);
+		}
+	} catch(const GEO::TaskCanceled&) {
+		// Do early cleanup
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+// Same as compute_sign(), on a sparse grid. The voxels of the allocated bricks
+// are flipped individually, and the sign of each other brick is taken from the
+// ray through its first voxel (a brick away from the band lies entirely on one
+// side of the surface). If bricks_only is set, the allocated bricks are left
+// untouched, and only the rays through the first voxels of the bricks are cast.
+void compute_sign_sparse(const GEO::Mesh &M,
+	const GEO::MeshFacetsAABB &aabb_tree, SparseVoxelGrid &voxels, bool bricks_only = false)
+{
+	const Vec3i size = voxels.grid_size();
+	const int bs = voxels.brick_size();
+
+	try {
+		GEO::ProgressTask task("Ray marching", 100);
+
+		GEO::vec3 min_corner, max_corner;
+		GEO::get_bbox(M, &min_corner[0], &max_corner[0]);
+
+		const GEO::vec3 origin = voxels.origin();
+		const double spacing = voxels.spacing();
+
+		#pragma omp parallel for
+		for (int x = 0; x < size[0]; ++x) {
+			if (omp_get_thread_num() == 0) {
+				task.progress((int) (100.0 * x / size[0] * omp_get_num_threads()));
+			}
+			if (bricks_only && x % bs != 0) { continue; }
+			for (int y = 0; y < size[1]; ++y) {
+				if (bricks_only && y % bs != 0) { continue; }
+				GEO::vec3 center = voxels.voxel_center(x, y, 0);
+
+				GEO::Box box;
+				box.xyz_min[0] = box.xyz_max[0] = center[0];
+				box.xyz_min[1] = box.xyz_max[1] = center[1];
+				box.xyz_min[2] = min_corner[2];
+				box.xyz_max[2] = max_corner[2];
+
+				std::vector<double> inter;
+				auto action = [&M, &inter, &center] (GEO::index_t f) {
+					double z;
+					if (intersect_ray_z(M, f, center, z)) {
+						inter.push_back(z);
+					}
+				};
+				aabb_tree.compute_bbox_facet_bbox_intersections(box, action);
+				std::sort(inter.begin(), inter.end());
+
+				const bool first_column = (x % bs == 0 && y % bs == 0);
+				const int offset = ((y % bs) * bs + (x % bs));
+				for (size_t k = 1; k < inter.size(); k += 2) {
+					int z1 = int(std::round((inter[k-1] - origin[2])/spacing));
+					int z2 = int(std::round((inter[k] - origin[2])/spacing));
+					for (int z = std::max(z1, 0); z < std::min(z2, size[2]); ++z) {
+						const int brick = voxels.brick_from_index3({{x / bs, y / bs, z / bs}});
+						const int b = voxels.brick_index(brick);
+						if (b != SparseVoxelGrid::NO_BRICK) {
+							if (!bricks_only) {
+								voxels.brick_data(b)[(z % bs) * bs * bs + offset] *= -1.0f;
+							}
+						} else if (first_column && z % bs == 0) {
+							voxels.set_brick_sign(brick, -1);
+						}
+					}
+				}
+			}
+		}
+	} catch(const GEO::TaskCanceled&) {
+		// Do early cleanup
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void sample_inside(const VoxelGrid &voxels, std::vector<GEO::vec3> &pts, int num_samples) {
 	// TODO: Implement
 }
@@ -588,9 +1127,13 @@ void write_samples(std::string &basename, const std::vector<GEO::vec3> &pts) {
 void paraview_dump(std::string &basename, const VoxelGrid &voxels) {
 	Vec3i size = voxels.grid_size();
 
+    GEO::vec3 first = voxels.voxel_center(0, 0, 0);
     std::ofstream metafile(basename + ".mhd");
+    metafile.precision(17);
     metafile << "ObjectType = Image\nNDims = 3\n"
     	<< "DimSize = " << size[0] << " " << size[1] << " " << size[2] << "\n"
+    	<< "Offset = " << first[0] << " " << first[1] << " " << first[2] << "\n"
+    	<< "ElementSpacing = " << voxels.spacing() << " " << voxels.spacing() << " " << voxels.spacing() << "\n"
     	<< "ElementType = MET_FLOAT\nElementDataFile = " + basename + ".raw\n";
     metafile.close();
 
@@ -599,6 +1142,72 @@ void paraview_dump(std::string &basename, const VoxelGrid &voxels) {
 	rawfile.close();
 }
 
+// Same as paraview_dump(), for a channel of `num_components` values per voxel
+template<typename T>
+void paraview_dump_channel(const std::string &basename, const VoxelGrid &voxels,
+	const std::vector<T> &values, int num_components)
+{
+	Vec3i size = voxels.grid_size();
+
+	GEO::vec3 first = voxels.voxel_center(0, 0, 0);
+	std::ofstream metafile(basename + ".mhd");
+	metafile.precision(17);
+	metafile << "ObjectType = Image\nNDims = 3\n"
+		<< "DimSize = " << size[0] << " " << size[1] << " " << size[2] << "\n"
+		<< "Offset = " << first[0] << " " << first[1] << " " << first[2] << "\n"
+		<< "ElementSpacing = " << voxels.spacing() << " " << voxels.spacing() << " " << voxels.spacing() << "\n"
+		<< "ElementNumberOfChannels = " << num_components << "\n"
+		<< "ElementType = " << (std::is_same<T, float>::value ? "MET_FLOAT" : "MET_INT") << "\n"
+		<< "ElementDataFile = " + basename + ".raw\n";
+	metafile.close();
+
+	std::ofstream rawfile(basename + ".raw", std::ios::binary);
+	rawfile.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+	rawfile.close();
+}
+
+// Each requested channel is saved as <basename>_<channel>.mhd/.raw
+void paraview_dump_channels(const std::string &basename, const VoxelGrid &voxels, const VoxelChannels &channels) {
+	if (channels.has(VoxelChannels::FACET)) {
+		paraview_dump_channel(basename + "_facet", voxels, channels.facet(), 1);
+	}
+	if (channels.has(VoxelChannels::CLOSEST_POINT)) {
+		paraview_dump_channel(basename + "_closest_point", voxels, channels.closest_point(), 3);
+	}
+	if (channels.has(VoxelChannels::OFFSET)) {
+		paraview_dump_channel(basename + "_offset", voxels, channels.offset(), 3);
+	}
+	if (channels.has(VoxelChannels::BARYCENTRIC)) {
+		paraview_dump_channel(basename + "_barycentric", voxels, channels.barycentric(), 3);
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+// Parse a comma separated list of channel names, returns false on an unknown name
+bool parse_channels(const std::string &names, int &channels) {
+	channels = 0;
+	std::stringstream ss(names);
+	std::string name;
+	while (std::getline(ss, name, ',')) {
+		if (name.empty()) {
+			continue;
+		} else if (name == "facet") {
+			channels |= VoxelChannels::FACET;
+		} else if (name == "closest_point") {
+			channels |= VoxelChannels::CLOSEST_POINT;
+		} else if (name == "offset") {
+			channels |= VoxelChannels::OFFSET;
+		} else if (name == "barycentric") {
+			channels |= VoxelChannels::BARYCENTRIC;
+		} else {
+			GEO::Logger::err("Channels") << "Unknown channel: " << name << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 int main(int argc, char** argv) {
@@ -643,29 +1252,125 @@ int main(int argc, char** argv) {
 		}
 		geo_assert(M_in.vertices.dimension() == 3);
 
+		// Output channels, the facet indices are those of the input mesh
+		// (the facets are reordered by the AABB trees)
+		int channel_flags = 0;
+		if (!parse_channels(CmdLine::get_arg("channels"), channel_flags)) {
+			return 1;
+		}
+		GEO::Attribute<GEO::index_t> input_facet;
+		if (channel_flags & VoxelChannels::FACET) {
+			input_facet.bind(M_in.facets.attributes(), "sdf_input_facet");
+			for (GEO::index_t f = 0; f < M_in.facets.nb(); ++f) {
+				input_facet[f] = f;
+			}
+		}
+
 		// Initialize voxel grid and AABB tree
 		vec3 min_corner, max_corner;
 		GEO::get_bbox(M_in, &min_corner[0], &max_corner[0]);
+
+		// Sparse grid, the dense grid is never allocated
+		if (CmdLine::get_arg_bool("sparse")) {
+			if (channel_flags != 0) {
+				Logger::warn("Channels") << "Output channels are not saved with a sparse grid" << std::endl;
+			}
+			int band = CmdLine::get_arg_int("narrow_band");
+			if (band <= 0) {
+				band = 4;
+				Logger::warn("Narrow band") << "Sparse grid needs a narrow band, using " << band << " voxels" << std::endl;
+			}
+			SparseVoxelGrid voxels(min_corner, max_corner - min_corner, voxel_size, padding,
+				CmdLine::get_arg_int("brick_size"));
+			allocate_narrow_band_bricks(M_in, voxels, band);
+			const float truncation = (float) (CmdLine::get_arg_double("truncation") * voxel_size);
+			if (truncation > 0.0f) {
+				voxels.set_background(std::min(voxels.background(), truncation));
+			}
+			GEO::MeshFacetsAABB aabb_tree(M_in);
+			bool is_signed = false;
+			if (!voxelize_only) {
+				Logger::div("Computing (unsigned) distance field");
+				GEO::MeshFacetsLeafAABB leaf_tree(M_in, false, CmdLine::get_arg_int("leaf_size"));
+				std::unique_ptr<GEO::MeshFacetsPseudonormals> pseudonormals;
+				if (CmdLine::get_arg("sign") == "pseudonormal") {
+					if (truncation > 0.0f) {
+						// Truncated voxels have no nearest facet
+						Logger::warn("Sign") << "Pseudonormals are not used with a truncation" << std::endl;
+					} else {
+						pseudonormals.reset(new GEO::MeshFacetsPseudonormals(M_in));
+						is_signed = true;
+					}
+				}
+				compute_unsigned_distance_field_sparse(leaf_tree, voxels, pseudonormals.get());
+			}
+			// With pseudonormals, only the bricks that are not allocated need rays
+			Logger::div("Computing inside/outside info");
+			compute_sign_sparse(M_in, aabb_tree, voxels, is_signed);
+
+			Logger::div("Saving result");
+			Logger::out("Sparse") << "Memory: " << voxels.memory_footprint() / (1024 * 1024) << " MB" << std::endl;
+			if (!voxels.save(output_basename + ".sdfb")) {
+				return 1;
+			}
+			Logger::out("") << "Everything OK, Returning status 0" << std::endl;
+			return 0;
+		}
+
 		VoxelGrid voxels(min_corner, max_corner - min_corner, voxel_size, padding);
 		GEO::MeshFacetsAABB aabb_tree(M_in);
+		std::unique_ptr<VoxelChannels> channels;
+		if (channel_flags != 0 && !voxelize_only) {
+			if (GEO::CmdLine::get_arg_bool("use_gpu") || CmdLine::get_arg_int("narrow_band") > 0) {
+				Logger::warn("Channels") << "Output channels are only computed by the exact CPU paths" << std::endl;
+			} else {
+				channels.reset(new VoxelChannels(voxels.num_voxels(), channel_flags));
+			}
+		}
 
 		// Compute (unsigned) distance field
+		bool is_signed = false;
 		if (!voxelize_only) {
 			Logger::div("Computing (unsigned) distance field");
 			if (GEO::CmdLine::get_arg_bool("use_gpu")) {
+				if (CmdLine::get_arg("sign") == "pseudonormal") {
+					Logger::warn("Sign") << "Pseudonormals are not used on the GPU (use_gpu=false to enable them)" << std::endl;
+				}
 				if (GEO::CmdLine::get_arg_bool("opencl_use_float")) {
 					compute_unsigned_distance_field_gpu<float>(M_in, aabb_tree, voxels);
 				} else {
 					compute_unsigned_distance_field_gpu<double>(M_in, aabb_tree, voxels);
 				}
 			} else {
-				compute_unsigned_distance_field_cpu(M_in, aabb_tree, voxels);
+				// Facets are already in Morton order
+				GEO::MeshFacetsLeafAABB leaf_tree(M_in, false, CmdLine::get_arg_int("leaf_size"));
+				int band = CmdLine::get_arg_int("narrow_band");
+				std::unique_ptr<GEO::MeshFacetsPseudonormals> pseudonormals;
+				if (CmdLine::get_arg("sign") == "pseudonormal") {
+					if (band > 0 || CmdLine::get_arg_double("truncation") > 0.0) {
+						// Swept or truncated voxels have no nearest facet
+						Logger::warn("Sign") << "Pseudonormals are not used with a narrow band or a truncation" << std::endl;
+					} else {
+						pseudonormals.reset(new GEO::MeshFacetsPseudonormals(M_in));
+						is_signed = true;
+					}
+				}
+				if (band > 0) {
+					compute_unsigned_distance_field_narrow_band(M_in, leaf_tree, voxels, band);
+				} else if (CmdLine::get_arg_int("brick_size") > 0) {
+					compute_unsigned_distance_field_bricks(leaf_tree, voxels, CmdLine::get_arg_int("brick_size"),
+						pseudonormals.get(), channels.get());
+				} else {
+					compute_unsigned_distance_field_cpu(M_in, leaf_tree, voxels, pseudonormals.get(), channels.get());
+				}
 			}
 		}
 
 		// Compute inside/outside info
-		Logger::div("Computing inside/outside info");
-		compute_sign(M_in, aabb_tree, voxels);
+		if (!is_signed) {
+			Logger::div("Computing inside/outside info");
+			compute_sign(M_in, aabb_tree, voxels);
+		}
 
 		// Sample points inside the voxels
 		//std::vector<vec3> pts;
@@ -680,6 +1385,14 @@ int main(int argc, char** argv) {
 		// } else {
 			paraview_dump(output_basename, voxels);
 		// }
+		if (channels) {
+			if (channels->has(VoxelChannels::FACET)) {
+				for (int32_t &f : channels->facet()) {
+					if (f >= 0) { f = (int32_t) input_facet[f]; }
+				}
+			}
+			paraview_dump_channels(output_basename, voxels, *channels);
+		}
 
 	} catch (const std::exception& e) {
 		std::cerr << "Received an exception: " << e.what() << std::endl;
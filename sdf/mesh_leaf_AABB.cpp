@@ -0,0 +1,803 @@
+#include "mesh_leaf_AABB.h"
+#include <geogram/mesh/mesh_reorder.h>
+#include <geogram/mesh/mesh_geometry.h>
+#include <geogram/mesh/mesh_repair.h>
+#include <algorithm>
+
+// The AVX2 kernel is compiled for its own function only, and selected at
+// runtime, so that the binary still runs on CPUs without AVX2
+#if defined(SDF_WITH_AVX2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SDF_USE_AVX2
+#define SDF_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    using namespace GEO;
+
+    /**
+     * \brief Fields stored for each triangle (a, b, c) of a packet.
+     * \details The normal is n = (b-a) x (c-a). Inverse squared lengths
+     *  of degenerate edges/normals are set to zero.
+     */
+    enum PacketField {
+        A_X, A_Y, A_Z,
+        AB_X, AB_Y, AB_Z,
+        AC_X, AC_Y, AC_Z,
+        N_X, N_Y, N_Z,
+        INV_AB2, INV_AC2, INV_BC2, INV_N2,
+        NB_FIELDS
+    };
+
+    const index_t PACKET_SIZE = MeshFacetsLeafAABB::PACKET_SIZE;
+
+    /**
+     * \brief Computes the axis-aligned bounding box of a mesh facet.
+     * \param[in] M the mesh
+     * \param[out] B the bounding box of the facet
+     * \param[in] f the index of the facet in mesh \p M
+     */
+    void get_facet_bbox(
+        const Mesh& M, Box& B, index_t f
+    ) {
+        index_t c = M.facets.corners_begin(f);
+        const double* p = M.vertices.point_ptr(M.facet_corners.vertex(c));
+        for(coord_index_t coord = 0; coord < 3; ++coord) {
+            B.xyz_min[coord] = p[coord];
+            B.xyz_max[coord] = p[coord];
+        }
+        for(++c; c < M.facets.corners_end(f); ++c) {
+            p = M.vertices.point_ptr(M.facet_corners.vertex(c));
+            for(coord_index_t coord = 0; coord < 3; ++coord) {
+                B.xyz_min[coord] = std::min(B.xyz_min[coord], p[coord]);
+                B.xyz_max[coord] = std::max(B.xyz_max[coord], p[coord]);
+            }
+        }
+    }
+
+    /**
+     * \brief Computes the maximum node index in a subtree
+     * \param[in] node_index node index of the root of the subtree
+     * \param[in] b first facet index in the subtree
+     * \param[in] e one position past the last facet index in the subtree
+     * \param[in] leaf_size maximum number of facets in a leaf
+     * \return the maximum node index in the subtree rooted at \p node_index
+     */
+    index_t max_node_index(
+        index_t node_index, index_t b, index_t e, index_t leaf_size
+    ) {
+        geo_debug_assert(e > b);
+        if(e - b <= leaf_size) {
+            return node_index;
+        }
+        index_t m = b + (e - b) / 2;
+        index_t childl = 2 * node_index;
+        index_t childr = 2 * node_index + 1;
+        return std::max(
+            max_node_index(childl, b, m, leaf_size),
+            max_node_index(childr, m, e, leaf_size)
+        );
+    }
+
+    /**
+     * \brief Stores a triangle in a lane of a packet.
+     * \param[in] M the mesh
+     * \param[in] f the index of the facet in mesh \p M
+     * \param[out] packet pointer to the first value of the packet
+     * \param[in] lane index of the lane in the packet
+     */
+    void store_triangle(
+        const Mesh& M, index_t f, double* packet, index_t lane
+    ) {
+        geo_debug_assert(M.facets.nb_vertices(f) == 3);
+        const vec3& a = Geom::mesh_vertex(M, M.facets.vertex(f, 0));
+        const vec3& b = Geom::mesh_vertex(M, M.facets.vertex(f, 1));
+        const vec3& c = Geom::mesh_vertex(M, M.facets.vertex(f, 2));
+        const vec3 ab = b - a;
+        const vec3 ac = c - a;
+        const vec3 n = cross(ab, ac);
+        const double values[NB_FIELDS] = {
+            a[0], a[1], a[2],
+            ab[0], ab[1], ab[2],
+            ac[0], ac[1], ac[2],
+            n[0], n[1], n[2],
+            length2(ab), length2(ac), length2(c - b), length2(n)
+        };
+        for(index_t k = 0; k < NB_FIELDS; ++k) {
+            double v = values[k];
+            if(k >= INV_AB2) {
+                v = (v > 0.0 ? 1.0 / v : 0.0);
+            }
+            packet[k * PACKET_SIZE + lane] = v;
+        }
+    }
+
+    /**
+     * \brief Computes the hierarchy of bounding boxes recursively,
+     *  and stores the triangles of the leaves in packets.
+     * \param[in] M the mesh
+     * \param[in] leaf_size maximum number of facets in a leaf
+     * \param[in] bboxes the array of bounding boxes
+     * \param[in] leaf_packet index of the first packet of each leaf
+     * \param[in] packets the packets of triangles
+     * \param[in] packet_facets the facet stored in each lane of the packets
+     * \param[in] packet_bboxes the bounding box of each packet
+     * \param[in] node_index the index of the root of the subtree
+     * \param[in] b first facet index in the subtree
+     * \param[in] e one position past the last facet index in the subtree
+     */
+    void init_bboxes_recursive(
+        const Mesh& M, index_t leaf_size,
+        vector<Box>& bboxes, vector<index_t>& leaf_packet,
+        vector<double>& packets, vector<index_t>& packet_facets,
+        vector<Box>& packet_bboxes,
+        index_t node_index, index_t b, index_t e
+    ) {
+        geo_debug_assert(node_index < bboxes.size());
+        geo_debug_assert(b != e);
+        if(e - b <= leaf_size) {
+            get_facet_bbox(M, bboxes[node_index], b);
+            for(index_t f = b + 1; f < e; ++f) {
+                Box B;
+                get_facet_bbox(M, B, f);
+                bbox_union(bboxes[node_index], bboxes[node_index], B);
+            }
+
+            // Unused lanes of the last packet repeat the last facet
+            index_t first = index_t(packets.size()) / (NB_FIELDS * PACKET_SIZE);
+            index_t nb_packets = (e - b + PACKET_SIZE - 1) / PACKET_SIZE;
+            leaf_packet[node_index] = first;
+            packets.resize(packets.size() + nb_packets * NB_FIELDS * PACKET_SIZE);
+            for(index_t k = 0; k < nb_packets * PACKET_SIZE; ++k) {
+                double* packet = &packets[(first + k / PACKET_SIZE) * NB_FIELDS * PACKET_SIZE];
+                store_triangle(M, std::min(b + k, e - 1), packet, k % PACKET_SIZE);
+                packet_facets.push_back(std::min(b + k, e - 1));
+            }
+            for(index_t k = 0; k < nb_packets; ++k) {
+                Box B;
+                get_facet_bbox(M, B, b + k * PACKET_SIZE);
+                for(index_t f = b + k * PACKET_SIZE + 1; f < std::min(b + (k + 1) * PACKET_SIZE, e); ++f) {
+                    Box F;
+                    get_facet_bbox(M, F, f);
+                    bbox_union(B, B, F);
+                }
+                packet_bboxes.push_back(B);
+            }
+            return;
+        }
+        index_t m = b + (e - b) / 2;
+        index_t childl = 2 * node_index;
+        index_t childr = 2 * node_index + 1;
+        init_bboxes_recursive(M, leaf_size, bboxes, leaf_packet, packets, packet_facets, packet_bboxes, childl, b, m);
+        init_bboxes_recursive(M, leaf_size, bboxes, leaf_packet, packets, packet_facets, packet_bboxes, childr, m, e);
+        bbox_union(bboxes[node_index], bboxes[childl], bboxes[childr]);
+    }
+
+#ifdef SDF_USE_AVX2
+
+    SDF_TARGET_AVX2 inline __m256d dot3(
+        __m256d ax, __m256d ay, __m256d az,
+        __m256d bx, __m256d by, __m256d bz
+    ) {
+        return _mm256_add_pd(
+            _mm256_mul_pd(ax, bx),
+            _mm256_add_pd(_mm256_mul_pd(ay, by), _mm256_mul_pd(az, bz))
+        );
+    }
+
+    // Determinant of (u, v, n), i.e. dot(cross(u, v), n)
+    SDF_TARGET_AVX2 inline __m256d det3(
+        __m256d ux, __m256d uy, __m256d uz,
+        __m256d vx, __m256d vy, __m256d vz,
+        __m256d nx, __m256d ny, __m256d nz
+    ) {
+        return dot3(
+            _mm256_sub_pd(_mm256_mul_pd(uy, vz), _mm256_mul_pd(uz, vy)),
+            _mm256_sub_pd(_mm256_mul_pd(uz, vx), _mm256_mul_pd(ux, vz)),
+            _mm256_sub_pd(_mm256_mul_pd(ux, vy), _mm256_mul_pd(uy, vx)),
+            nx, ny, nz
+        );
+    }
+
+    // Squared distance from p to the segment [a, a+u], where d = p - a
+    SDF_TARGET_AVX2 inline __m256d segment_sq_dist(
+        __m256d dx, __m256d dy, __m256d dz,
+        __m256d ux, __m256d uy, __m256d uz,
+        __m256d inv_u2
+    ) {
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d one = _mm256_set1_pd(1.0);
+        __m256d t = _mm256_mul_pd(dot3(dx, dy, dz, ux, uy, uz), inv_u2);
+        t = _mm256_min_pd(_mm256_max_pd(t, zero), one);
+        dx = _mm256_sub_pd(dx, _mm256_mul_pd(t, ux));
+        dy = _mm256_sub_pd(dy, _mm256_mul_pd(t, uy));
+        dz = _mm256_sub_pd(dz, _mm256_mul_pd(t, uz));
+        return dot3(dx, dy, dz, dx, dy, dz);
+    }
+
+    /**
+     * \brief Computes the squared distances between a point and the
+     *  triangles of a packet.
+     * \param[in] packet pointer to the first value of the packet
+     * \param[in] p the query point
+     * \param[out] sq_dist the PACKET_SIZE squared distances
+     */
+    SDF_TARGET_AVX2 void packet_squared_distances_avx2(
+        const double* packet, const vec3& p, double* sq_dist
+    ) {
+        geo_static_assert(PACKET_SIZE == 4);
+        #define LOAD(field) _mm256_loadu_pd(packet + (field) * PACKET_SIZE)
+        const __m256d zero = _mm256_setzero_pd();
+
+        // ap = p - a, bp = p - b, cp = p - c, bc = c - b
+        const __m256d abx = LOAD(AB_X), aby = LOAD(AB_Y), abz = LOAD(AB_Z);
+        const __m256d acx = LOAD(AC_X), acy = LOAD(AC_Y), acz = LOAD(AC_Z);
+        const __m256d nx = LOAD(N_X), ny = LOAD(N_Y), nz = LOAD(N_Z);
+        const __m256d apx = _mm256_sub_pd(_mm256_set1_pd(p[0]), LOAD(A_X));
+        const __m256d apy = _mm256_sub_pd(_mm256_set1_pd(p[1]), LOAD(A_Y));
+        const __m256d apz = _mm256_sub_pd(_mm256_set1_pd(p[2]), LOAD(A_Z));
+        const __m256d bpx = _mm256_sub_pd(apx, abx);
+        const __m256d bpy = _mm256_sub_pd(apy, aby);
+        const __m256d bpz = _mm256_sub_pd(apz, abz);
+        const __m256d cpx = _mm256_sub_pd(apx, acx);
+        const __m256d cpy = _mm256_sub_pd(apy, acy);
+        const __m256d cpz = _mm256_sub_pd(apz, acz);
+        const __m256d bcx = _mm256_sub_pd(acx, abx);
+        const __m256d bcy = _mm256_sub_pd(acy, aby);
+        const __m256d bcz = _mm256_sub_pd(acz, abz);
+
+        // The projection of p is inside the triangle iff it is on the
+        // inner side of the three edges
+        const __m256d inv_n2 = LOAD(INV_N2);
+        __m256d inside = _mm256_cmp_pd(inv_n2, zero, _CMP_GT_OQ);
+        inside = _mm256_and_pd(inside, _mm256_cmp_pd(
+            det3(abx, aby, abz, apx, apy, apz, nx, ny, nz), zero, _CMP_GE_OQ));
+        inside = _mm256_and_pd(inside, _mm256_cmp_pd(
+            det3(bcx, bcy, bcz, bpx, bpy, bpz, nx, ny, nz), zero, _CMP_GE_OQ));
+        inside = _mm256_and_pd(inside, _mm256_cmp_pd(
+            det3(cpx, cpy, cpz, acx, acy, acz, nx, ny, nz), zero, _CMP_GE_OQ));
+
+        // Distance to the supporting plane
+        const __m256d h = dot3(apx, apy, apz, nx, ny, nz);
+        const __m256d plane = _mm256_mul_pd(_mm256_mul_pd(h, h), inv_n2);
+
+        // Distance to the closest edge
+        __m256d edge = segment_sq_dist(apx, apy, apz, abx, aby, abz, LOAD(INV_AB2));
+        edge = _mm256_min_pd(edge, segment_sq_dist(apx, apy, apz, acx, acy, acz, LOAD(INV_AC2)));
+        edge = _mm256_min_pd(edge, segment_sq_dist(bpx, bpy, bpz, bcx, bcy, bcz, LOAD(INV_BC2)));
+
+        _mm256_storeu_pd(sq_dist, _mm256_blendv_pd(edge, plane, inside));
+        #undef LOAD
+    }
+
+    // Whether the CPU running the program supports AVX2
+    const bool cpu_has_avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+
+#endif
+
+    // Squared distance from p to the segment [a, a+u], where d = p - a
+    inline double segment_sq_dist(
+        double dx, double dy, double dz,
+        double ux, double uy, double uz,
+        double inv_u2
+    ) {
+        double t = (dx * ux + dy * uy + dz * uz) * inv_u2;
+        t = std::min(std::max(t, 0.0), 1.0);
+        dx -= t * ux;
+        dy -= t * uy;
+        dz -= t * uz;
+        return dx * dx + dy * dy + dz * dz;
+    }
+
+    /**
+     * \brief Computes the squared distances between a point and the
+     *  triangles of a packet.
+     * \details Portable version of the AVX2 kernel. The loop over the
+     *  lanes is branch-free, so that the compiler can vectorize it.
+     * \param[in] packet pointer to the first value of the packet
+     * \param[in] p the query point
+     * \param[out] sq_dist the PACKET_SIZE squared distances
+     */
+    void packet_squared_distances_scalar(
+        const double* packet, const vec3& p, double* sq_dist
+    ) {
+        #define FIELD(field) packet[(field) * PACKET_SIZE + i]
+        for(index_t i = 0; i < PACKET_SIZE; ++i) {
+            const double abx = FIELD(AB_X), aby = FIELD(AB_Y), abz = FIELD(AB_Z);
+            const double acx = FIELD(AC_X), acy = FIELD(AC_Y), acz = FIELD(AC_Z);
+            const double nx = FIELD(N_X), ny = FIELD(N_Y), nz = FIELD(N_Z);
+            const double apx = p[0] - FIELD(A_X);
+            const double apy = p[1] - FIELD(A_Y);
+            const double apz = p[2] - FIELD(A_Z);
+            const double bpx = apx - abx, bpy = apy - aby, bpz = apz - abz;
+            const double cpx = apx - acx, cpy = apy - acy, cpz = apz - acz;
+            const double bcx = acx - abx, bcy = acy - aby, bcz = acz - abz;
+
+            // The projection of p is inside the triangle iff it is on the
+            // inner side of the three edges
+            const double d1 = (aby * apz - abz * apy) * nx
+                + (abz * apx - abx * apz) * ny + (abx * apy - aby * apx) * nz;
+            const double d2 = (bcy * bpz - bcz * bpy) * nx
+                + (bcz * bpx - bcx * bpz) * ny + (bcx * bpy - bcy * bpx) * nz;
+            const double d3 = (cpy * acz - cpz * acy) * nx
+                + (cpz * acx - cpx * acz) * ny + (cpx * acy - cpy * acx) * nz;
+            const bool inside = FIELD(INV_N2) > 0.0 && d1 >= 0.0 && d2 >= 0.0 && d3 >= 0.0;
+
+            // Distance to the supporting plane
+            const double h = apx * nx + apy * ny + apz * nz;
+            const double plane = h * h * FIELD(INV_N2);
+
+            // Distance to the closest edge
+            double edge = segment_sq_dist(apx, apy, apz, abx, aby, abz, FIELD(INV_AB2));
+            edge = std::min(edge, segment_sq_dist(apx, apy, apz, acx, acy, acz, FIELD(INV_AC2)));
+            edge = std::min(edge, segment_sq_dist(bpx, bpy, bpz, bcx, bcy, bcz, FIELD(INV_BC2)));
+
+            sq_dist[i] = (inside ? plane : edge);
+        }
+        #undef FIELD
+    }
+
+    /**
+     * \brief Computes the squared distances between a point and the
+     *  triangles of a packet, with the AVX2 kernel if the CPU supports it.
+     * \param[in] packet pointer to the first value of the packet
+     * \param[in] p the query point
+     * \param[out] sq_dist the PACKET_SIZE squared distances
+     */
+    inline void packet_squared_distances(
+        const double* packet, const vec3& p, double* sq_dist
+    ) {
+#ifdef SDF_USE_AVX2
+        if(cpu_has_avx2) {
+            packet_squared_distances_avx2(packet, p, sq_dist);
+            return;
+        }
+#endif
+        packet_squared_distances_scalar(packet, p, sq_dist);
+    }
+
+    /**
+     * \brief Finds the nearest point in a mesh facet from a query point.
+     * \param[in] M the mesh
+     * \param[in] p the query point
+     * \param[in] f index of the facet in \p M
+     * \param[out] nearest_p the point of facet \p f nearest to \p p
+     * \param[out] squared_dist the squared distance between
+     *  \p p and \p nearest_p
+     * \pre the mesh \p M is triangulated
+     */
+    void get_point_facet_nearest_point(
+        const Mesh& M,
+        const vec3& p,
+        index_t f,
+        vec3& nearest_p,
+        double& squared_dist
+    ) {
+        geo_debug_assert(M.facets.nb_vertices(f) == 3);
+        const vec3& p1 = Geom::mesh_vertex(M, M.facets.vertex(f, 0));
+        const vec3& p2 = Geom::mesh_vertex(M, M.facets.vertex(f, 1));
+        const vec3& p3 = Geom::mesh_vertex(M, M.facets.vertex(f, 2));
+        double lambda1, lambda2, lambda3;  // barycentric coords, not used.
+        squared_dist = Geom::point_triangle_squared_distance(
+            p, p1, p2, p3, nearest_p, lambda1, lambda2, lambda3
+        );
+    }
+
+    /**
+     * \brief Computes the squared distance between a point and a Box
+     *  with negative sign if the point is inside the Box.
+     * \param[in] p the point
+     * \param[in] B the box
+     * \return the signed squared distance between \p p and \p B
+     */
+    double point_box_signed_squared_distance(
+        const vec3& p,
+        const Box& B
+    ) {
+        bool inside = true;
+        double result = 0.0;
+        for(coord_index_t c = 0; c < 3; c++) {
+            if(p[c] < B.xyz_min[c]) {
+                inside = false;
+                result += geo_sqr(p[c] - B.xyz_min[c]);
+            } else if(p[c] > B.xyz_max[c]) {
+                inside = false;
+                result += geo_sqr(p[c] - B.xyz_max[c]);
+            }
+        }
+        if(inside) {
+            result = geo_sqr(p[0] - B.xyz_min[0]);
+            for(coord_index_t c = 0; c < 3; ++c) {
+                result = std::min(result, geo_sqr(p[c] - B.xyz_min[c]));
+                result = std::min(result, geo_sqr(p[c] - B.xyz_max[c]));
+            }
+            result = -result;
+        }
+        return result;
+    }
+
+    /**
+     * \brief Computes the squared distance between a point and the
+     *  center of a box.
+     * \param[in] p the point
+     * \param[in] B the box
+     * \return the squared distance between \p p and the center of \p B
+     */
+    double point_box_center_squared_distance(
+        const vec3& p, const Box& B
+    ) {
+        double result = 0.0;
+        for(coord_index_t c = 0; c < 3; ++c) {
+            double d = p[c] - 0.5 * (B.xyz_min[c] + B.xyz_max[c]);
+            result += geo_sqr(d);
+        }
+        return result;
+    }
+
+    /**
+     * \brief Computes the squared distance between two boxes.
+     * \param[in] A the first box
+     * \param[in] B the second box
+     * \return the squared distance between \p A and \p B, or zero
+     *  if they overlap
+     */
+    double box_box_squared_distance(
+        const Box& A, const Box& B
+    ) {
+        double result = 0.0;
+        for(coord_index_t c = 0; c < 3; ++c) {
+            if(A.xyz_max[c] < B.xyz_min[c]) {
+                result += geo_sqr(B.xyz_min[c] - A.xyz_max[c]);
+            } else if(B.xyz_max[c] < A.xyz_min[c]) {
+                result += geo_sqr(A.xyz_min[c] - B.xyz_max[c]);
+            }
+        }
+        return result;
+    }
+
+}
+
+/****************************************************************************/
+
+namespace GEO {
+
+    MeshFacetsLeafAABB::MeshFacetsLeafAABB(
+        Mesh& M, bool reorder, index_t leaf_size
+    ) :
+        leaf_size_(std::max(leaf_size, index_t(1))),
+        mesh_(M) {
+        if(!M.facets.are_simplices()) {
+            mesh_repair(
+                M, MeshRepairMode(MESH_REPAIR_TRIANGULATE | MESH_REPAIR_QUIET)
+            );
+        }
+        if(reorder) {
+            mesh_reorder(mesh_, MESH_ORDER_MORTON);
+        }
+        if(mesh_.facets.nb() == 0) {
+            return;
+        }
+        index_t nb_nodes = max_node_index(
+            1, 0, mesh_.facets.nb(), leaf_size_
+        ) + 1; // <-- this is because size == max_index + 1 !!!
+        bboxes_.resize(nb_nodes);
+        leaf_packet_.assign(nb_nodes, index_t(-1));
+        packets_.reserve(
+            (mesh_.facets.nb() / PACKET_SIZE + 1) * 2 * NB_FIELDS * PACKET_SIZE
+        );
+        packet_facets_.reserve(packets_.capacity() / NB_FIELDS);
+        init_bboxes_recursive(
+            mesh_, leaf_size_, bboxes_, leaf_packet_, packets_, packet_facets_,
+            packet_bboxes_, 1, 0, mesh_.facets.nb()
+        );
+    }
+
+    void MeshFacetsLeafAABB::get_nearest_facet_hint(
+        const vec3& p,
+        index_t& nearest_f, vec3& nearest_point, double& sq_dist
+    ) const {
+        // Same as MeshFacetsAABB: follow the child whose box center is
+        // nearest, down to a leaf, and take its first facet.
+        index_t b = 0;
+        index_t e = mesh_.facets.nb();
+        index_t n = 1;
+        while(!is_leaf(b, e)) {
+            index_t m = b + (e - b) / 2;
+            index_t childl = 2 * n;
+            index_t childr = 2 * n + 1;
+            if(
+                point_box_center_squared_distance(p, bboxes_[childl]) <
+                point_box_center_squared_distance(p, bboxes_[childr])
+            ) {
+                e = m;
+                n = childl;
+            } else {
+                b = m;
+                n = childr;
+            }
+        }
+        nearest_f = b;
+
+        index_t v = mesh_.facet_corners.vertex(
+            mesh_.facets.corners_begin(nearest_f)
+        );
+        nearest_point = Geom::mesh_vertex(mesh_, v);
+        sq_dist = Geom::distance2(p, nearest_point);
+    }
+
+    index_t MeshFacetsLeafAABB::leaf_nearest_facet(
+        const vec3& p, index_t n, index_t b, index_t e, double& sq_dist
+    ) const {
+        geo_debug_assert(leaf_packet_[n] != index_t(-1));
+        const index_t nb_packets = (e - b + PACKET_SIZE - 1) / PACKET_SIZE;
+        const double* packet = &packets_[leaf_packet_[n] * NB_FIELDS * PACKET_SIZE];
+        index_t nearest = 0;
+        sq_dist = Numeric::max_float64();
+        double dist[PACKET_SIZE];
+        for(index_t k = 0; k < nb_packets; ++k, packet += NB_FIELDS * PACKET_SIZE) {
+            packet_squared_distances(packet, p, dist);
+            for(index_t i = 0; i < PACKET_SIZE; ++i) {
+                if(dist[i] < sq_dist) {
+                    sq_dist = dist[i];
+                    nearest = k * PACKET_SIZE + i;
+                }
+            }
+        }
+        return std::min(b + nearest, e - 1);
+    }
+
+    void MeshFacetsLeafAABB::nearest_facet_recursive(
+        const vec3& p,
+        index_t& nearest_f, vec3& nearest_point, double& sq_dist,
+        index_t n, index_t b, index_t e
+    ) const {
+        geo_debug_assert(e > b);
+
+        // If node is a leaf: compute the distances to all its facets
+        // at once, and replace current if nearer
+        if(is_leaf(b, e)) {
+            double cur_sq_dist;
+            index_t f = leaf_nearest_facet(p, n, b, e, cur_sq_dist);
+            if(cur_sq_dist < sq_dist) {
+                // The nearest point (and the reference distance) are
+                // recomputed with the exact same routine as MeshFacetsAABB
+                vec3 cur_nearest_point;
+                get_point_facet_nearest_point(
+                    mesh_, p, f, cur_nearest_point, cur_sq_dist
+                );
+                if(cur_sq_dist < sq_dist) {
+                    nearest_f = f;
+                    nearest_point = cur_nearest_point;
+                    sq_dist = cur_sq_dist;
+                }
+            }
+            return;
+        }
+        index_t m = b + (e - b) / 2;
+        index_t childl = 2 * n;
+        index_t childr = 2 * n + 1;
+
+        double dl = point_box_signed_squared_distance(p, bboxes_[childl]);
+        double dr = point_box_signed_squared_distance(p, bboxes_[childr]);
+
+        // Traverse the "nearest" child first, so that it has more chances
+        // to prune the traversal of the other child.
+        if(dl < dr) {
+            if(dl < sq_dist) {
+                nearest_facet_recursive(
+                    p,
+                    nearest_f, nearest_point, sq_dist,
+                    childl, b, m
+                );
+            }
+            if(dr < sq_dist) {
+                nearest_facet_recursive(
+                    p,
+                    nearest_f, nearest_point, sq_dist,
+                    childr, m, e
+                );
+            }
+        } else {
+            if(dr < sq_dist) {
+                nearest_facet_recursive(
+                    p,
+                    nearest_f, nearest_point, sq_dist,
+                    childr, m, e
+                );
+            }
+            if(dl < sq_dist) {
+                nearest_facet_recursive(
+                    p,
+                    nearest_f, nearest_point, sq_dist,
+                    childl, b, m
+                );
+            }
+        }
+    }
+
+
+    void MeshFacetsLeafAABB::get_block_candidates(
+        const Box& block, BlockCandidates& candidates, double max_dist
+    ) const {
+        candidates.packets.clear();
+        candidates.distances.clear();
+        if(mesh_.facets.nb() == 0) {
+            return;
+        }
+        vec3& c = candidates.center;
+        double r2 = 0.0;
+        for(coord_index_t coord = 0; coord < 3; ++coord) {
+            c[coord] = 0.5 * (block.xyz_min[coord] + block.xyz_max[coord]);
+            r2 += geo_sqr(0.5 * (block.xyz_max[coord] - block.xyz_min[coord]));
+        }
+        // Relative slack, so that rounding errors of the packet kernel
+        // never cull the nearest facet
+        const double r = std::sqrt(r2) * (1.0 + 1e-9);
+        max_dist *= (1.0 + 1e-9);
+
+        // Every point of the box is farther than max_dist if c is farther
+        // than max_dist + r
+        vec3 nearest_point;
+        double sq_dist;
+        if(nearest_facet_within(
+            c, geo_sqr(max_dist + r), nearest_point, sq_dist
+        ) == NO_FACET) {
+            return;
+        }
+        const double d = std::min(
+            std::sqrt(sq_dist) * (1.0 + 1e-9) + r, max_dist
+        );
+        vector<std::pair<double, index_t> > packets;
+        block_candidates_recursive(
+            block, c, geo_sqr(d), geo_sqr(d + r), packets,
+            1, 0, mesh_.facets.nb()
+        );
+        std::sort(packets.begin(), packets.end());
+        candidates.packets.reserve(packets.size());
+        candidates.distances.reserve(packets.size());
+        for(index_t k = 0; k < packets.size(); ++k) {
+            candidates.distances.push_back(std::sqrt(packets[k].first));
+            candidates.packets.push_back(packets[k].second);
+        }
+    }
+
+    void MeshFacetsLeafAABB::refine_block_candidates(
+        const Box& block, const BlockCandidates& parent,
+        BlockCandidates& candidates, double max_dist
+    ) const {
+        candidates.packets.clear();
+        candidates.distances.clear();
+        vec3& c = candidates.center;
+        double r2 = 0.0;
+        for(coord_index_t coord = 0; coord < 3; ++coord) {
+            c[coord] = 0.5 * (block.xyz_min[coord] + block.xyz_max[coord]);
+            r2 += geo_sqr(0.5 * (block.xyz_max[coord] - block.xyz_min[coord]));
+        }
+        vec3 nearest_point;
+        double sq_dist;
+        if(nearest_facet_in_block(c, parent, nearest_point, sq_dist) == NO_FACET) {
+            return;
+        }
+
+        // Same bound as get_block_candidates(), tested on the bounding box
+        // of each packet first
+        const double r = std::sqrt(r2) * (1.0 + 1e-9);
+        const double d = std::min(
+            std::sqrt(sq_dist) * (1.0 + 1e-9) + r, max_dist * (1.0 + 1e-9)
+        );
+        const double center_sq_bound = geo_sqr(d + r);
+        vector<std::pair<double, index_t> > packets;
+        double dist[PACKET_SIZE];
+        for(index_t k = 0; k < parent.packets.size(); ++k) {
+            const index_t packet = parent.packets[k];
+            if(point_box_signed_squared_distance(c, packet_bboxes_[packet]) > center_sq_bound) {
+                continue;
+            }
+            packet_squared_distances(
+                &packets_[packet * NB_FIELDS * PACKET_SIZE], c, dist
+            );
+            double min_dist = dist[0];
+            for(index_t i = 1; i < PACKET_SIZE; ++i) {
+                min_dist = std::min(min_dist, dist[i]);
+            }
+            if(min_dist <= center_sq_bound) {
+                packets.push_back(std::make_pair(min_dist, packet));
+            }
+        }
+        std::sort(packets.begin(), packets.end());
+        candidates.packets.reserve(packets.size());
+        candidates.distances.reserve(packets.size());
+        for(index_t k = 0; k < packets.size(); ++k) {
+            candidates.distances.push_back(std::sqrt(packets[k].first));
+            candidates.packets.push_back(packets[k].second);
+        }
+    }
+
+    void MeshFacetsLeafAABB::block_candidates_recursive(
+        const Box& block, const vec3& c,
+        double box_sq_bound, double center_sq_bound,
+        vector<std::pair<double, index_t> >& packets,
+        index_t n, index_t b, index_t e
+    ) const {
+        geo_debug_assert(e > b);
+        if(box_box_squared_distance(block, bboxes_[n]) > box_sq_bound) {
+            return;
+        }
+        if(is_leaf(b, e)) {
+            const index_t nb_packets = (e - b + PACKET_SIZE - 1) / PACKET_SIZE;
+            double dist[PACKET_SIZE];
+            for(index_t k = 0; k < nb_packets; ++k) {
+                const index_t packet = leaf_packet_[n] + k;
+                packet_squared_distances(
+                    &packets_[packet * NB_FIELDS * PACKET_SIZE], c, dist
+                );
+                double min_dist = dist[0];
+                for(index_t i = 1; i < PACKET_SIZE; ++i) {
+                    min_dist = std::min(min_dist, dist[i]);
+                }
+                if(min_dist <= center_sq_bound) {
+                    packets.push_back(std::make_pair(min_dist, packet));
+                }
+            }
+            return;
+        }
+        index_t m = b + (e - b) / 2;
+        block_candidates_recursive(
+            block, c, box_sq_bound, center_sq_bound, packets, 2 * n, b, m
+        );
+        block_candidates_recursive(
+            block, c, box_sq_bound, center_sq_bound, packets, 2 * n + 1, m, e
+        );
+    }
+
+    void MeshFacetsLeafAABB::nearest_facet_in_block_with_hint(
+        const vec3& p, const BlockCandidates& candidates,
+        index_t& nearest_f, vec3& nearest_point, double& sq_dist
+    ) const {
+        if(nearest_f == NO_FACET) {
+            sq_dist = Numeric::max_float64();
+        }
+        // Slightly enlarged, so that rounding errors never stop the scan
+        // too early
+        const double r = length(p - candidates.center) * (1.0 + 1e-9);
+        index_t nearest = NO_FACET;
+        double best = sq_dist;
+        double dist[PACKET_SIZE];
+        for(index_t k = 0; k < candidates.packets.size(); ++k) {
+            const double lower = candidates.distances[k] - r;
+            if(lower > 0.0 && lower * lower > best) {
+                break;
+            }
+            const index_t packet = candidates.packets[k];
+            if(point_box_signed_squared_distance(p, packet_bboxes_[packet]) >= best) {
+                continue;
+            }
+            packet_squared_distances(
+                &packets_[packet * NB_FIELDS * PACKET_SIZE], p, dist
+            );
+            for(index_t i = 0; i < PACKET_SIZE; ++i) {
+                if(dist[i] < best) {
+                    best = dist[i];
+                    nearest = packet * PACKET_SIZE + i;
+                }
+            }
+        }
+        if(nearest == NO_FACET) {
+            return;
+        }
+        // Same exact routine as nearest_facet_recursive()
+        const index_t f = packet_facets_[nearest];
+        vec3 cur_nearest_point;
+        double cur_sq_dist;
+        get_point_facet_nearest_point(
+            mesh_, p, f, cur_nearest_point, cur_sq_dist
+        );
+        if(nearest_f == NO_FACET || cur_sq_dist < sq_dist) {
+            nearest_f = f;
+            nearest_point = cur_nearest_point;
+            sq_dist = cur_sq_dist;
+        }
+    }
+
+}
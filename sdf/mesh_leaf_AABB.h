@@ -0,0 +1,351 @@
+#ifndef GEOGRAM_MESH_MESH_LEAF_AABB
+#define GEOGRAM_MESH_MESH_LEAF_AABB
+
+/**
+ * \file mesh_leaf_AABB.h
+ * \brief Axis Aligned Bounding Box tree of mesh facets with
+ *  multi-triangle leaves, for fast nearest facet queries.
+ */
+
+#include <geogram/basic/common.h>
+#include <geogram/mesh/mesh.h>
+#include <geogram/basic/geometry.h>
+#include <utility>
+
+namespace GEO {
+
+    /**
+     * \brief Axis Aligned Bounding Box tree of mesh facets, where each
+     *  leaf stores a small bucket of triangles.
+     * \details The tree has the same implicit layout as MeshFacetsAABB
+     *  (children of node n are 2n and 2n+1), but the recursion stops as
+     *  soon as a node contains at most leaf_size() facets. The triangles
+     *  of each leaf are stored as structure-of-arrays packets, so that the
+     *  distances from a query point to all the triangles of a leaf are
+     *  computed at once (with AVX2 when available).
+     */
+    class MeshFacetsLeafAABB {
+    public:
+        /**
+         * \brief Number of triangles processed together by the
+         *  distance kernel.
+         */
+        static const index_t PACKET_SIZE = 4;
+
+        /**
+         * \brief Creates the Axis Aligned Bounding Boxes tree.
+         * \param[in] M the input mesh. It can be modified,
+         *  and will be triangulated (if
+         *  not already a triangular mesh). The facets are
+         *  re-ordered (using Morton's order, see mesh_reorder()).
+         * \param[in] reorder if not set, Morton re-ordering is
+         *  skipped (but it means that mesh_reorder() was previously
+         *  called else the algorithm will be pretty unefficient).
+         * \param[in] leaf_size maximum number of facets in a leaf.
+         *  Since nodes are split in halves, leaves contain between
+         *  leaf_size/2 and leaf_size facets.
+         * \pre M.facets.are_simplices()
+         */
+        MeshFacetsLeafAABB(Mesh& M, bool reorder = true, index_t leaf_size = 8);
+
+        /**
+         * \brief Gets the mesh.
+         * \return a const reference to the mesh.
+         */
+        const Mesh& mesh() const {
+            return mesh_;
+        }
+
+        /**
+         * \brief Gets the maximum number of facets in a leaf.
+         */
+        index_t leaf_size() const {
+            return leaf_size_;
+        }
+
+        /**
+         * \brief Finds the nearest facet from an arbitrary 3d query point.
+         * \param[in] p query point
+         * \param[out] nearest_point nearest point on the surface
+         * \param[out] sq_dist squared distance between p and the surface.
+         * \return the index of the facet nearest to point p.
+         */
+        index_t nearest_facet(
+            const vec3& p, vec3& nearest_point, double& sq_dist
+        ) const {
+            index_t nearest_facet;
+            get_nearest_facet_hint(p, nearest_facet, nearest_point, sq_dist);
+            nearest_facet_recursive(
+                p,
+                nearest_facet, nearest_point, sq_dist,
+                1, 0, mesh_.facets.nb()
+            );
+            return nearest_facet;
+        }
+
+        /**
+         * \brief Computes the nearest point and nearest facet from
+         * a query point, using user-specified hint.
+         * \param[in] p query point
+         * \param[in,out] nearest_facet the nearest facet so far,
+         *   or NO_FACET if not known yet
+         * \param[in,out] nearest_point a point in nearest_facet
+         * \param[in,out] sq_dist squared distance between p and
+         *    nearest_point
+         * \see MeshFacetsAABB::nearest_facet_with_hint()
+         */
+        void nearest_facet_with_hint(
+            const vec3& p,
+            index_t& nearest_facet, vec3& nearest_point, double& sq_dist
+        ) const {
+            if(nearest_facet == NO_FACET) {
+                get_nearest_facet_hint(
+                    p, nearest_facet, nearest_point, sq_dist
+                );
+            }
+            nearest_facet_recursive(
+                p,
+                nearest_facet, nearest_point, sq_dist,
+                1, 0, mesh_.facets.nb()
+            );
+        }
+
+        /**
+         * \brief Finds the nearest facet within a given distance of a
+         *  query point.
+         * \details Every node farther than \p max_sq_dist is pruned, so that
+         *  the query is almost free when the surface is far away.
+         * \param[in] p query point
+         * \param[in] max_sq_dist squared radius of the search
+         * \param[out] nearest_point nearest point on the surface, if found
+         * \param[out] sq_dist squared distance between p and the surface,
+         *  or \p max_sq_dist if it is larger
+         * \return the index of the facet nearest to point p, or NO_FACET
+         *  if the surface is farther than \p max_sq_dist
+         */
+        index_t nearest_facet_within(
+            const vec3& p, double max_sq_dist,
+            vec3& nearest_point, double& sq_dist
+        ) const {
+            index_t nearest_facet;
+            get_nearest_facet_hint(p, nearest_facet, nearest_point, sq_dist);
+            if(sq_dist > max_sq_dist) {
+                nearest_facet = NO_FACET;
+                sq_dist = max_sq_dist;
+            }
+            nearest_facet_recursive(
+                p,
+                nearest_facet, nearest_point, sq_dist,
+                1, 0, mesh_.facets.nb()
+            );
+            return nearest_facet;
+        }
+
+        /**
+         * \brief Computes the distance between an arbitrary 3d query
+         *  point and the surface.
+         * \param[in] p query point
+         * \return the squared distance between \p p and the surface.
+         */
+        double squared_distance(const vec3& p) const {
+            vec3 nearest_point;
+            double result;
+            nearest_facet(p, nearest_point, result);
+            return result;
+        }
+
+        /**
+         * \brief Packets of triangles that can contain the facet nearest
+         *  to a point of a box, see get_block_candidates().
+         */
+        struct BlockCandidates {
+            // Center of the box
+            vec3 center;
+
+            // Candidate packets, by increasing distance to the center
+            vector<index_t> packets;
+
+            // Distance from the center to the nearest triangle of each packet
+            vector<double> distances;
+        };
+
+        /**
+         * \brief Collects the packets of triangles that can contain the
+         *  facet nearest to a point of a box.
+         * \details A facet t can be nearest to a point v of the box only if
+         *  d(v, t) <= d(v) <= d(c) + r, where c is the center of the box and
+         *  r its half diagonal. Nodes whose bounding box is farther than
+         *  d(c) + r from the box are culled, and so are the packets whose
+         *  triangles are all farther than d(c) + 2r from c.
+         *  If only the facets within \p max_dist of the box are of interest,
+         *  d(c) + r is replaced by min(d(c) + r, max_dist), and there is no
+         *  candidate at all when the box is farther than max_dist.
+         * \param[in] block the query box
+         * \param[out] candidates the candidate packets
+         * \param[in] max_dist the distance beyond which the nearest facet
+         *  of a point of the box is not needed
+         */
+        void get_block_candidates(
+            const Box& block, BlockCandidates& candidates,
+            double max_dist = Numeric::max_float64()
+        ) const;
+
+        /**
+         * \brief Same as get_block_candidates(), for a box inside a box
+         *  whose candidates are known.
+         * \details The candidates are taken from those of the larger box,
+         *  without traversing the tree.
+         * \param[in] block the query box
+         * \param[in] parent the candidates of a box that contains \p block
+         * \param[out] candidates the candidate packets of \p block
+         * \param[in] max_dist same as in get_block_candidates(), at most
+         *  the one used for \p parent
+         */
+        void refine_block_candidates(
+            const Box& block, const BlockCandidates& parent,
+            BlockCandidates& candidates,
+            double max_dist = Numeric::max_float64()
+        ) const;
+
+        /**
+         * \brief Finds the nearest facet from a query point among
+         *  the candidates of a box.
+         * \param[in] p query point
+         * \param[in] candidates the candidates of a box that contains \p p,
+         *  as returned by get_block_candidates()
+         * \param[out] nearest_point nearest point on the surface
+         * \param[out] sq_dist squared distance between p and the surface
+         * \return the index of the facet nearest to point p, or NO_FACET
+         *  if there is no candidate
+         */
+        index_t nearest_facet_in_block(
+            const vec3& p, const BlockCandidates& candidates,
+            vec3& nearest_point, double& sq_dist
+        ) const {
+            index_t nearest_facet = NO_FACET;
+            nearest_facet_in_block_with_hint(
+                p, candidates, nearest_facet, nearest_point, sq_dist
+            );
+            return nearest_facet;
+        }
+
+        /**
+         * \brief Same as nearest_facet_in_block(), starting from a known
+         *  facet (or NO_FACET).
+         * \details Since d(p, t) >= d(c, t) - |p - c|, the scan stops at
+         *  the first packet that cannot beat the nearest facet found so far.
+         *  A good hint makes it stop earlier.
+         * \param[in] p query point
+         * \param[in] candidates the candidates of a box that contains \p p
+         * \param[in,out] nearest_facet the nearest facet so far,
+         *   or NO_FACET if not known yet
+         * \param[in,out] nearest_point a point in nearest_facet
+         * \param[in,out] sq_dist squared distance between p and
+         *    nearest_point
+         */
+        void nearest_facet_in_block_with_hint(
+            const vec3& p, const BlockCandidates& candidates,
+            index_t& nearest_facet, vec3& nearest_point, double& sq_dist
+        ) const;
+
+    protected:
+        /**
+         * \brief Tests whether a node of the tree is a leaf.
+         * \param[in] b index of the first facet in the node
+         * \param[in] e one position past the index of the last facet
+         */
+        bool is_leaf(index_t b, index_t e) const {
+            return e - b <= leaf_size_;
+        }
+
+        /**
+         * \brief Computes a reasonable initialization for
+         *  nearest facet search.
+         * \param[in] p query point
+         * \param[out] nearest_facet a facet reasonably near p
+         * \param[out] nearest_point a point in nearest_facet
+         * \param[out] sq_dist squared distance between p and nearest_point
+         */
+        void get_nearest_facet_hint(
+            const vec3& p,
+            index_t& nearest_facet, vec3& nearest_point, double& sq_dist
+        ) const;
+
+        /**
+         * \brief The recursive function used by the implementation
+         *  of nearest_facet().
+         * \param[in] p query point
+         * \param[in,out] nearest_facet the nearest facet so far,
+         * \param[in,out] nearest_point a point in nearest_facet
+         * \param[in,out] sq_dist squared distance between p and nearest_point
+         * \param[in] n index of the current node in the AABB tree
+         * \param[in] b index of the first facet in the subtree under node \p n
+         * \param[in] e one position past the index of the last facet in the
+         *  subtree under node \p n
+         */
+        void nearest_facet_recursive(
+            const vec3& p,
+            index_t& nearest_facet, vec3& nearest_point, double& sq_dist,
+            index_t n, index_t b, index_t e
+        ) const;
+
+        /**
+         * \brief Finds the nearest facet of a leaf from a query point.
+         * \param[in] p query point
+         * \param[in] n index of the leaf in the AABB tree
+         * \param[in] b index of the first facet in the leaf
+         * \param[in] e one position past the index of the last facet
+         * \param[out] sq_dist squared distance between p and the
+         *  nearest facet of the leaf
+         * \return the index of the nearest facet of the leaf
+         */
+        index_t leaf_nearest_facet(
+            const vec3& p, index_t n, index_t b, index_t e, double& sq_dist
+        ) const;
+
+        /**
+         * \brief The recursive function used by the implementation
+         *  of get_block_candidates().
+         * \param[in] block the query box
+         * \param[in] c the center of \p block
+         * \param[in] box_sq_bound squared distance beyond which a node
+         *  box is culled
+         * \param[in] center_sq_bound squared distance from \p c beyond
+         *  which a triangle is culled
+         * \param[out] packets the candidate packets, with the distance
+         *  from \p c to their nearest triangle
+         * \param[in] n index of the current node in the AABB tree
+         * \param[in] b index of the first facet in the subtree under node \p n
+         * \param[in] e one position past the index of the last facet in the
+         *  subtree under node \p n
+         */
+        void block_candidates_recursive(
+            const Box& block, const vec3& c,
+            double box_sq_bound, double center_sq_bound,
+            vector<std::pair<double, index_t> >& packets,
+            index_t n, index_t b, index_t e
+        ) const;
+
+    protected:
+        index_t leaf_size_;
+        vector<Box> bboxes_;
+
+        // For each leaf node, index of its first packet of triangles
+        vector<index_t> leaf_packet_;
+
+        // Triangle packets, each one storing PACKET_SIZE values for each
+        // of the NB_FIELDS fields listed in mesh_leaf_AABB.cpp
+        vector<double> packets_;
+
+        // Facet stored in each lane of each packet
+        vector<index_t> packet_facets_;
+
+        // Bounding box of the triangles of each packet
+        vector<Box> packet_bboxes_;
+
+        Mesh& mesh_;
+    };
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include "mesh_pseudonormals.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace GEO {
+
+    MeshFacetsPseudonormals::MeshFacetsPseudonormals(
+        const Mesh& M
+    ) :
+        mesh_(M) {
+        const index_t nb_facets = M.facets.nb();
+        facet_normals_.assign(nb_facets, vec3(0.0, 0.0, 0.0));
+        edge_normals_.assign(3 * nb_facets, vec3(0.0, 0.0, 0.0));
+        vertex_normals_.assign(M.vertices.nb(), vec3(0.0, 0.0, 0.0));
+
+        // Facet normals, and angle-weighted sums at the vertices
+        for(index_t f = 0; f < nb_facets; ++f) {
+            geo_debug_assert(M.facets.nb_vertices(f) == 3);
+            const vec3& p1 = M.vertices.point(M.facets.vertex(f, 0));
+            const vec3& p2 = M.vertices.point(M.facets.vertex(f, 1));
+            const vec3& p3 = M.vertices.point(M.facets.vertex(f, 2));
+            const vec3 n = cross(p2 - p1, p3 - p1);
+            const double l = length(n);
+            if(l == 0.0) {
+                continue;
+            }
+            facet_normals_[f] = n / l;
+            for(index_t lv = 0; lv < 3; ++lv) {
+                const vec3& p = M.vertices.point(M.facets.vertex(f, lv));
+                const vec3 e1 = M.vertices.point(M.facets.vertex(f, (lv + 1) % 3)) - p;
+                const vec3 e2 = M.vertices.point(M.facets.vertex(f, (lv + 2) % 3)) - p;
+                const double angle = std::atan2(length(cross(e1, e2)), dot(e1, e2));
+                vertex_normals_[M.facets.vertex(f, lv)] += angle * facet_normals_[f];
+            }
+        }
+
+        // Edge normals: sort the edges by their (sorted) vertices, and sum
+        // the normals of the facets that share each edge
+        vector<std::pair<std::pair<index_t, index_t>, index_t> > edges;
+        edges.reserve(3 * nb_facets);
+        for(index_t f = 0; f < nb_facets; ++f) {
+            for(index_t lv = 0; lv < 3; ++lv) {
+                index_t v1 = M.facets.vertex(f, lv);
+                index_t v2 = M.facets.vertex(f, (lv + 1) % 3);
+                if(v1 > v2) {
+                    std::swap(v1, v2);
+                }
+                edges.push_back(std::make_pair(std::make_pair(v1, v2), 3 * f + lv));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        for(index_t b = 0; b < edges.size(); ) {
+            index_t e = b + 1;
+            while(e < edges.size() && edges[e].first == edges[b].first) {
+                ++e;
+            }
+            vec3 n(0.0, 0.0, 0.0);
+            for(index_t k = b; k < e; ++k) {
+                n += facet_normals_[edges[k].second / 3];
+            }
+            for(index_t k = b; k < e; ++k) {
+                edge_normals_[edges[k].second] = n;
+            }
+            b = e;
+        }
+    }
+
+    MeshFacetsPseudonormals::Feature MeshFacetsPseudonormals::nearest_feature(
+        const vec3& p, index_t f,
+        vec3& nearest_point, double& sq_dist, index_t& lv
+    ) const {
+        geo_debug_assert(mesh_.facets.nb_vertices(f) == 3);
+        const vec3& p1 = mesh_.vertices.point(mesh_.facets.vertex(f, 0));
+        const vec3& p2 = mesh_.vertices.point(mesh_.facets.vertex(f, 1));
+        const vec3& p3 = mesh_.vertices.point(mesh_.facets.vertex(f, 2));
+        double lambda[3];
+        sq_dist = Geom::point_triangle_squared_distance(
+            p, p1, p2, p3, nearest_point, lambda[0], lambda[1], lambda[2]
+        );
+
+        // Barycentric coordinates of points on edges are not always
+        // exactly zero (e.g. 1 - s - (1 - s))
+        const double eps = 1e-10;
+        index_t nb_zeros = 0;
+        index_t zero = 0;
+        index_t nonzero = 0;
+        for(index_t k = 0; k < 3; ++k) {
+            if(lambda[k] <= eps) {
+                ++nb_zeros;
+                zero = k;
+            } else {
+                nonzero = k;
+            }
+        }
+        if(nb_zeros >= 2) {
+            lv = nonzero;
+            return FEATURE_VERTEX;
+        }
+        if(nb_zeros == 1) {
+            // The edge opposite to vertex zero
+            lv = (zero + 1) % 3;
+            return FEATURE_EDGE;
+        }
+        lv = 0;
+        return FEATURE_FACET;
+    }
+
+    double MeshFacetsPseudonormals::signed_distance(
+        const vec3& p, index_t f
+    ) const {
+        vec3 nearest_point;
+        double sq_dist;
+        index_t lv;
+        const Feature feature = nearest_feature(p, f, nearest_point, sq_dist, lv);
+        const double d = std::sqrt(sq_dist);
+        return dot(p - nearest_point, pseudonormal(f, feature, lv)) < 0.0 ? -d : d;
+    }
+
+}
@@ -0,0 +1,107 @@
+#ifndef GEOGRAM_MESH_MESH_PSEUDONORMALS
+#define GEOGRAM_MESH_MESH_PSEUDONORMALS
+
+/**
+ * \file mesh_pseudonormals.h
+ * \brief Angle-weighted pseudonormals of a triangle mesh, to get the
+ *  sign of the distance to a closed surface from its nearest facet.
+ */
+
+#include <geogram/basic/common.h>
+#include <geogram/mesh/mesh.h>
+#include <geogram/basic/geometry.h>
+
+namespace GEO {
+
+    /**
+     * \brief Pseudonormals of the facets, edges and vertices of a
+     *  closed triangle mesh.
+     * \details The pseudonormal of a facet is its normal, the one of an
+     *  edge is the sum of the normals of the facets around it, and the
+     *  one of a vertex is the sum of the normals of the facets around it
+     *  weighted by their angle at the vertex (Baerentzen and Aanaes, 2005).
+     *  If q is the point of the surface nearest to p, and n the
+     *  pseudonormal of the feature that contains q, then dot(p - q, n) is
+     *  positive if p is outside and negative if p is inside.
+     */
+    class MeshFacetsPseudonormals {
+    public:
+        /**
+         * \brief Feature of a facet that contains a point.
+         */
+        enum Feature {
+            FEATURE_FACET,
+            FEATURE_EDGE,
+            FEATURE_VERTEX
+        };
+
+        /**
+         * \brief Computes the pseudonormals.
+         * \param[in] M the input mesh. It is not modified, but must not
+         *  be modified either while this object is in use.
+         * \pre M.facets.are_simplices()
+         */
+        MeshFacetsPseudonormals(const Mesh& M);
+
+        /**
+         * \brief Finds the nearest point of a facet from a query point,
+         *  and the feature of the facet that contains it.
+         * \param[in] p query point
+         * \param[in] f index of the facet
+         * \param[out] nearest_point the point of \p f nearest to \p p
+         * \param[out] sq_dist squared distance between p and nearest_point
+         * \param[out] lv local index of the vertex for FEATURE_VERTEX, or
+         *  of the edge for FEATURE_EDGE (edge lv joins the vertices lv and
+         *  lv+1 modulo 3)
+         * \return the feature of \p f that contains nearest_point
+         */
+        Feature nearest_feature(
+            const vec3& p, index_t f,
+            vec3& nearest_point, double& sq_dist, index_t& lv
+        ) const;
+
+        /**
+         * \brief Gets the pseudonormal of a feature of a facet.
+         * \param[in] f index of the facet
+         * \param[in] feature the feature
+         * \param[in] lv local index of the vertex or of the edge, see
+         *  nearest_feature()
+         */
+        const vec3& pseudonormal(index_t f, Feature feature, index_t lv) const {
+            switch(feature) {
+            case FEATURE_VERTEX:
+                return vertex_normals_[mesh_.facets.vertex(f, lv)];
+            case FEATURE_EDGE:
+                return edge_normals_[3 * f + lv];
+            case FEATURE_FACET:
+            default:
+                return facet_normals_[f];
+            }
+        }
+
+        /**
+         * \brief Computes the signed distance between a query point and
+         *  the surface, given the nearest facet.
+         * \param[in] p query point
+         * \param[in] f index of the facet nearest to \p p
+         * \return the distance between p and the surface, negative if
+         *  p is inside
+         */
+        double signed_distance(const vec3& p, index_t f) const;
+
+    protected:
+        const Mesh& mesh_;
+
+        // Unit normal of each facet (zero for degenerate facets)
+        vector<vec3> facet_normals_;
+
+        // For each facet f, pseudonormal of its edge lv at index 3f+lv
+        vector<vec3> edge_normals_;
+
+        // Angle-weighted pseudonormal of each vertex
+        vector<vec3> vertex_normals_;
+    };
+
+}
+
+#endif
@@ -0,0 +1,280 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "sdf_sampler.h"
+#include <algorithm>
+#include <cmath>
+
+// The AVX2 path is compiled for its own function only, and selected at
+// runtime, so that the library still runs on CPUs without AVX2
+#if defined(SDF_WITH_AVX2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SDF_USE_AVX2
+#include <immintrin.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+const size_t SDFSampler::BATCH_SIZE;
+
+SDFSampler::SDFSampler(const VoxelGrid &voxels, const GEO::MeshFacetsAABB *aabb_tree,
+		const GEO::MeshFacetsPseudonormals *pseudonormals)
+	: m_data(voxels.rawbuf())
+	, m_grid_size(voxels.grid_size())
+	, m_stride_y(voxels.grid_size()[0])
+	, m_stride_z(voxels.grid_size()[0] * voxels.grid_size()[1])
+	, m_inv_spacing((float) (1.0 / voxels.spacing()))
+	, m_aabb_tree(aabb_tree)
+	, m_pseudonormals(pseudonormals)
+{
+	// Interpolation needs two voxels along each axis
+	geo_assert(m_grid_size[0] >= 2 && m_grid_size[1] >= 2 && m_grid_size[2] >= 2);
+	const GEO::vec3 first = voxels.voxel_center(0, 0, 0);
+	for (int c = 0; c < 3; ++c) {
+		m_first[c] = (float) first[c];
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+void SDFSampler::sample(const float *points, size_t n, float *distances, float *gradients, Mode mode) const {
+	const int num_batches = (int) ((n + BATCH_SIZE - 1) / BATCH_SIZE);
+	#pragma omp parallel for schedule(static) if (num_batches > 1)
+	for (int b = 0; b < num_batches; ++b) {
+		const size_t first = (size_t) b * BATCH_SIZE;
+		const size_t count = std::min(BATCH_SIZE, n - first);
+		sample_batch(points + 3 * first, count, distances + first,
+			gradients ? gradients + 3 * first : nullptr, mode);
+	}
+}
+
+void SDFSampler::sample(const std::vector<GEO::vec3> &points, std::vector<float> &distances,
+	std::vector<GEO::vec3> *gradients, Mode mode) const
+{
+	std::vector<float> xyz(3 * points.size());
+	for (size_t k = 0; k < points.size(); ++k) {
+		for (int c = 0; c < 3; ++c) {
+			xyz[3 * k + c] = (float) points[k][c];
+		}
+	}
+	distances.resize(points.size());
+	std::vector<float> grad(gradients ? 3 * points.size() : 0);
+	sample(xyz.data(), points.size(), distances.data(), gradients ? grad.data() : nullptr, mode);
+	if (gradients) {
+		gradients->resize(points.size());
+		for (size_t k = 0; k < points.size(); ++k) {
+			(*gradients)[k] = GEO::vec3(grad[3 * k], grad[3 * k + 1], grad[3 * k + 2]);
+		}
+	}
+}
+
+float SDFSampler::sample(const GEO::vec3 &p, Mode mode) const {
+	const float xyz[3] = {(float) p[0], (float) p[1], (float) p[2]};
+	float dist;
+	sample_batch(xyz, 1, &dist, nullptr, mode);
+	return dist;
+}
+
+// -----------------------------------------------------------------------------
+
+void SDFSampler::sample_batch(const float *points, size_t n, float *distances, float *gradients, Mode mode) const {
+	if (mode == EXACT) {
+		for (size_t k = 0; k < n; ++k) {
+			sample_exact(points + 3 * k, distances[k], gradients ? gradients + 3 * k : nullptr);
+		}
+		return;
+	}
+
+	size_t k = 0;
+#ifdef SDF_USE_AVX2
+	static const bool cpu_has_avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+	if (cpu_has_avx2) {
+		k = sample_batch_avx2(points, n, distances, gradients);
+	}
+#endif
+	for (; k < n; ++k) {
+		float *grad = (gradients ? gradients + 3 * k : nullptr);
+		if (!interpolate(points + 3 * k, distances[k], grad)) {
+			sample_exact(points + 3 * k, distances[k], grad);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+#ifdef SDF_USE_AVX2
+__attribute__((target("avx2")))
+size_t SDFSampler::sample_batch_avx2(const float *points, size_t n, float *distances, float *gradients) const {
+	// Same operations as interpolate(), on 8 points at once. The corners of
+	// points outside the grid are clamped so that the gathers stay in bounds,
+	// and these points are recomputed by sample_exact().
+	const __m256i xyz_index = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 inv_spacing = _mm256_set1_ps(m_inv_spacing);
+	const __m256i stride_y = _mm256_set1_epi32(m_stride_y);
+	const __m256i stride_z = _mm256_set1_epi32(m_stride_z);
+	size_t k = 0;
+	for (; k + 8 <= n; k += 8) {
+		const float *p = points + 3 * k;
+		__m256 t[3];
+		__m256i i[3];
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int c = 0; c < 3; ++c) {
+			const __m256 last = _mm256_set1_ps((float) (m_grid_size[c] - 1));
+			const __m256 x = _mm256_i32gather_ps(p + c, xyz_index, 4);
+			__m256 u = _mm256_mul_ps(_mm256_sub_ps(x, _mm256_set1_ps(m_first[c])), inv_spacing);
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(u, last, _CMP_LE_OQ));
+			u = _mm256_min_ps(_mm256_max_ps(u, zero), last);
+			i[c] = _mm256_min_epi32(_mm256_cvttps_epi32(u), _mm256_set1_epi32(m_grid_size[c] - 2));
+			t[c] = _mm256_sub_ps(u, _mm256_cvtepi32_ps(i[c]));
+		}
+		const __m256i base = _mm256_add_epi32(i[0], _mm256_add_epi32(
+			_mm256_mullo_epi32(i[1], stride_y), _mm256_mullo_epi32(i[2], stride_z)));
+		const __m256i base_y = _mm256_add_epi32(base, stride_y);
+		const __m256i base_z = _mm256_add_epi32(base, stride_z);
+		const __m256i base_yz = _mm256_add_epi32(base_y, stride_z);
+		const __m256 v000 = _mm256_i32gather_ps(m_data, base, 4);
+		const __m256 v100 = _mm256_i32gather_ps(m_data + 1, base, 4);
+		const __m256 v010 = _mm256_i32gather_ps(m_data, base_y, 4);
+		const __m256 v110 = _mm256_i32gather_ps(m_data + 1, base_y, 4);
+		const __m256 v001 = _mm256_i32gather_ps(m_data, base_z, 4);
+		const __m256 v101 = _mm256_i32gather_ps(m_data + 1, base_z, 4);
+		const __m256 v011 = _mm256_i32gather_ps(m_data, base_yz, 4);
+		const __m256 v111 = _mm256_i32gather_ps(m_data + 1, base_yz, 4);
+
+		#define SDF_LERP(a, b, s) _mm256_add_ps(a, _mm256_mul_ps(s, _mm256_sub_ps(b, a)))
+		const __m256 c00 = SDF_LERP(v000, v100, t[0]);
+		const __m256 c10 = SDF_LERP(v010, v110, t[0]);
+		const __m256 c01 = SDF_LERP(v001, v101, t[0]);
+		const __m256 c11 = SDF_LERP(v011, v111, t[0]);
+		const __m256 c0 = SDF_LERP(c00, c10, t[1]);
+		const __m256 c1 = SDF_LERP(c01, c11, t[1]);
+		_mm256_storeu_ps(distances + k, SDF_LERP(c0, c1, t[2]));
+
+		if (gradients) {
+			const __m256 d0 = SDF_LERP(_mm256_sub_ps(v100, v000), _mm256_sub_ps(v110, v010), t[1]);
+			const __m256 d1 = SDF_LERP(_mm256_sub_ps(v101, v001), _mm256_sub_ps(v111, v011), t[1]);
+			float grad[3][8];
+			_mm256_storeu_ps(grad[0], _mm256_mul_ps(SDF_LERP(d0, d1, t[2]), inv_spacing));
+			_mm256_storeu_ps(grad[1], _mm256_mul_ps(SDF_LERP(_mm256_sub_ps(c10, c00),
+				_mm256_sub_ps(c11, c01), t[2]), inv_spacing));
+			_mm256_storeu_ps(grad[2], _mm256_mul_ps(_mm256_sub_ps(c1, c0), inv_spacing));
+			for (int l = 0; l < 8; ++l) {
+				for (int c = 0; c < 3; ++c) {
+					gradients[3 * (k + l) + c] = grad[c][l];
+				}
+			}
+		}
+		#undef SDF_LERP
+
+		const int mask = _mm256_movemask_ps(inside);
+		if (mask != 0xff) {
+			for (int l = 0; l < 8; ++l) {
+				if (!(mask & (1 << l))) {
+					sample_exact(p + 3 * l, distances[k + l], gradients ? gradients + 3 * (k + l) : nullptr);
+				}
+			}
+		}
+	}
+	return k;
+}
+#else
+size_t SDFSampler::sample_batch_avx2(const float *, size_t, float *, float *) const {
+	return 0;
+}
+#endif
+
+// -----------------------------------------------------------------------------
+
+bool SDFSampler::interpolate(const float *p, float &dist, float *grad, bool clamp) const {
+	float t[3];
+	int i[3];
+	for (int c = 0; c < 3; ++c) {
+		const float last = (float) (m_grid_size[c] - 1);
+		float u = (p[c] - m_first[c]) * m_inv_spacing;
+		if (!(u >= 0.0f && u <= last)) {
+			if (!clamp) {
+				return false;
+			}
+			u = (u > 0.0f ? std::min(u, last) : 0.0f);
+		}
+		i[c] = std::min((int) u, m_grid_size[c] - 2);
+		t[c] = u - (float) i[c];
+	}
+	const float *v = m_data + i[2] * m_stride_z + i[1] * m_stride_y + i[0];
+	const float v000 = v[0];
+	const float v100 = v[1];
+	const float v010 = v[m_stride_y];
+	const float v110 = v[m_stride_y + 1];
+	const float v001 = v[m_stride_z];
+	const float v101 = v[m_stride_z + 1];
+	const float v011 = v[m_stride_z + m_stride_y];
+	const float v111 = v[m_stride_z + m_stride_y + 1];
+
+	auto lerp = [] (float a, float b, float s) { return a + s * (b - a); };
+	const float c00 = lerp(v000, v100, t[0]);
+	const float c10 = lerp(v010, v110, t[0]);
+	const float c01 = lerp(v001, v101, t[0]);
+	const float c11 = lerp(v011, v111, t[0]);
+	const float c0 = lerp(c00, c10, t[1]);
+	const float c1 = lerp(c01, c11, t[1]);
+	dist = lerp(c0, c1, t[2]);
+
+	// Derivatives of the trilinear interpolant
+	if (grad) {
+		const float d0 = lerp(v100 - v000, v110 - v010, t[1]);
+		const float d1 = lerp(v101 - v001, v111 - v011, t[1]);
+		grad[0] = lerp(d0, d1, t[2]) * m_inv_spacing;
+		grad[1] = lerp(c10 - c00, c11 - c01, t[2]) * m_inv_spacing;
+		grad[2] = (c1 - c0) * m_inv_spacing;
+	}
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+
+void SDFSampler::sample_exact(const float *p, float &dist, float *grad) const {
+	if (!m_aabb_tree) {
+		// The distance is 1-Lipschitz, so d(p) <= d(q) + |p - q| for the point
+		// q of the grid nearest to p
+		float q[3];
+		float offset[3];
+		float len2 = 0.0f;
+		for (int c = 0; c < 3; ++c) {
+			const float last = m_first[c] + (float) (m_grid_size[c] - 1) / m_inv_spacing;
+			q[c] = std::max(m_first[c], std::min(p[c], last));
+			offset[c] = p[c] - q[c];
+			len2 += offset[c] * offset[c];
+		}
+		interpolate(q, dist, grad, true);
+		const float len = std::sqrt(len2);
+		dist += len;
+		if (grad && len > 0.0f) {
+			for (int c = 0; c < 3; ++c) {
+				grad[c] = offset[c] / len;
+			}
+		}
+		return;
+	}
+
+	const GEO::vec3 query(p[0], p[1], p[2]);
+	GEO::vec3 nearest_point;
+	double sq_dist;
+	const GEO::index_t f = m_aabb_tree->nearest_facet(query, nearest_point, sq_dist);
+	const double d = std::sqrt(sq_dist);
+
+	// Points outside the grid are outside the surface (the grid is padded)
+	float grid_dist = 1.0f;
+	float grid_grad[3] = {0.0f, 0.0f, 0.0f};
+	const bool in_grid = interpolate(p, grid_dist, grid_grad);
+	double sign = 1.0;
+	if (m_pseudonormals) {
+		sign = (m_pseudonormals->signed_distance(query, f) < 0.0 ? -1.0 : 1.0);
+	} else if (in_grid && grid_dist < 0.0f) {
+		sign = -1.0;
+	}
+	dist = (float) (sign * d);
+	if (grad) {
+		for (int c = 0; c < 3; ++c) {
+			// On the surface, the gradient of the grid is the best guess
+			grad[c] = (d > 0.0 ? (float) (sign * (query[c] - nearest_point[c]) / d) : grid_grad[c]);
+		}
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "voxel_grid.h"
+#include "mesh_AABB.h"
+#include "mesh_pseudonormals.h"
+#include <cstddef>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+// Signed distances and gradients at arbitrary points, by trilinear
+// interpolation of the voxel values of a signed distance field (as computed
+// and saved by the sdf tool, see VoxelGrid::load()).
+//
+// Points are processed by batches, in parallel, 8 at a time with AVX2 when the
+// CPU supports it. Points outside the voxel centers, or all points in EXACT
+// mode, are queried from the AABB tree if one is given: the distance is then
+// exact, and its sign comes from the pseudonormals if given, or else from the
+// grid. Without a tree, the distance outside the grid is extrapolated from the
+// nearest grid point q as d(q) + |p - q|, an upper bound of the distance up to
+// the interpolation error at q.
+//
+// The grid, tree and pseudonormals are referenced, not copied, and must
+// outlive the sampler. The tree and pseudonormals must be built on the same
+// mesh as the grid, after the facets are reordered.
+class SDFSampler {
+public:
+	enum Mode {
+		INTERPOLATE, // trilinear interpolation, exact queries outside the grid
+		EXACT,       // exact queries everywhere (needs a tree)
+	};
+
+	// Number of points per parallel task
+	static const size_t BATCH_SIZE = 4096;
+
+private:
+	// Member data
+	const float *m_data;
+	Vec3i m_grid_size;
+	int m_stride_y;
+	int m_stride_z;
+	float m_first[3];       // center of the first voxel
+	float m_inv_spacing;
+	const GEO::MeshFacetsAABB *m_aabb_tree;
+	const GEO::MeshFacetsPseudonormals *m_pseudonormals;
+
+public:
+	// Interface
+	SDFSampler(const VoxelGrid &voxels, const GEO::MeshFacetsAABB *aabb_tree = nullptr,
+		const GEO::MeshFacetsPseudonormals *pseudonormals = nullptr);
+
+	// Distances at n points (x, y, z interleaved), and their gradients (3 per
+	// point, interleaved) if `gradients` is not null
+	void sample(const float *points, size_t n, float *distances, float *gradients = nullptr,
+		Mode mode = INTERPOLATE) const;
+
+	// Same as above, for geogram points
+	void sample(const std::vector<GEO::vec3> &points, std::vector<float> &distances,
+		std::vector<GEO::vec3> *gradients = nullptr, Mode mode = INTERPOLATE) const;
+
+	// Distance at a single point
+	float sample(const GEO::vec3 &p, Mode mode = INTERPOLATE) const;
+
+private:
+	void sample_batch(const float *points, size_t n, float *distances, float *gradients, Mode mode) const;
+
+	// Interpolation of the first points of a batch, 8 at a time with AVX2 (the
+	// CPU must support it), returns the number of points processed
+	size_t sample_batch_avx2(const float *points, size_t n, float *distances, float *gradients) const;
+
+	// Trilinear interpolation at p, returns false if p lies outside the voxel
+	// centers (nothing is written then), unless it is clamped to them
+	bool interpolate(const float *p, float &dist, float *grad, bool clamp = false) const;
+
+	// Exact query (or extrapolation without a tree) at p
+	void sample_exact(const float *p, float &dist, float *grad) const;
+};
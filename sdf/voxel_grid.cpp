@@ -0,0 +1,353 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "voxel_grid.h"
+#include <geogram/basic/logger.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+////////////////////////////////////////////////////////////////////////////////
+
+VoxelGrid::VoxelGrid()
+	: m_spacing(1.0)
+	, m_grid_size({{0, 0, 0}})
+{ }
+
+VoxelGrid::VoxelGrid(GEO::vec3 origin, GEO::vec3 extent, double spacing, int padding)
+	: m_origin(origin)
+	, m_spacing(spacing)
+{
+	m_origin -= padding * spacing * GEO::vec3(1, 1, 1);
+	m_grid_size[0] = (int) std::floor(extent[0] / spacing) + 2 * padding;
+	m_grid_size[1] = (int) std::floor(extent[1] / spacing) + 2 * padding;
+	m_grid_size[2] = (int) std::floor(extent[2] / spacing) + 2 * padding;
+	m_data.assign(m_grid_size[0] * m_grid_size[1] * m_grid_size[2], 1.0f);
+	GEO::Logger::out("Voxels") << "Grid size: "
+		<< m_grid_size[0] << " x " << m_grid_size[1] << " x " << m_grid_size[2] << std::endl;
+}
+
+GEO::vec3 VoxelGrid::voxel_center(int x, int y, int z) const {
+	GEO::vec3 pos;
+	pos[0] = (x + 0.5) * m_spacing;
+	pos[1] = (y + 0.5) * m_spacing;
+	pos[2] = (z + 0.5) * m_spacing;
+	return pos + m_origin;
+}
+
+Vec3i VoxelGrid::index3_from_index(int idx) const {
+	return {{
+		idx % m_grid_size[0],
+		(idx / m_grid_size[0]) % m_grid_size[1],
+		(idx / m_grid_size[0]) / m_grid_size[1],
+	}};
+}
+
+int VoxelGrid::index_from_index3(Vec3i vx) const {
+	return (vx[2] * m_grid_size[1] + vx[1]) * m_grid_size[0] + vx[0];
+}
+
+// -----------------------------------------------------------------------------
+
+bool VoxelGrid::load(const std::string &filename) {
+	std::ifstream header(filename);
+	if (!header) {
+		GEO::Logger::err("VoxelGrid") << "Cannot read file: " << filename << std::endl;
+		return false;
+	}
+	Vec3i size = {{0, 0, 0}};
+	double offset[3] = {0.0, 0.0, 0.0};
+	double spacing[3] = {1.0, 1.0, 1.0};
+	std::string type, data_file;
+	std::string line;
+	while (std::getline(header, line)) {
+		const size_t eq = line.find('=');
+		if (eq == std::string::npos) { continue; }
+		std::string key = line.substr(0, eq);
+		key.erase(key.find_last_not_of(" \t") + 1);
+		std::istringstream value(line.substr(eq + 1));
+		if (key == "DimSize") {
+			value >> size[0] >> size[1] >> size[2];
+		} else if (key == "Offset") {
+			value >> offset[0] >> offset[1] >> offset[2];
+		} else if (key == "ElementSpacing") {
+			value >> spacing[0] >> spacing[1] >> spacing[2];
+		} else if (key == "ElementType") {
+			value >> type;
+		} else if (key == "ElementDataFile") {
+			std::getline(value >> std::ws, data_file);
+		}
+	}
+	if (size[0] <= 0 || size[1] <= 0 || size[2] <= 0 || type != "MET_FLOAT" || data_file.empty()
+		|| spacing[1] != spacing[0] || spacing[2] != spacing[0])
+	{
+		GEO::Logger::err("VoxelGrid") << "Unsupported MetaImage header: " << filename << std::endl;
+		return false;
+	}
+
+	// The data file is written as given by the sdf tool, and relative to the
+	// header by other MetaImage writers
+	std::ifstream raw(data_file, std::ios::binary);
+	const size_t slash = filename.find_last_of("/\\");
+	if (!raw && slash != std::string::npos) {
+		raw.open(filename.substr(0, slash + 1) + data_file, std::ios::binary);
+	}
+	m_grid_size = size;
+	m_spacing = spacing[0];
+	m_origin = GEO::vec3(offset[0], offset[1], offset[2]) - 0.5 * m_spacing * GEO::vec3(1, 1, 1);
+	m_data.resize((size_t) size[0] * size[1] * size[2]);
+	if (!raw || !raw.read(reinterpret_cast<char *>(m_data.data()), m_data.size() * sizeof(float))) {
+		GEO::Logger::err("VoxelGrid") << "Cannot read voxel data: " << data_file << std::endl;
+		return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+VoxelChannels::VoxelChannels(int num_voxels, int channels)
+	: m_channels(channels)
+{
+	if (has(FACET)) { m_facet.assign(num_voxels, -1); }
+	if (has(CLOSEST_POINT)) { m_closest_point.assign(3 * (size_t) num_voxels, NAN); }
+	if (has(OFFSET)) { m_offset.assign(3 * (size_t) num_voxels, NAN); }
+	if (has(BARYCENTRIC)) { m_barycentric.assign(3 * (size_t) num_voxels, NAN); }
+}
+
+void VoxelChannels::set(int idx, int32_t facet, const GEO::vec3 &center, const GEO::vec3 &nearest_point,
+	const GEO::vec3 &barycentric)
+{
+	if (has(FACET)) { m_facet[idx] = facet; }
+	for (int c = 0; c < 3; ++c) {
+		if (has(CLOSEST_POINT)) { m_closest_point[3 * (size_t) idx + c] = (float) nearest_point[c]; }
+		if (has(OFFSET)) { m_offset[3 * (size_t) idx + c] = (float) (nearest_point[c] - center[c]); }
+		if (has(BARYCENTRIC)) { m_barycentric[3 * (size_t) idx + c] = (float) barycentric[c]; }
+	}
+}
+
+void VoxelChannels::set_none(int idx) {
+	if (has(FACET)) { m_facet[idx] = -1; }
+	for (int c = 0; c < 3; ++c) {
+		if (has(CLOSEST_POINT)) { m_closest_point[3 * (size_t) idx + c] = NAN; }
+		if (has(OFFSET)) { m_offset[3 * (size_t) idx + c] = NAN; }
+		if (has(BARYCENTRIC)) { m_barycentric[3 * (size_t) idx + c] = NAN; }
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+SparseVoxelGrid::SparseVoxelGrid()
+	: m_spacing(1.0)
+	, m_grid_size({{0, 0, 0}})
+	, m_brick_size(8)
+	, m_num_bricks({{0, 0, 0}})
+	, m_background(1.0f)
+{ }
+
+SparseVoxelGrid::SparseVoxelGrid(GEO::vec3 origin, GEO::vec3 extent, double spacing, int padding,
+		int brick_size)
+	: m_origin(origin)
+	, m_spacing(spacing)
+	, m_brick_size(std::max(1, brick_size))
+	, m_background(1.0f)
+{
+	// Same voxels as VoxelGrid
+	m_origin -= padding * spacing * GEO::vec3(1, 1, 1);
+	for (int c = 0; c < 3; ++c) {
+		m_grid_size[c] = (int) std::floor(extent[c] / spacing) + 2 * padding;
+		m_num_bricks[c] = (m_grid_size[c] + m_brick_size - 1) / m_brick_size;
+	}
+	const int num_bricks = m_num_bricks[0] * m_num_bricks[1] * m_num_bricks[2];
+	m_brick_index.assign(num_bricks, NO_BRICK);
+	m_brick_sign.assign(num_bricks, 1);
+	GEO::Logger::out("Voxels") << "Grid size: "
+		<< m_grid_size[0] << " x " << m_grid_size[1] << " x " << m_grid_size[2]
+		<< " (" << m_num_bricks[0] << " x " << m_num_bricks[1] << " x " << m_num_bricks[2]
+		<< " bricks of " << m_brick_size << "^3)" << std::endl;
+}
+
+GEO::vec3 SparseVoxelGrid::voxel_center(int x, int y, int z) const {
+	GEO::vec3 pos;
+	pos[0] = (x + 0.5) * m_spacing;
+	pos[1] = (y + 0.5) * m_spacing;
+	pos[2] = (z + 0.5) * m_spacing;
+	return pos + m_origin;
+}
+
+Vec3i SparseVoxelGrid::index3_from_brick(int brick) const {
+	return {{
+		brick % m_num_bricks[0],
+		(brick / m_num_bricks[0]) % m_num_bricks[1],
+		(brick / m_num_bricks[0]) / m_num_bricks[1],
+	}};
+}
+
+// -----------------------------------------------------------------------------
+
+int SparseVoxelGrid::allocate_brick(int brick) {
+	if (m_brick_index[brick] == NO_BRICK) {
+		m_brick_index[brick] = (int) m_allocated.size();
+		m_allocated.push_back(brick);
+		m_data.resize(m_data.size() + voxels_per_brick(), m_brick_sign[brick] * m_background);
+	}
+	return m_brick_index[brick];
+}
+
+float SparseVoxelGrid::value(int x, int y, int z) const {
+	const int brick = brick_from_index3({{x / m_brick_size, y / m_brick_size, z / m_brick_size}});
+	const int k = m_brick_index[brick];
+	if (k == NO_BRICK) {
+		return m_brick_sign[brick] * m_background;
+	}
+	x %= m_brick_size;
+	y %= m_brick_size;
+	z %= m_brick_size;
+	return brick_data(k)[(z * m_brick_size + y) * m_brick_size + x];
+}
+
+size_t SparseVoxelGrid::memory_footprint() const {
+	return m_data.size() * sizeof(float)
+		+ m_brick_index.size() * sizeof(int)
+		+ m_brick_sign.size() * sizeof(int8_t)
+		+ m_allocated.size() * sizeof(int);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// File layout (native endianness):
+//   char[8]   magic "SPARSDF"
+//   int32     version
+//   int32[3]  grid size (voxels)
+//   int32     brick size
+//   double[3] origin (corner of the first voxel)
+//   double    spacing
+//   float     background magnitude
+//   int8[n]   sign of each of the n bricks, X fastest
+//   int32     number of allocated bricks
+//   for each allocated brick: int32 brick index, float[brick_size^3] values (X fastest)
+
+namespace {
+
+const char SPARSE_MAGIC[8] = "SPARSDF";
+const int32_t SPARSE_VERSION = 1;
+
+template<typename T>
+void write_pod(std::ostream &out, const T &value) {
+	out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<typename T>
+bool read_pod(std::istream &in, T &value) {
+	return (bool) in.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+} // anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+bool SparseVoxelGrid::save(const std::string &filename) const {
+	std::ofstream out(filename, std::ios::binary);
+	if (!out) {
+		GEO::Logger::err("SparseVoxelGrid") << "Cannot write file: " << filename << std::endl;
+		return false;
+	}
+	out.write(SPARSE_MAGIC, sizeof(SPARSE_MAGIC));
+	write_pod(out, SPARSE_VERSION);
+	for (int c = 0; c < 3; ++c) { write_pod(out, (int32_t) m_grid_size[c]); }
+	write_pod(out, (int32_t) m_brick_size);
+	for (int c = 0; c < 3; ++c) { write_pod(out, (double) m_origin[c]); }
+	write_pod(out, m_spacing);
+	write_pod(out, m_background);
+	out.write(reinterpret_cast<const char *>(m_brick_sign.data()), m_brick_sign.size());
+	write_pod(out, (int32_t) m_allocated.size());
+	for (size_t k = 0; k < m_allocated.size(); ++k) {
+		write_pod(out, (int32_t) m_allocated[k]);
+		out.write(reinterpret_cast<const char *>(brick_data((int) k)), voxels_per_brick() * sizeof(float));
+	}
+	return (bool) out;
+}
+
+bool SparseVoxelGrid::load(const std::string &filename) {
+	std::ifstream in(filename, std::ios::binary);
+	char magic[sizeof(SPARSE_MAGIC)];
+	int32_t version = 0;
+	if (!in || !in.read(magic, sizeof(magic)) || std::memcmp(magic, SPARSE_MAGIC, sizeof(magic)) != 0
+		|| !read_pod(in, version) || version != SPARSE_VERSION)
+	{
+		GEO::Logger::err("SparseVoxelGrid") << "Not a sparse voxel grid file: " << filename << std::endl;
+		return false;
+	}
+
+	// Header, read into locals and only committed once the whole file is valid
+	int32_t grid_size[3], brick_size, num_allocated;
+	double origin[3], spacing;
+	float background;
+	bool ok = true;
+	for (int c = 0; c < 3; ++c) { ok = ok && read_pod(in, grid_size[c]); }
+	ok = ok && read_pod(in, brick_size);
+	for (int c = 0; c < 3; ++c) { ok = ok && read_pod(in, origin[c]); }
+	ok = ok && read_pod(in, spacing) && read_pod(in, background);
+	// brick_size^3 must fit in an int (see voxels_per_brick()), and so must the number of bricks
+	ok = ok && brick_size > 0 && brick_size <= 1024;
+	Vec3i num_bricks;
+	int64_t total_bricks = 1;
+	for (int c = 0; ok && c < 3; ++c) {
+		ok = grid_size[c] > 0;
+		num_bricks[c] = (int) ((grid_size[c] + (int64_t) brick_size - 1) / brick_size);
+		total_bricks *= num_bricks[c];
+		ok = ok && total_bricks <= std::numeric_limits<int>::max();
+	}
+	if (!ok) {
+		GEO::Logger::err("SparseVoxelGrid") << "Invalid header: " << filename << std::endl;
+		return false;
+	}
+
+	// Brick signs and allocated bricks (each is an index and brick_size^3 values)
+	const int nb = (int) total_bricks;
+	const size_t voxels_per_brick = (size_t) brick_size * brick_size * brick_size;
+	std::vector<int8_t> brick_sign(nb);
+	if (!in.read(reinterpret_cast<char *>(brick_sign.data()), nb) || !read_pod(in, num_allocated)) {
+		GEO::Logger::err("SparseVoxelGrid") << "Truncated file: " << filename << std::endl;
+		return false;
+	}
+	const std::streamoff position = in.tellg();
+	in.seekg(0, std::ios::end);
+	const uint64_t remaining = (uint64_t) (in.tellg() - position);
+	in.seekg(position);
+	if (num_allocated < 0 || num_allocated > nb
+		|| (uint64_t) num_allocated > remaining / (sizeof(int32_t) + voxels_per_brick * sizeof(float)))
+	{
+		GEO::Logger::err("SparseVoxelGrid") << "Invalid number of bricks in file: " << filename << std::endl;
+		return false;
+	}
+	std::vector<int> brick_index(nb, NO_BRICK);
+	std::vector<int> allocated(num_allocated);
+	std::vector<float> data((size_t) num_allocated * voxels_per_brick);
+	for (int32_t k = 0; k < num_allocated; ++k) {
+		int32_t brick;
+		if (!read_pod(in, brick) || brick < 0 || brick >= nb || brick_index[brick] != NO_BRICK) {
+			GEO::Logger::err("SparseVoxelGrid") << "Invalid brick in file: " << filename << std::endl;
+			return false;
+		}
+		brick_index[brick] = k;
+		allocated[k] = brick;
+		if (!in.read(reinterpret_cast<char *>(data.data() + k * voxels_per_brick), voxels_per_brick * sizeof(float))) {
+			GEO::Logger::err("SparseVoxelGrid") << "Truncated file: " << filename << std::endl;
+			return false;
+		}
+	}
+
+	for (int c = 0; c < 3; ++c) {
+		m_origin[c] = origin[c];
+		m_grid_size[c] = grid_size[c];
+	}
+	m_spacing = spacing;
+	m_background = background;
+	m_brick_size = brick_size;
+	m_num_bricks = num_bricks;
+	m_brick_sign.swap(brick_sign);
+	m_brick_index.swap(brick_index);
+	m_allocated.swap(allocated);
+	m_data.swap(data);
+	return true;
+}
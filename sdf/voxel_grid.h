@@ -0,0 +1,156 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <geogram/basic/common.h>
+#include <geogram/basic/geometry.h>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+typedef std::array<int, 3> Vec3i;
+
+// Dense grid of voxels, X being the fastest varying coordinate
+class VoxelGrid {
+private:
+	// Member data
+	std::vector<float> m_data;
+	GEO::vec3 m_origin;
+	double m_spacing; // voxel size (in mm)
+	Vec3i m_grid_size;
+
+public:
+	// Interface
+	VoxelGrid();
+	VoxelGrid(GEO::vec3 origin, GEO::vec3 extent, double voxel_size, int padding);
+
+	Vec3i grid_size() const { return m_grid_size; }
+	int num_voxels() const { return m_grid_size[0] * m_grid_size[1]  * m_grid_size[2]; }
+
+	GEO::vec3 origin() const { return m_origin; }
+	double spacing() const { return m_spacing; }
+
+	Vec3i index3_from_index(int idx) const;
+	int index_from_index3(Vec3i vx) const;
+
+	GEO::vec3 voxel_center(int x, int y, int z) const;
+
+	float & at(int idx) { return m_data[idx]; }
+	const float * rawbuf() const { return m_data.data(); }
+	float * raw_layer(int z) { return m_data.data() + z * m_grid_size[1] * m_grid_size[0]; }
+
+	// MetaImage (.mhd header and .raw float data) as written by the sdf tool,
+	// the first voxel center and the spacing being given by Offset and
+	// ElementSpacing
+	bool load(const std::string &filename);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Optional outputs of the distance pass at each voxel of a VoxelGrid, besides
+// the distance itself. Only the requested channels are allocated. A voxel with
+// no nearest facet (e.g. beyond the truncation distance) has facet -1 and NaN
+// vectors.
+class VoxelChannels {
+public:
+	enum Channel : int {
+		FACET         = 1, // index of the nearest facet
+		CLOSEST_POINT = 2, // nearest point on the surface
+		OFFSET        = 4, // nearest point minus voxel center
+		BARYCENTRIC   = 8, // barycentric coordinates of the nearest point in its facet
+	};
+
+private:
+	// Member data
+	int m_channels;
+	std::vector<int32_t> m_facet;
+	std::vector<float> m_closest_point; // 3 per voxel
+	std::vector<float> m_offset;        // 3 per voxel
+	std::vector<float> m_barycentric;   // 3 per voxel
+
+public:
+	// Interface
+	VoxelChannels(int num_voxels, int channels);
+
+	bool has(Channel c) const { return (m_channels & c) != 0; }
+
+	void set(int idx, int32_t facet, const GEO::vec3 &center, const GEO::vec3 &nearest_point,
+		const GEO::vec3 &barycentric);
+	void set_none(int idx);
+
+	std::vector<int32_t> & facet() { return m_facet; }
+	const std::vector<int32_t> & facet() const { return m_facet; }
+	const std::vector<float> & closest_point() const { return m_closest_point; }
+	const std::vector<float> & offset() const { return m_offset; }
+	const std::vector<float> & barycentric() const { return m_barycentric; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Sparse grid of voxels, stored as cubic bricks of brick_size^3 voxels. Only
+// the bricks near the surface are allocated. A voxel of any other brick has
+// the background value of its brick, whose sign tells whether the brick lies
+// inside (negative) or outside (positive) the surface.
+class SparseVoxelGrid {
+public:
+	// Brick index of a brick that is not allocated
+	enum : int {
+		NO_BRICK = -1,
+	};
+
+private:
+	// Member data
+	GEO::vec3 m_origin;
+	double m_spacing; // voxel size (in mm)
+	Vec3i m_grid_size;
+	int m_brick_size;
+	Vec3i m_num_bricks;
+	float m_background;                // Magnitude of the background values
+	std::vector<int> m_brick_index;    // For each brick, index among the allocated bricks or NO_BRICK
+	std::vector<int8_t> m_brick_sign;  // For each brick, sign of its background value
+	std::vector<int> m_allocated;      // Allocated bricks, in order of allocation
+	std::vector<float> m_data;         // Values of the allocated bricks, brick_size^3 each
+
+public:
+	// Interface
+	SparseVoxelGrid();
+	SparseVoxelGrid(GEO::vec3 origin, GEO::vec3 extent, double voxel_size, int padding,
+		int brick_size = 8);
+
+	Vec3i grid_size() const { return m_grid_size; }
+	GEO::vec3 origin() const { return m_origin; }
+	double spacing() const { return m_spacing; }
+	GEO::vec3 voxel_center(int x, int y, int z) const;
+
+	// Bricks
+	int brick_size() const { return m_brick_size; }
+	int voxels_per_brick() const { return m_brick_size * m_brick_size * m_brick_size; }
+	Vec3i num_bricks() const { return m_num_bricks; }
+	int brick_from_index3(Vec3i b) const { return (b[2] * m_num_bricks[1] + b[1]) * m_num_bricks[0] + b[0]; }
+	Vec3i index3_from_brick(int brick) const;
+
+	// Allocated bricks (their values are initialized to the background value)
+	int allocate_brick(int brick);
+	int num_allocated_bricks() const { return (int) m_allocated.size(); }
+	int allocated_brick(int k) const { return m_allocated[k]; }
+	int brick_index(int brick) const { return m_brick_index[brick]; }
+	float * brick_data(int k) { return m_data.data() + (size_t) k * voxels_per_brick(); }
+	const float * brick_data(int k) const { return m_data.data() + (size_t) k * voxels_per_brick(); }
+
+	// Background values
+	float background() const { return m_background; }
+	void set_background(float value) { m_background = value; }
+	int brick_sign(int brick) const { return m_brick_sign[brick]; }
+	void set_brick_sign(int brick, int sign) { m_brick_sign[brick] = (sign < 0 ? -1 : 1); }
+
+	// Value of a voxel, whether its brick is allocated or not
+	float value(int x, int y, int z) const;
+
+	// Number of bytes used by the voxel values and the brick tables
+	size_t memory_footprint() const;
+
+	// Binary file I/O
+	bool save(const std::string &filename) const;
+	bool load(const std::string &filename);
+};
@@ -1,11 +1,15 @@
 #pragma once
 
 ////////////////////////////////////////////////////////////////////////////////
+#include "geogram/basic/process.h"
 #include <Eigen/Dense>
 #include <typeindex>
+#include <type_traits>
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <stdexcept>
 #include <map>
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -16,7 +20,22 @@ public:
 	AttributeBase(std::type_index t) : m_DerivedType(t) { }
 	virtual ~AttributeBase() = default;
 	virtual void resize(size_t n) = 0;
+	virtual void remap(const std::vector<int> &oldToNew, size_t n) = 0;
 	std::type_index type() const { return m_DerivedType; }
+
+	// Below this number of entries, loops over an attribute are not worth
+	// running in parallel
+	static const size_t PARALLEL_THRESHOLD = 1 << 16;
+
+	// Run f(begin, end) over slices of [0, n)
+	template<typename Func>
+	static void forEachSlice(size_t n, const Func &f) {
+		if (n < PARALLEL_THRESHOLD) {
+			f(0, n);
+		} else {
+			GEO::parallel_for_slice(0, (GEO::index_t) n, [&](GEO::index_t b, GEO::index_t e) { f(b, e); });
+		}
+	}
 };
 
 // -----------------------------------------------------------------------------
@@ -26,8 +45,34 @@ struct Attribute : public AttributeBase {
 	// Constructor
 	Attribute(int rows) : AttributeBase(typeid(T)), content_(rows) { content_.setZero(); }
 
-	// Resize data
-	void resize(size_t r) { content_.resize(r); }
+	// Resize data, keeping the existing entries (new entries are set to zero)
+	void resize(size_t r) {
+		if (r == (size_t) content_.size()) { return; }
+		Eigen::Matrix<T, Eigen::Dynamic, 1> tmp(r);
+		const size_t kept = std::min(r, (size_t) content_.size());
+		forEachSlice(r, [&](size_t b, size_t e) {
+			for (size_t i = b; i < e; ++i) { tmp(i) = (i < kept ? content_(i) : T(0)); }
+		});
+		content_.swap(tmp);
+	}
+
+	// Move entry i to oldToNew[i] (dropped if -1) in a vector of size n
+	void remap(const std::vector<int> &oldToNew, size_t n) {
+		Eigen::Matrix<T, Eigen::Dynamic, 1> tmp(n);
+		forEachSlice(oldToNew.size(), [&](size_t b, size_t e) {
+			for (size_t i = b; i < e; ++i) {
+				if (oldToNew[i] != -1) { tmp(oldToNew[i]) = content_(i); }
+			}
+		});
+		content_.swap(tmp);
+	}
+
+	// Set all entries to the same value
+	void fill(T value) {
+		forEachSlice((size_t) content_.size(), [&](size_t b, size_t e) {
+			std::fill(content_.data() + b, content_.data() + e, value);
+		});
+	}
 
 	// Data
 	Eigen::Matrix<T, Eigen::Dynamic, 1> content_;
@@ -35,6 +80,47 @@ struct Attribute : public AttributeBase {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Typed reference to an attribute, resolved once by AttributeManager::handle()
+// so that hot loops skip the lookup by name. Use AttributeHandle<const T> for
+// read-only access. The handle stays valid as long as the attribute exists,
+// but the pointer returned by data() is invalidated by a resize.
+template<typename T>
+class AttributeHandle {
+
+public:
+	typedef typename std::remove_const<T>::type Scalar;
+	typedef typename std::conditional<std::is_const<T>::value,
+		const Eigen::Matrix<Scalar, Eigen::Dynamic, 1>,
+		Eigen::Matrix<Scalar, Eigen::Dynamic, 1>>::type VectorType;
+
+private:
+	VectorType *m_Vector = nullptr;
+
+public:
+	AttributeHandle() = default;
+	explicit AttributeHandle(VectorType *vector) : m_Vector(vector) { }
+
+	// Read-only handles can be obtained from mutable ones
+	operator AttributeHandle<const Scalar>() const { return AttributeHandle<const Scalar>(m_Vector); }
+
+	// Whether the handle refers to an attribute
+	bool isValid() const { return m_Vector != nullptr; }
+
+	// Number of entries
+	size_t size() const { return (size_t) m_Vector->size(); }
+
+	// Raw storage
+	T * data() const { return m_Vector->data(); }
+
+	// Underlying vector
+	VectorType & vector() const { return *m_Vector; }
+
+	// Entry access
+	T & operator[](size_t i) const { return m_Vector->data()[i]; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 // A generic class to manage attributes
 class AttributeManager {
 
@@ -51,8 +137,11 @@ public:
 	// Number of attributes
 	size_t size() const { return m_Size; }
 
-	// Resize attributes
-	void resize(size_t n) { for (auto ptr : m_Attrs) { ptr.second->resize(n); }; m_Size= n; }
+	// Resize attributes (existing entries are kept, new ones are set to zero)
+	void resize(size_t n) { for (const auto &kv : m_Attrs) { kv.second->resize(n); }; m_Size = n; }
+
+	// Renumber attribute entries (see Attribute::remap)
+	void remap(const std::vector<int> &oldToNew, size_t n) { for (const auto &kv : m_Attrs) { kv.second->remap(oldToNew, n); }; m_Size = n; }
 
 	// Create a new attribute of type T
 	template<typename T>
@@ -66,6 +155,19 @@ public:
 	template<typename T>
 	const Vector<T> & get(const std::string &name) const;
 
+	// Resolve an attribute once for repeated access (invalid handle if absent
+	// or of a different type)
+	template<typename T>
+	AttributeHandle<T> handle(const std::string &name);
+
+	// Resolve an attribute once for repeated read-only access
+	template<typename T>
+	AttributeHandle<const T> handle(const std::string &name) const;
+
+	// Set all entries of an attribute to the same value
+	template<typename T>
+	void fill(const std::string &name, T value);
+
 	// Retrieve attribute type
 	std::type_index type(const std::string &name) const { return m_Attrs.at(name)->type(); }
 
@@ -74,6 +176,15 @@ public:
 
 	// Test whether a given attribute is present
 	bool exists(const std::string &name) const { return m_Attrs.count(name) > 0; }
+
+	// Copy an arithmetic attribute into a vector of doubles (false if absent
+	// or of another type)
+	bool getAsDouble(const std::string &name, Eigen::VectorXd &values) const;
+
+private:
+	// Attribute of type T, or nullptr
+	template<typename T>
+	Attribute<T> * find(const std::string &name) const;
 };
 
 // -----------------------------------------------------------------------------
@@ -92,14 +203,25 @@ AttributeManager::create(const std::string &name) {
 	}
 }
 
+// Attribute of type T, or nullptr (the type tag avoids a dynamic_cast)
+template<typename T>
+Attribute<T> *
+AttributeManager::find(const std::string &name) const {
+	auto it = m_Attrs.find(name);
+	if (it == m_Attrs.end() || it->second->type() != std::type_index(typeid(T))) {
+		return nullptr;
+	}
+	return static_cast<Attribute<T> *>(it->second.get());
+}
+
 // Retrieve attribute by name
 template<typename T>
 AttributeManager::Vector<T> &
 AttributeManager::get(const std::string &name) {
-	assert(m_Attrs.count(name) == 1);
-	std::shared_ptr<AttributeBase> ptr = m_Attrs.at(name);
-	auto * derived = dynamic_cast<Attribute<T> *>(ptr.get());
-	assert(derived); //, "Incompatible type requested for attribute: " + name);
+	auto * derived = find<T>(name);
+	if (derived == nullptr) {
+		throw std::out_of_range("[Attributes] missing or mistyped attribute: " + name);
+	}
 	return derived->content_;
 }
 
@@ -107,13 +229,47 @@ AttributeManager::get(const std::string &name) {
 template<typename T>
 const AttributeManager::Vector<T> &
 AttributeManager::get(const std::string &name) const {
-	assert(m_Attrs.count(name) == 1);
-	std::shared_ptr<const AttributeBase> ptr = m_Attrs.at(name);
-	const auto * derived = dynamic_cast<const Attribute<T> *>(ptr.get());
-	assert(derived); //, "Incompatible type requested for attribute: " + name);
+	const auto * derived = find<T>(name);
+	if (derived == nullptr) {
+		throw std::out_of_range("[Attributes] missing or mistyped attribute: " + name);
+	}
 	return derived->content_;
 }
 
+// Resolve an attribute once for repeated access
+template<typename T>
+AttributeHandle<T>
+AttributeManager::handle(const std::string &name) {
+	auto * derived = find<T>(name);
+	if (derived == nullptr) {
+		std::cerr << "[Attributes] Attribute [" << name << "] not found with the requested type." << std::endl;
+		return AttributeHandle<T>();
+	}
+	return AttributeHandle<T>(&derived->content_);
+}
+
+// Resolve an attribute once for repeated read-only access
+template<typename T>
+AttributeHandle<const T>
+AttributeManager::handle(const std::string &name) const {
+	const auto * derived = find<T>(name);
+	if (derived == nullptr) {
+		std::cerr << "[Attributes] Attribute [" << name << "] not found with the requested type." << std::endl;
+		return AttributeHandle<const T>();
+	}
+	return AttributeHandle<const T>(&derived->content_);
+}
+
+// Set all entries of an attribute to the same value
+template<typename T>
+void AttributeManager::fill(const std::string &name, T value) {
+	auto * derived = find<T>(name);
+	if (derived == nullptr) {
+		throw std::out_of_range("[Attributes] missing or mistyped attribute: " + name);
+	}
+	derived->fill(value);
+}
+
 // -----------------------------------------------------------------------------
 
 // Retrieve attribute keys
@@ -125,4 +281,22 @@ inline std::vector<std::string> AttributeManager::keys() const {
 	return res;
 }
 
-
+// Copy an arithmetic attribute into a vector of doubles
+inline bool AttributeManager::getAsDouble(const std::string &name, Eigen::VectorXd &values) const {
+	if (!exists(name)) {
+		return false;
+	}
+	std::type_index id = type(name);
+	if (id == std::type_index(typeid(double))) {
+		values = get<double>(name);
+	} else if (id == std::type_index(typeid(float))) {
+		values = get<float>(name).cast<double>();
+	} else if (id == std::type_index(typeid(int))) {
+		values = get<int>(name).cast<double>();
+	} else if (id == std::type_index(typeid(unsigned))) {
+		values = get<unsigned>(name).cast<double>();
+	} else {
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,312 @@
+// Micro-benchmarks of the octree operations. Results are written as JSON, one
+// record per (operation, grid size, predicate, mode), so that runs before and
+// after a change of the octree internals can be compared.
+
+#include "octree.h"
+#include "common.h"
+#include "mesh_sign.h"
+#include "mesh_wide_AABB.h"
+#include <geogram/basic/command_line.h>
+#include <geogram/basic/command_line_args.h>
+#include <geogram/basic/logger.h>
+#include <geogram/basic/process.h>
+#include <geogram/basic/stopwatch.h>
+#include <geogram/mesh/mesh.h>
+#include <geogram/mesh/mesh_AABB.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+typedef std::function<bool(int, int, int, int)> Predicate;
+
+struct Record {
+	std::string operation;
+	std::string predicate;
+	std::string mode;
+	int         gridSize;
+	double      seconds;   // Best time over the repetitions
+	int         numCells;
+	int         numNodes;
+	size_t      memory;    // Process memory after the operation (bytes)
+};
+
+// -----------------------------------------------------------------------------
+
+void write_json(std::ostream &out, const std::vector<Record> &records) {
+	out << "{\n";
+	out << "  \"num_cores\": " << GEO::Process::number_of_cores() << ",\n";
+	out << "  \"max_used_memory\": " << GEO::Process::max_used_memory() << ",\n";
+	out << "  \"results\": [\n";
+	for (size_t i = 0; i < records.size(); ++i) {
+		const Record &r = records[i];
+		out << "    { \"operation\": \"" << r.operation << "\""
+			<< ", \"predicate\": \"" << r.predicate << "\""
+			<< ", \"mode\": \"" << r.mode << "\""
+			<< ", \"grid_size\": " << r.gridSize
+			<< ", \"seconds\": " << r.seconds
+			<< ", \"num_cells\": " << r.numCells
+			<< ", \"num_nodes\": " << r.numNodes
+			<< ", \"memory\": " << r.memory
+			<< " }" << (i + 1 < records.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n";
+	out << "}\n";
+}
+
+// -----------------------------------------------------------------------------
+
+// Deterministic hash of a cell, mapped to [0, 1)
+double cell_hash(int x, int y, int z, int extent) {
+	uint64_t h = Morton::encode(Eigen::Vector3i(x, y, z)) * 0x9E3779B97F4A7C15ull + (uint64_t) extent;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Synthetic predicates on a grid of size n
+Predicate make_predicate(const std::string &name, int n) {
+	if (name == "sphere_shell") {
+		return [n](int x, int y, int z, int extent) {
+			const Eigen::Vector3d c = Eigen::Vector3d(x, y, z).array() + 0.5 * extent - 0.5 * n;
+			return extent > 1 && std::abs(c.norm() - 0.35 * n) < 0.87 * extent;
+		};
+	} else if (name == "plane") {
+		return [n](int x, int y, int z, int extent) {
+			const Eigen::Vector3d c = Eigen::Vector3d(x, y, z).array() + 0.5 * extent;
+			const Eigen::Vector3d normal = Eigen::Vector3d(1, 2, 3).normalized();
+			return extent > 1 && std::abs(normal.dot(c) - 0.4 * n * normal.sum()) < 0.87 * extent;
+		};
+	} else {
+		// Below the first two levels, each cell is split with a fixed probability
+		// (3.2 of the 8 children are split again on average)
+		return [n](int x, int y, int z, int extent) {
+			return extent > 1 && (4 * extent > n || cell_hash(x, y, z, extent) < 0.4);
+		};
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+// Closed torus centered in the grid [0, n]^3 (facets oriented outward)
+void make_torus(GEO::Mesh &M, int n, int resolution) {
+	const int nu = 2 * resolution;
+	const int nv = resolution;
+	const double R = 0.3 * n;
+	const double r = 0.12 * n;
+	const double twoPi = 2.0 * std::acos(-1.0);
+	M.clear();
+	M.vertices.create_vertices(nu * nv);
+	for (int i = 0; i < nu; ++i) {
+		for (int j = 0; j < nv; ++j) {
+			const double u = twoPi * i / nu;
+			const double v = twoPi * j / nv;
+			GEO::vec3 &p = M.vertices.point(i * nv + j);
+			p[0] = 0.5 * n + (R + r * std::cos(v)) * std::cos(u);
+			p[1] = 0.5 * n + (R + r * std::cos(v)) * std::sin(u);
+			p[2] = 0.5 * n + r * std::sin(v);
+		}
+	}
+	M.facets.create_triangles(2 * nu * nv);
+	for (int i = 0; i < nu; ++i) {
+		for (int j = 0; j < nv; ++j) {
+			const GEO::index_t a = i * nv + j;
+			const GEO::index_t b = ((i + 1) % nu) * nv + j;
+			const GEO::index_t c = ((i + 1) % nu) * nv + (j + 1) % nv;
+			const GEO::index_t d = i * nv + (j + 1) % nv;
+			const GEO::index_t f = 2 * a;
+			M.facets.set_vertex(f, 0, a); M.facets.set_vertex(f, 1, b); M.facets.set_vertex(f, 2, c);
+			M.facets.set_vertex(f + 1, 0, a); M.facets.set_vertex(f + 1, 1, c); M.facets.set_vertex(f + 1, 2, d);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+class Benchmark {
+
+private:
+	std::vector<Record> m_Records;
+	int m_Repeat;
+
+public:
+	Benchmark(int repeat) : m_Repeat(std::max(1, repeat)) { }
+
+	const std::vector<Record> & records() const { return m_Records; }
+
+	// Time an operation applied to a fresh octree built by setup()
+	void run(const std::string &operation, const std::string &predicate, const std::string &mode,
+		int n, std::function<void(OctreeGrid &)> setup, std::function<void(OctreeGrid &)> op)
+	{
+		Record r;
+		r.operation = operation;
+		r.predicate = predicate;
+		r.mode = mode;
+		r.gridSize = n;
+		r.seconds = std::numeric_limits<double>::max();
+		for (int k = 0; k < m_Repeat; ++k) {
+			OctreeGrid octree(Eigen::Vector3i::Constant(n));
+			setup(octree);
+			GEO::Stopwatch W(operation, false);
+			op(octree);
+			r.seconds = std::min(r.seconds, W.elapsed_time());
+			r.numCells = octree.numCells();
+			r.numNodes = octree.numNodes();
+			r.memory = GEO::Process::used_memory();
+		}
+		GEO::Logger::out("Benchmark") << operation << " " << predicate << " " << mode
+			<< " n=" << n << ": " << r.seconds << "s" << std::endl;
+		m_Records.push_back(r);
+	}
+};
+
+void no_setup(OctreeGrid &) { }
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+	// Initialize the Geogram library
+	GEO::initialize();
+
+	// Import standard command line arguments, and custom ones
+	GEO::CmdLine::import_arg_group("standard");
+	GEO::CmdLine::declare_arg("sizes", "64,128,256", "Fine grid sizes to benchmark (comma separated)");
+	GEO::CmdLine::declare_arg("repeat", 3, "Number of repetitions (the best time is kept)");
+	GEO::CmdLine::declare_arg("mesh_resolution", 128, "Number of rings of the procedural torus");
+
+	// Parse command line options and filenames
+	std::vector<std::string> filenames;
+	if (!GEO::CmdLine::parse(argc, argv, filenames, "<output.json>")) {
+		return 1;
+	}
+	if (filenames.empty()) {
+		filenames.push_back("benchmark.json");
+	}
+
+	std::vector<int> sizes;
+	{
+		std::stringstream ss(GEO::CmdLine::get_arg("sizes"));
+		std::string item;
+		while (std::getline(ss, item, ',')) {
+			if (!item.empty()) { sizes.push_back(std::stoi(item)); }
+		}
+	}
+	Benchmark bench(GEO::CmdLine::get_arg_int("repeat"));
+
+	// Subdivision with synthetic predicates
+	const char *predicates[] = { "sphere_shell", "plane", "random" };
+	const char *modes[] = { "plain", "graded", "paired" };
+	for (int n : sizes) {
+		for (const char *name : predicates) {
+			const Predicate pred = make_predicate(name, n);
+			for (int m = 0; m < 3; ++m) {
+				const bool graded = (m >= 1);
+				const bool paired = (m == 2);
+				bench.run("subdivide", name, modes[m], n, no_setup, [&](OctreeGrid &octree) {
+					octree.subdivide(pred, graded, paired);
+				});
+			}
+			bench.run("subdivide_parallel", name, "plain", n, no_setup, [&](OctreeGrid &octree) {
+				octree.subdivideParallel(pred);
+			});
+			bench.run("subdivide_concurrent", name, "plain", n, no_setup, [&](OctreeGrid &octree) {
+				octree.subdivideConcurrent(pred);
+			});
+		}
+
+		// Export and attribute transfer on a graded sphere shell
+		const Predicate shell = make_predicate("sphere_shell", n);
+		auto refine = [&](OctreeGrid &octree) {
+			octree.subdivide(shell, true, false);
+			Eigen::VectorXf &cellData = octree.cellAttributes.create<float>("data");
+			cellData.setConstant(1.0f);
+			Eigen::VectorXd &nodeData = octree.nodeAttributes.create<double>("data");
+			nodeData.setConstant(1.0);
+		};
+		bench.run("create_mesh", "sphere_shell", "graded", n, refine, [&](OctreeGrid &octree) {
+			GEO::Mesh mesh;
+			octree.createMesh(mesh, Eigen::Vector3d::Zero(), Eigen::Vector3d::Ones());
+		});
+		GEO::Mesh hexes;
+		bench.run("update_mesh_attributes", "sphere_shell", "graded", n, [&](OctreeGrid &octree) {
+			refine(octree);
+			octree.createMesh(hexes, Eigen::Vector3d::Zero(), Eigen::Vector3d::Ones());
+		}, [&](OctreeGrid &octree) {
+			octree.updateMeshAttributes(hexes);
+		});
+		bench.run("extract_surface", "sphere_shell", "graded", n, [&](OctreeGrid &octree) {
+			refine(octree);
+			Eigen::VectorXd &sdf = octree.nodeAttributes.create<double>("sdf");
+			for (int v = 0; v < octree.numNodes(); ++v) {
+				sdf[v] = (octree.nodePos(v).cast<double>().array() - 0.5 * n).matrix().norm() - 0.35 * n;
+			}
+		}, [&](OctreeGrid &octree) {
+			GEO::Mesh surface;
+			octree.extractSurface(surface, "sdf", Eigen::Vector3d::Zero(), Eigen::Vector3d::Ones());
+		});
+
+		// Inside/outside on an octree refined around a procedural mesh
+		GEO::Mesh M;
+		make_torus(M, n, GEO::CmdLine::get_arg_int("mesh_resolution"));
+		GEO::MeshFacetsAABB binary_tree(M);
+		MeshFacetsWideAABB aabb_tree(M, false);
+		auto touches_surface = [&](int x, int y, int z, int extent) {
+			if (extent == 1) { return false; }
+			GEO::Box box;
+			box.xyz_min[0] = x; box.xyz_min[1] = y; box.xyz_min[2] = z;
+			box.xyz_max[0] = x + extent; box.xyz_max[1] = y + extent; box.xyz_max[2] = z + extent;
+			bool has_triangles = false;
+			auto action = [&has_triangles](GEO::index_t) { has_triangles = true; };
+			aabb_tree.compute_bbox_facet_bbox_intersections(box, action);
+			return has_triangles;
+		};
+		auto refine_mesh = [&](OctreeGrid &octree) { octree.subdivide(touches_surface); };
+		bench.run("subdivide", "mesh", "plain", n, no_setup, refine_mesh);
+		bench.run("subdivide_concurrent", "mesh", "plain", n, no_setup, [&](OctreeGrid &octree) {
+			octree.subdivideConcurrent(touches_surface);
+		});
+		auto nearest_facets = [&](const OctreeGrid &octree, std::function<double(const GEO::vec3 &)> sq_dist) {
+			double sum = 0;
+			for (int c = 0; c < octree.numCells(); ++c) {
+				if (octree.cellIsFree(c) || !octree.cellIsLeaf(c)) { continue; }
+				const Eigen::Vector3d q = octree.cellCornerPos(c, 0).cast<double>().array() + 0.5 * octree.cellExtent(c);
+				sum += sq_dist(GEO::vec3(q[0], q[1], q[2]));
+			}
+			return sum;
+		};
+		bench.run("nearest_facet", "mesh", "binary", n, refine_mesh, [&](OctreeGrid &octree) {
+			nearest_facets(octree, [&](const GEO::vec3 &q) { return binary_tree.squared_distance(q); });
+		});
+		bench.run("nearest_facet", "mesh", "wide", n, refine_mesh, [&](OctreeGrid &octree) {
+			nearest_facets(octree, [&](const GEO::vec3 &q) { return aabb_tree.squared_distance(q); });
+		});
+		bench.run("compute_sign", "mesh", "plain", n, refine_mesh, [&](OctreeGrid &octree) {
+			compute_sign(M, aabb_tree, octree, GEO::vec3(0, 0, 0), 1.0);
+		});
+		bench.run("compute_sign_flood_fill", "mesh", "plain", n, refine_mesh, [&](OctreeGrid &octree) {
+			compute_sign_flood_fill(M, aabb_tree, octree, GEO::vec3(0, 0, 0), 1.0);
+		});
+	}
+
+	std::ofstream out(filenames[0]);
+	if (!out) {
+		std::cerr << "[Benchmark] Cannot write file: " << filenames[0] << std::endl;
+		return 1;
+	}
+	write_json(out, bench.records());
+	GEO::Logger::out("Benchmark") << "Results written to " << filenames[0] << std::endl;
+
+	return 0;
+}
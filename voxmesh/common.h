@@ -2,6 +2,7 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 #include <Eigen/Dense>
+#include <cstdint>
 ////////////////////////////////////////////////////////////////////////////////
 
 namespace Math {
@@ -93,3 +94,25 @@ namespace Cube {
 	}
 
 } // namespace Cube
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace Morton {
+
+	// Spread the lower 21 bits of x so that there are two zero bits between each
+	inline uint64_t splitBits(uint64_t x) {
+		x &= 0x1fffff;
+		x = (x | x << 32) & 0x1f00000000ffffull;
+		x = (x | x << 16) & 0x1f0000ff0000ffull;
+		x = (x | x << 8)  & 0x100f00f00f00f00full;
+		x = (x | x << 4)  & 0x10c30c30c30c30c3ull;
+		x = (x | x << 2)  & 0x1249249249249249ull;
+		return x;
+	}
+
+	// Interleave the bits of a (non-negative, 21 bits) grid position
+	inline uint64_t encode(const Eigen::Vector3i &p) {
+		return splitBits(p[0]) | (splitBits(p[1]) << 1) | (splitBits(p[2]) << 2);
+	}
+
+} // namespace Morton
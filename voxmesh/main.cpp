@@ -47,6 +47,9 @@
 
 
 #include "octree.h"
+#include "common.h"
+#include "mesh_sign.h"
+#include "mesh_wide_AABB.h"
 #include <geogram/basic/file_system.h>
 #include <geogram/basic/command_line.h>
 #include <geogram/basic/command_line_args.h>
@@ -56,10 +59,11 @@
 #include <geogram/mesh/mesh.h>
 #include <geogram/mesh/mesh_geometry.h>
 #include <geogram/mesh/mesh_io.h>
-#include <geogram/mesh/mesh_AABB.h>
 #include <geogram/numerics/predicates.h>
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <functional>
 #include <iterator>
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -223,121 +227,10 @@ GEO::vec2 DexelGrid<T>::dexel_center(int x, int y) const {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// NOTE: Function `point_in_triangle_2d` comes from SDFGen by Christopher Batty.
-// https://github.com/christopherbatty/SDFGen/blob/master/makelevelset3.cpp
-////////////////////////////////////////////////////////////////////////////////
-
-// calculate twice signed area of triangle (0,0)-(x1,y1)-(x2,y2)
-// return an SOS-determined sign (-1, +1, or 0 only if it's a truly degenerate triangle)
-int orientation(
-	double x1, double y1, double x2, double y2, double &twice_signed_area)
-{
-	twice_signed_area=y1*x2-x1*y2;
-	if(twice_signed_area>0) return 1;
-	else if(twice_signed_area<0) return -1;
-	else if(y2>y1) return 1;
-	else if(y2<y1) return -1;
-	else if(x1>x2) return 1;
-	else if(x1<x2) return -1;
-	else return 0; // only true when x1==x2 and y1==y2
-}
-
-// -----------------------------------------------------------------------------
-
-// robust test of (x0,y0) in the triangle (x1,y1)-(x2,y2)-(x3,y3)
-// if true is returned, the barycentric coordinates are set in a,b,c.
-bool point_in_triangle_2d(
-	double x0, double y0, double x1, double y1,
-	double x2, double y2, double x3, double y3,
-	double &a, double &b, double &c)
-{
-	x1-=x0; x2-=x0; x3-=x0;
-	y1-=y0; y2-=y0; y3-=y0;
-	int signa=orientation(x2, y2, x3, y3, a);
-	if(signa==0) return false;
-	int signb=orientation(x3, y3, x1, y1, b);
-	if(signb!=signa) return false;
-	int signc=orientation(x1, y1, x2, y2, c);
-	if(signc!=signa) return false;
-	double sum=a+b+c;
-	geo_assert(sum!=0); // if the SOS signs match and are nonzero, there's no way all of a, b, and c are zero.
-	a/=sum;
-	b/=sum;
-	c/=sum;
-	return true;
-}
-
-// -----------------------------------------------------------------------------
-
-// \brief Computes the (approximate) orientation predicate in 2d.
-// \details Computes the sign of the (approximate) signed volume of
-//  the triangle p0, p1, p2
-// \param[in] p0 first vertex of the triangle
-// \param[in] p1 second vertex of the triangle
-// \param[in] p2 third vertex of the triangle
-// \retval POSITIVE if the triangle is oriented positively
-// \retval ZERO if the triangle is flat
-// \retval NEGATIVE if the triangle is oriented negatively
-// \todo check whether orientation is inverted as compared to
-//   Shewchuk's version.
-inline GEO::Sign orient_2d_inexact(GEO::vec2 p0, GEO::vec2 p1, GEO::vec2 p2) {
-	double a11 = p1[0] - p0[0] ;
-	double a12 = p1[1] - p0[1] ;
-
-	double a21 = p2[0] - p0[0] ;
-	double a22 = p2[1] - p0[1] ;
-
-	double Delta = GEO::det2x2(
-		a11, a12,
-		a21, a22
-	);
-
-	return GEO::geo_sgn(Delta);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-
-
-/**
- * @brief      { Intersect a vertical ray with a triangle }
- *
- * @param[in]  M     { Mesh containing the triangle to intersect }
- * @param[in]  f     { Index of the facet to intersect }
- * @param[in]  q     { Query point (only XY coordinates are used) }
- * @param[out] z     { Intersection }
- *
- * @return     { {-1,0,1} depending on the sign of the intersection. }
- */
-template<int X = 0, int Y = 1, int Z = 2>
-int intersect_ray_z(const GEO::Mesh &M, GEO::index_t f, const GEO::vec3 &q, double &z) {
-	using namespace GEO;
-
-	index_t c = M.facets.corners_begin(f);
-	const vec3& p1 = Geom::mesh_vertex(M, M.facet_corners.vertex(c++));
-	const vec3& p2 = Geom::mesh_vertex(M, M.facet_corners.vertex(c++));
-	const vec3& p3 = Geom::mesh_vertex(M, M.facet_corners.vertex(c));
-
-	double u, v, w;
-	if (point_in_triangle_2d(
-		q[X], q[Y], p1[X], p1[Y], p2[X], p2[Y], p3[X], p3[Y], u, v, w))
-	{
-		z = u*p1[Z] + v*p2[Z] + w*p3[Z];
-		auto sign = orient_2d_inexact(vec2(p1[X], p1[Y]), vec2(p2[X], p2[Y]), vec2(p3[X], p3[Y]));
-		switch (sign) {
-		case GEO::POSITIVE: return 1;
-		case GEO::NEGATIVE: return -1;
-		default: return 0;
-		}
-	}
-
-	return 0;
-}
-
-// -----------------------------------------------------------------------------
 
 template<typename T>
 void compute_sign(const GEO::Mesh &M,
-	const GEO::MeshFacetsAABB &aabb_tree, VoxelGrid<T> &voxels)
+	const MeshFacetsWideAABB &aabb_tree, VoxelGrid<T> &voxels)
 {
 	const GEO::vec3i size = voxels.grid_size();
 
@@ -392,7 +285,7 @@ void compute_sign(const GEO::Mesh &M,
 
 template<typename T>
 void compute_sign(const GEO::Mesh &M,
-	const GEO::MeshFacetsAABB &aabb_tree, DexelGrid<T> &dexels)
+	const MeshFacetsWideAABB &aabb_tree, DexelGrid<T> &dexels)
 {
 	const GEO::vec2i size = dexels.grid_size();
 
@@ -449,67 +342,110 @@ void compute_sign(const GEO::Mesh &M,
 
 // -----------------------------------------------------------------------------
 
-void compute_sign(const GEO::Mesh &M, const GEO::MeshFacetsAABB &aabb_tree,
-	OctreeGrid &octree, GEO::vec3 origin, double spacing)
+// Signed distance from a point to the mesh (negative inside)
+double signed_distance(const GEO::Mesh &M, const MeshFacetsWideAABB &aabb_tree,
+	const GEO::vec3 &p, double zmin, double zmax)
 {
-	Eigen::VectorXf & inside = octree.cellAttributes.create<float>("inside");
-	inside.resize(octree.numCells());
-	inside.setZero();
+	GEO::vec3 nearest_point;
+	double sq_dist;
+	aabb_tree.nearest_facet(p, nearest_point, sq_dist);
+	double dist = std::sqrt(sq_dist);
+	return (point_is_inside(M, aabb_tree, p, zmin, zmax) ? -dist : dist);
+}
 
-	try {
-		GEO::ProgressTask task("Ray marching", 100);
+// -----------------------------------------------------------------------------
 
-		GEO::vec3 min_corner, max_corner;
-		GEO::get_bbox(M, &min_corner[0], &max_corner[0]);
+/**
+ * @brief      { Refine an octree until the trilinear interpolation of the
+ *             signed distance at the cell corners matches the exact distance
+ *             up to a given tolerance (measured at the cell center and at the
+ *             center of each face), then store the signed distance at the
+ *             octree nodes in the "sdf" node attribute. The predicate is
+ *             evaluated in parallel, one level at a time. With a budget of
+ *             cells, the cells with the largest error are split first. }
+ *
+ * @param[in]  M          { Input triangle mesh }
+ * @param[in]  aabb_tree  { AABB tree of the input mesh }
+ * @param      octree     { Octree to refine }
+ * @param[in]  origin     { Origin of the octree in world coordinates }
+ * @param[in]  spacing    { Size of the finest cells }
+ * @param[in]  tolerance  { Maximum interpolation error (in mm) }
+ * @param[in]  graded     { Should the octree be 2:1 graded }
+ * @param[in]  paired     { Should the octree respect the pairing rule }
+ * @param[in]  max_cells  { Maximum number of cells (unlimited if negative) }
+ */
+void compute_octree_sdf(const GEO::Mesh &M, const MeshFacetsWideAABB &aabb_tree,
+	OctreeGrid &octree, GEO::vec3 origin, double spacing, double tolerance,
+	bool graded, bool paired, int max_cells)
+{
+	GEO::vec3 min_corner, max_corner;
+	GEO::get_bbox(M, &min_corner[0], &max_corner[0]);
+	const double zmin = min_corner[2] - spacing;
+	const double zmax = max_corner[2] + spacing;
 
-		GEO::parallel_for(0, octree.numCells(), [&](int cellId) {
-			auto cell_xyz_min = octree.cellCornerPos(cellId, OctreeGrid::CORNER_X0_Y0_Z0);
-			auto extent = octree.cellExtent(cellId);
-
-			GEO::Box box;
-			box.xyz_min[0] = origin[0] + spacing * cell_xyz_min[0];
-			box.xyz_min[1] = origin[1] + spacing * cell_xyz_min[1];
-			box.xyz_max[0] = box.xyz_min[0] + spacing * extent;
-			box.xyz_max[1] = box.xyz_min[1] + spacing * extent;
-			box.xyz_min[2] = min_corner[2] - spacing;
-			box.xyz_max[2] = max_corner[2] + spacing;
-
-			GEO::vec3 center(
-				box.xyz_min[0] + 0.5 * spacing * extent,
-				box.xyz_min[1] + 0.5 * spacing * extent,
-				origin[2] + spacing * cell_xyz_min[2] + 0.5 * spacing * extent
-			);
-
-			std::vector<std::pair<double, int>> inter;
-			auto action = [&M, &inter, &center] (GEO::index_t f) {
-				double z;
-				if (int s = intersect_ray_z(M, f, center, z)) {
-					inter.emplace_back(z, s);
-				}
-			};
-			aabb_tree.compute_bbox_facet_bbox_intersections(box, action);
-			std::sort(inter.begin(), inter.end());
-
-			std::vector<double> reduced;
-			for (int i = 0, s = 0; i < inter.size(); ++i) {
-				const int ds = inter[i].second;
-				s += ds;
-				if ((s == -1 && ds < 0) || (s == 0 && ds > 0)) {
-					reduced.push_back(inter[i].first);
+	auto sdf = [&](double x, double y, double z) {
+		return signed_distance(M, aabb_tree, origin + spacing * GEO::vec3(x, y, z), zmin, zmax);
+	};
+
+	// Largest interpolation error at the cell center and face centers
+	auto interpolation_error = [&](int x, int y, int z, int extent) {
+		double d[2][2][2];
+		for (int k = 0; k < 2; ++k) {
+			for (int j = 0; j < 2; ++j) {
+				for (int i = 0; i < 2; ++i) {
+					d[i][j][k] = sdf(x + i * extent, y + j * extent, z + k * extent);
 				}
 			}
+		}
+		const double h = 0.5 * extent;
 
-			int num_before = 0;
-			for (double z : reduced) {
-				if (z < center[2]) { ++num_before; }
-			}
-			if (num_before % 2 == 1) {
-				inside(cellId) = 1.0;
+		// Cell center
+		double interp = 0;
+		for (int c = 0; c < 8; ++c) {
+			interp += d[c & 1][(c >> 1) & 1][(c >> 2) & 1];
+		}
+		double error = std::abs(sdf(x + h, y + h, z + h) - interp / 8.0);
+
+		// Face centers
+		for (int axis = 0; axis < 3; ++axis) {
+			for (int side = 0; side < 2; ++side) {
+				interp = 0;
+				for (int a = 0; a < 2; ++a) {
+					for (int b = 0; b < 2; ++b) {
+						int u[3];
+						u[axis] = side;
+						u[(axis + 1) % 3] = a;
+						u[(axis + 2) % 3] = b;
+						interp += d[u[0]][u[1]][u[2]];
+					}
+				}
+				GEO::vec3 p(x + h, y + h, z + h);
+				p[axis] += (side ? h : -h);
+				error = std::max(error, std::abs(sdf(p[0], p[1], p[2]) - interp / 4.0));
 			}
-		});
-	} catch(const GEO::TaskCanceled&) {
-		// Do early cleanup
+		}
+		return error;
+	};
+
+	// Refine cells where the trilinear interpolant is not accurate enough
+	if (max_cells < 0) {
+		octree.subdivideParallel([&](int x, int y, int z, int extent) {
+			return extent > 1 && interpolation_error(x, y, z, extent) > tolerance;
+		}, graded, paired);
+	} else {
+		octree.subdivideByPriority([&](int x, int y, int z, int extent) {
+			const double error = interpolation_error(x, y, z, extent);
+			return (error > tolerance ? error : 0.0);
+		}, max_cells, graded, paired);
 	}
+
+	// Signed distance at the octree nodes
+	Eigen::VectorXd & dist = octree.nodeAttributes.create<double>("sdf");
+	dist.resize(octree.numNodes());
+	GEO::parallel_for(0, octree.numNodes(), [&](int v) {
+		Eigen::Vector3i pos = octree.nodePos(v);
+		dist(v) = sdf(pos[0], pos[1], pos[2]);
+	});
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -742,9 +678,94 @@ static unsigned next_pow2(unsigned x) {
 	return x + 1;
 }
 
-void compute_octree(const GEO::Mesh &M, const GEO::MeshFacetsAABB &aabb_tree,
-	const std::string &filename, GEO::vec3 min_corner, GEO::vec3 extent,
+/**
+ * @brief      { Build an octree bottom-up from a dense voxelization of the
+ *             input mesh. Voxels touching the bounding box of a facet are
+ *             flagged for refinement, which is the test made by the AABB
+ *             predicate of compute_octree() on the finest cells, so both
+ *             methods produce the same leaves. The "inside" attribute of the
+ *             leaves is read from the voxel grid instead of casting new rays. }
+ *
+ * @param[in]  M           { Input triangle mesh }
+ * @param[in]  aabb_tree   { AABB tree of the input mesh }
+ * @param      octree      { Octree to build (with its fine cell grid size) }
+ * @param[in]  grid_size   { Size of the fine cell grid of the octree }
+ * @param[in]  min_corner  { Min corner of the input mesh bbox }
+ * @param[in]  extent      { Extent of the input mesh bbox }
+ * @param[in]  spacing     { Size of a voxel }
+ * @param[in]  padding     { Number of padded voxels }
+ * @param[in]  graded      { Should the octree be 2:1 graded }
+ * @param[in]  paired      { Should the octree respect the pairing rule }
+ */
+void compute_octree_bottom_up(const GEO::Mesh &M, const MeshFacetsWideAABB &aabb_tree,
+	OctreeGrid &octree, Eigen::Vector3i grid_size, GEO::vec3 min_corner, GEO::vec3 extent,
 	double spacing, int padding, bool graded, bool paired)
+{
+	VoxelGrid<num_t> voxels(min_corner, extent, spacing, padding);
+	compute_sign(M, aabb_tree, voxels);
+	const GEO::vec3 origin = voxels.origin();
+	const GEO::vec3i size = voxels.grid_size();
+
+	// Inside/outside labels (the octree grid is padded to a power of two)
+	std::vector<uint8_t> labels(grid_size.prod(), 0);
+	GEO::parallel_for(0, size[2], [&](int z) {
+		for (int y = 0; y < size[1]; ++y) {
+			for (int x = 0; x < size[0]; ++x) {
+				labels[Layout3D::toIndex(Eigen::Vector3i(x, y, z), grid_size)] =
+					voxels.at(voxels.index_from_index3(GEO::vec3i(x, y, z)));
+			}
+		}
+	});
+
+	// Flag voxels overlapping a facet bbox, with the same box test as the predicate
+	std::vector<char> refine(grid_size.prod(), 0);
+	for (GEO::index_t f = 0; f < M.facets.nb(); ++f) {
+		GEO::vec3 bmin = M.vertices.point(M.facets.vertex(f, 0));
+		GEO::vec3 bmax = bmin;
+		for (GEO::index_t lv = 1; lv < M.facets.nb_vertices(f); ++lv) {
+			const GEO::vec3 &p = M.vertices.point(M.facets.vertex(f, lv));
+			for (int c = 0; c < 3; ++c) {
+				bmin[c] = std::min(bmin[c], p[c]);
+				bmax[c] = std::max(bmax[c], p[c]);
+			}
+		}
+		int lo[3], hi[3];
+		for (int c = 0; c < 3; ++c) {
+			lo[c] = std::max(0, (int) std::floor((bmin[c] - origin[c]) / spacing) - 1);
+			hi[c] = std::min(grid_size[c] - 1, (int) std::floor((bmax[c] - origin[c]) / spacing) + 1);
+			auto overlaps = [&](int x) {
+				const double xmin = origin[c] + spacing * x;
+				const double xmax = xmin + spacing * 1;
+				return xmin <= bmax[c] && xmax >= bmin[c];
+			};
+			while (lo[c] <= hi[c] && !overlaps(lo[c])) { ++lo[c]; }
+			while (hi[c] >= lo[c] && !overlaps(hi[c])) { --hi[c]; }
+		}
+		for (int z = lo[2]; z <= hi[2]; ++z) {
+			for (int y = lo[1]; y <= hi[1]; ++y) {
+				for (int x = lo[0]; x <= hi[0]; ++x) {
+					refine[Layout3D::toIndex(Eigen::Vector3i(x, y, z), grid_size)] = 1;
+				}
+			}
+		}
+	}
+
+	std::vector<int> cell_labels;
+	octree.buildBottomUp(refine, labels, cell_labels, graded, paired);
+
+	Eigen::VectorXf & inside = octree.cellAttributes.create<float>("inside");
+	inside.resize(octree.numCells());
+	for (int c = 0; c < octree.numCells(); ++c) {
+		inside(c) = (cell_labels[c] == 1 ? 1.0f : 0.0f);
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+void compute_octree(const GEO::Mesh &M, const MeshFacetsWideAABB &aabb_tree,
+	const std::string &filename, GEO::vec3 min_corner, GEO::vec3 extent,
+	double spacing, int padding, bool graded, bool paired, bool flood_fill,
+	double sdf_tolerance, int max_cells, bool bottom_up, bool contour)
 {
 	GEO::vec3 origin =  min_corner - padding * spacing * GEO::vec3(1, 1, 1);
 	Eigen::Vector3i grid_size(
@@ -770,17 +791,53 @@ void compute_octree(const GEO::Mesh &M, const GEO::MeshFacetsAABB &aabb_tree,
 		aabb_tree.compute_bbox_facet_bbox_intersections(box, action);
 		return has_triangles;
 	};
-	octree.subdivide(should_subdivide, graded, paired);
+	if (sdf_tolerance > 0) {
+		compute_octree_sdf(M, aabb_tree, octree, origin, spacing, sdf_tolerance, graded, paired, max_cells);
+	} else if (bottom_up) {
+		compute_octree_bottom_up(M, aabb_tree, octree, grid_size, min_corner, extent,
+			spacing, padding, graded, paired);
+	} else {
+		// Cells touching the surface are refined down to the finest level
+		// anyway, so grading can be enforced once at the end. Subtrees are
+		// grown concurrently since the predicate is cheap.
+		octree.subdivideConcurrent(should_subdivide);
+		if (graded || paired) {
+			octree.balance(graded, paired);
+		}
+	}
 
 	// Compute inside/outside info
-	compute_sign(M, aabb_tree, octree, origin, spacing);
+	if (bottom_up && sdf_tolerance <= 0) {
+		// Already read from the voxel grid
+	} else if (flood_fill) {
+		compute_sign_flood_fill(M, aabb_tree, octree, origin, spacing);
+	} else {
+		compute_sign(M, aabb_tree, octree, origin, spacing);
+	}
 
-	// Export
+	// Export cells and nodes in Morton order
 	GEO::Logger::div("Saving");
+	octree.reorder();
+	if (endswith(filename, ".oct")) {
+		octree.save(filename);
+		return;
+	}
 	GEO::Mesh M_out;
-	{
-		Eigen::Vector3d o(origin[0], origin[1], origin[2]);
-		Eigen::Vector3d s(spacing, spacing, spacing);
+	Eigen::Vector3d o(origin[0], origin[1], origin[2]);
+	Eigen::Vector3d s(spacing, spacing, spacing);
+	if (contour) {
+		// Normals of the closest input facets at the edge crossings
+		auto normal = [&](const Eigen::Vector3d &p) {
+			GEO::vec3 q(o[0] + spacing * p[0], o[1] + spacing * p[1], o[2] + spacing * p[2]);
+			GEO::vec3 nearest_point;
+			double sq_dist;
+			GEO::index_t f = aabb_tree.nearest_facet(q, nearest_point, sq_dist);
+			GEO::vec3 n = GEO::Geom::mesh_facet_normal(M, f);
+			return Eigen::Vector3d(n[0], n[1], n[2]);
+		};
+		GEO::Logger::out("OctreeGrid") << "Extracting surface..." << std::endl;
+		octree.extractSurface(M_out, (sdf_tolerance > 0 ? "sdf" : "inside"), o, s, normal);
+	} else {
 		GEO::Logger::out("OctreeGrid") << "Creating volume mesh..." << std::endl;
 		octree.createMesh(M_out, o, s);
 	}
@@ -804,6 +861,12 @@ int main(int argc, char** argv) {
 	GEO::CmdLine::declare_arg("octree", false, "Generate an adaptive octree of the input model");
 	GEO::CmdLine::declare_arg("graded", false, "Should the octree be 2:1 graded");
 	GEO::CmdLine::declare_arg("paired", false, "Should the octree respect the pairing rule");
+	GEO::CmdLine::declare_arg("flood_fill", false, "Only cast rays from octree leaves touching the surface");
+	GEO::CmdLine::declare_arg("bottom_up", false, "Build the octree from a dense voxelization instead of testing each cell");
+	GEO::CmdLine::declare_arg("sdf", false, "Store the signed distance field at the octree nodes");
+	GEO::CmdLine::declare_arg("sdf_tolerance", 0.01, "Max interpolation error of the octree distance field (in mm)");
+	GEO::CmdLine::declare_arg("max_cells", -1, "Max number of cells of the distance field octree (largest errors are refined first)");
+	GEO::CmdLine::declare_arg("contour", false, "Output the surface extracted from the octree by dual contouring instead of its cells");
 
 	// Parse command line options and filenames
 	std::vector<std::string> filenames;
@@ -819,6 +882,11 @@ int main(int argc, char** argv) {
 	bool octree = GEO::CmdLine::get_arg_bool("octree");
 	bool graded = GEO::CmdLine::get_arg_bool("graded");
 	bool paired = GEO::CmdLine::get_arg_bool("paired");
+	bool flood_fill = GEO::CmdLine::get_arg_bool("flood_fill");
+	double sdf_tolerance = (GEO::CmdLine::get_arg_bool("sdf") ? GEO::CmdLine::get_arg_double("sdf_tolerance") : 0.0);
+	int max_cells = GEO::CmdLine::get_arg_int("max_cells");
+	bool bottom_up = GEO::CmdLine::get_arg_bool("bottom_up");
+	bool contour = GEO::CmdLine::get_arg_bool("contour");
 
 	// Default output filename is "output" if unspecified
 	if(filenames.size() == 1) {
@@ -852,7 +920,7 @@ int main(int argc, char** argv) {
 		double max_extent = std::max(extent[0], std::max(extent[1], extent[2]));
 		voxel_size = max_extent / num_voxels;
 	}
-	GEO::MeshFacetsAABB aabb_tree(M);
+	MeshFacetsWideAABB aabb_tree(M);
 
 	// Dexelize the input mesh
 	if (dexelize) {
@@ -868,7 +936,8 @@ int main(int argc, char** argv) {
 	// Compute an octree of the input mesh
 	if (octree) {
 		GEO::Logger::div("Octree");
-		compute_octree(M, aabb_tree, filenames[1], min_corner, extent, voxel_size, padding, graded, paired);
+		compute_octree(M, aabb_tree, filenames[1], min_corner, extent, voxel_size, padding,
+			graded, paired, flood_fill, sdf_tolerance, max_cells, bottom_up, contour);
 		return 0;
 	}
 
@@ -0,0 +1,226 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "mesh_sign.h"
+#include <geogram/basic/logger.h>
+#include <geogram/basic/process.h>
+#include <geogram/basic/progress.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief      { Test whether a point lies inside the mesh, by casting a ray along Z }
+ *
+ * @param[in]  M          { Input triangle mesh }
+ * @param[in]  aabb_tree  { AABB tree of the input mesh }
+ * @param[in]  q          { Query point }
+ * @param[in]  zmin       { Lower bound of the ray along Z }
+ * @param[in]  zmax       { Upper bound of the ray along Z }
+ *
+ * @return     { true if the query point is inside the mesh }
+ */
+bool point_is_inside(const GEO::Mesh &M, const MeshFacetsWideAABB &aabb_tree,
+	const GEO::vec3 &q, double zmin, double zmax)
+{
+	GEO::Box box;
+	box.xyz_min[0] = box.xyz_max[0] = q[0];
+	box.xyz_min[1] = box.xyz_max[1] = q[1];
+	box.xyz_min[2] = zmin;
+	box.xyz_max[2] = zmax;
+
+	// Scratch buffer reused across calls made by the same thread
+	thread_local std::vector<std::pair<double, int>> inter;
+	inter.clear();
+	auto action = [&M, &q] (GEO::index_t f) {
+		double z;
+		if (int s = intersect_ray_z(M, f, q, z)) {
+			inter.emplace_back(z, s);
+		}
+	};
+	aabb_tree.compute_bbox_facet_bbox_intersections(box, action);
+	std::sort(inter.begin(), inter.end());
+
+	// Count in/out events located below the query point
+	int num_before = 0;
+	for (int i = 0, s = 0; i < (int) inter.size() && inter[i].first < q[2]; ++i) {
+		const int ds = inter[i].second;
+		s += ds;
+		if ((s == -1 && ds < 0) || (s == 0 && ds > 0)) {
+			++num_before;
+		}
+	}
+	return (num_before % 2 == 1);
+}
+
+// -----------------------------------------------------------------------------
+
+// Bounding box of an octree cell in world coordinates
+GEO::Box octree_cell_box(const OctreeGrid &octree, int cellId, GEO::vec3 origin, double spacing) {
+	auto cell_xyz_min = octree.cellCornerPos(cellId, OctreeGrid::CORNER_X0_Y0_Z0);
+	auto extent = octree.cellExtent(cellId);
+	GEO::Box box;
+	for (int c = 0; c < 3; ++c) {
+		box.xyz_min[c] = origin[c] + spacing * cell_xyz_min[c];
+		box.xyz_max[c] = box.xyz_min[c] + spacing * extent;
+	}
+	return box;
+}
+
+// -----------------------------------------------------------------------------
+
+void compute_sign(const GEO::Mesh &M, const MeshFacetsWideAABB &aabb_tree,
+	OctreeGrid &octree, GEO::vec3 origin, double spacing)
+{
+	Eigen::VectorXf & inside = octree.cellAttributes.create<float>("inside");
+	inside.resize(octree.numCells());
+	inside.setZero();
+
+	try {
+		GEO::ProgressTask task("Ray marching", 100);
+
+		GEO::vec3 min_corner, max_corner;
+		GEO::get_bbox(M, &min_corner[0], &max_corner[0]);
+
+		GEO::parallel_for(0, octree.numCells(), [&](int cellId) {
+			GEO::Box box = octree_cell_box(octree, cellId, origin, spacing);
+			GEO::vec3 center(
+				0.5 * (box.xyz_min[0] + box.xyz_max[0]),
+				0.5 * (box.xyz_min[1] + box.xyz_max[1]),
+				0.5 * (box.xyz_min[2] + box.xyz_max[2])
+			);
+			if (point_is_inside(M, aabb_tree, center, min_corner[2] - spacing, max_corner[2] + spacing)) {
+				inside(cellId) = 1.0;
+			}
+		});
+	} catch(const GEO::TaskCanceled&) {
+		// Do early cleanup
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+/**
+ * @brief      { Compute inside/outside info for the leaves of an octree. Rays
+ *             are only cast from leaves whose box touches the surface. The
+ *             other leaves are grouped into connected components by a parallel
+ *             flood fill over the cell adjacency, and a single ray is cast per
+ *             component. Internal cells are left at 0. }
+ */
+void compute_sign_flood_fill(const GEO::Mesh &M, const MeshFacetsWideAABB &aabb_tree,
+	OctreeGrid &octree, GEO::vec3 origin, double spacing)
+{
+	Eigen::VectorXf & inside = octree.cellAttributes.create<float>("inside");
+	inside.resize(octree.numCells());
+	inside.setZero();
+
+	GEO::vec3 min_corner, max_corner;
+	GEO::get_bbox(M, &min_corner[0], &max_corner[0]);
+	const double zmin = min_corner[2] - spacing;
+	const double zmax = max_corner[2] + spacing;
+
+	auto cell_center = [&](int cellId) {
+		Eigen::Vector3d pos = octree.cellCenterPos(cellId);
+		return GEO::vec3(
+			origin[0] + spacing * pos[0],
+			origin[1] + spacing * pos[1],
+			origin[2] + spacing * pos[2]
+		);
+	};
+
+	// Collect leaf cells
+	std::vector<int> leaves;
+	std::vector<int> cellToLeaf(octree.numCells(), -1);
+	for (int cellId = 0; cellId < octree.numCells(); ++cellId) {
+		if (octree.cellIsLeaf(cellId)) {
+			cellToLeaf[cellId] = (int) leaves.size();
+			leaves.push_back(cellId);
+		}
+	}
+	const int numLeaves = (int) leaves.size();
+
+	// Flag leaves whose box touches the bbox of a triangle
+	std::vector<char> surface(numLeaves, 0);
+	GEO::parallel_for(0, numLeaves, [&](int i) {
+		GEO::Box box = octree_cell_box(octree, leaves[i], origin, spacing);
+		bool has_triangles = false;
+		auto action = [&has_triangles](GEO::index_t) { has_triangles = true; };
+		aabb_tree.compute_bbox_facet_bbox_intersections(box, action);
+		surface[i] = has_triangles;
+	});
+
+	// Adjacency between non-surface leaves. A leaf links to the smallest cell
+	// at least as large as itself, so each pair of adjacent leaves is seen at
+	// least from the finer side, and we store both directions.
+	std::vector<int> offset(numLeaves + 1, 0);
+	auto for_each_link = [&](int i, std::function<void(int, int)> func) {
+		if (surface[i]) { return; }
+		for (int axis = 0; axis < 3; ++axis) {
+			for (int dir = 0; dir < 2; ++dir) {
+				int neigh = octree.cellNeighId(leaves[i], axis, dir);
+				if (neigh == -1 || cellToLeaf[neigh] == -1) { continue; }
+				int j = cellToLeaf[neigh];
+				if (!surface[j]) { func(i, j); }
+			}
+		}
+	};
+	for (int i = 0; i < numLeaves; ++i) {
+		for_each_link(i, [&](int a, int b) { ++offset[a+1]; ++offset[b+1]; });
+	}
+	for (int i = 0; i < numLeaves; ++i) {
+		offset[i+1] += offset[i];
+	}
+	std::vector<int> adjacency(offset.back());
+	{
+		std::vector<int> pos(offset.begin(), offset.end() - 1);
+		for (int i = 0; i < numLeaves; ++i) {
+			for_each_link(i, [&](int a, int b) { adjacency[pos[a]++] = b; adjacency[pos[b]++] = a; });
+		}
+	}
+
+	// Connected components by parallel min-label propagation with pointer jumping
+	std::vector<int> label(numLeaves), tmp(numLeaves);
+	for (int i = 0; i < numLeaves; ++i) {
+		label[i] = i;
+	}
+	int numRounds = 0;
+	for (bool changed = true; changed; ++numRounds) {
+		GEO::parallel_for(0, numLeaves, [&](int i) {
+			int l = label[i];
+			for (int k = offset[i]; k < offset[i+1]; ++k) {
+				l = std::min(l, label[adjacency[k]]);
+			}
+			tmp[i] = l;
+		});
+		std::atomic<bool> any(false);
+		GEO::parallel_for(0, numLeaves, [&](int i) {
+			int l = tmp[tmp[i]];
+			if (l != label[i]) {
+				label[i] = l;
+				any = true;
+			}
+		});
+		changed = any;
+	}
+
+	// Cast rays from surface leaves and one leaf per component
+	std::atomic<int> numRays(0);
+	GEO::parallel_for(0, numLeaves, [&](int i) {
+		if (surface[i] || label[i] == i) {
+			if (point_is_inside(M, aabb_tree, cell_center(leaves[i]), zmin, zmax)) {
+				inside(leaves[i]) = 1.0;
+			}
+			++numRays;
+		}
+	});
+
+	// Propagate the labels of the representatives to their components
+	GEO::parallel_for(0, numLeaves, [&](int i) {
+		if (!surface[i] && label[i] != i) {
+			inside(leaves[i]) = inside(leaves[label[i]]);
+		}
+	});
+
+	GEO::Logger::out("Octree") << "Cast " << numRays << " rays for " << numLeaves
+		<< " leaves (" << numRounds << " flood fill rounds)" << std::endl;
+}
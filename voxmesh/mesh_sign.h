@@ -0,0 +1,141 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "octree.h"
+#include <geogram/mesh/mesh.h>
+#include <geogram/mesh/mesh_geometry.h>
+#include "mesh_wide_AABB.h"
+////////////////////////////////////////////////////////////////////////////////
+
+// Inside/outside queries against a closed triangle mesh, by casting rays
+// along Z and counting the oriented crossings
+
+////////////////////////////////////////////////////////////////////////////////
+// NOTE: Function `point_in_triangle_2d` comes from SDFGen by Christopher Batty.
+// https://github.com/christopherbatty/SDFGen/blob/master/makelevelset3.cpp
+////////////////////////////////////////////////////////////////////////////////
+
+// calculate twice signed area of triangle (0,0)-(x1,y1)-(x2,y2)
+// return an SOS-determined sign (-1, +1, or 0 only if it's a truly degenerate triangle)
+inline int orientation(
+	double x1, double y1, double x2, double y2, double &twice_signed_area)
+{
+	twice_signed_area=y1*x2-x1*y2;
+	if(twice_signed_area>0) return 1;
+	else if(twice_signed_area<0) return -1;
+	else if(y2>y1) return 1;
+	else if(y2<y1) return -1;
+	else if(x1>x2) return 1;
+	else if(x1<x2) return -1;
+	else return 0; // only true when x1==x2 and y1==y2
+}
+
+// -----------------------------------------------------------------------------
+
+// robust test of (x0,y0) in the triangle (x1,y1)-(x2,y2)-(x3,y3)
+// if true is returned, the barycentric coordinates are set in a,b,c.
+inline bool point_in_triangle_2d(
+	double x0, double y0, double x1, double y1,
+	double x2, double y2, double x3, double y3,
+	double &a, double &b, double &c)
+{
+	x1-=x0; x2-=x0; x3-=x0;
+	y1-=y0; y2-=y0; y3-=y0;
+	int signa=orientation(x2, y2, x3, y3, a);
+	if(signa==0) return false;
+	int signb=orientation(x3, y3, x1, y1, b);
+	if(signb!=signa) return false;
+	int signc=orientation(x1, y1, x2, y2, c);
+	if(signc!=signa) return false;
+	double sum=a+b+c;
+	geo_assert(sum!=0); // if the SOS signs match and are nonzero, there's no way all of a, b, and c are zero.
+	a/=sum;
+	b/=sum;
+	c/=sum;
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// \brief Computes the (approximate) orientation predicate in 2d.
+// \details Computes the sign of the (approximate) signed volume of
+//  the triangle p0, p1, p2
+// \param[in] p0 first vertex of the triangle
+// \param[in] p1 second vertex of the triangle
+// \param[in] p2 third vertex of the triangle
+// \retval POSITIVE if the triangle is oriented positively
+// \retval ZERO if the triangle is flat
+// \retval NEGATIVE if the triangle is oriented negatively
+// \todo check whether orientation is inverted as compared to
+//   Shewchuk's version.
+inline GEO::Sign orient_2d_inexact(GEO::vec2 p0, GEO::vec2 p1, GEO::vec2 p2) {
+	double a11 = p1[0] - p0[0] ;
+	double a12 = p1[1] - p0[1] ;
+
+	double a21 = p2[0] - p0[0] ;
+	double a22 = p2[1] - p0[1] ;
+
+	double Delta = GEO::det2x2(
+		a11, a12,
+		a21, a22
+	);
+
+	return GEO::geo_sgn(Delta);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+/**
+ * @brief      { Intersect a vertical ray with a triangle }
+ *
+ * @param[in]  M     { Mesh containing the triangle to intersect }
+ * @param[in]  f     { Index of the facet to intersect }
+ * @param[in]  q     { Query point (only XY coordinates are used) }
+ * @param[out] z     { Intersection }
+ *
+ * @return     { {-1,0,1} depending on the sign of the intersection. }
+ */
+template<int X = 0, int Y = 1, int Z = 2>
+int intersect_ray_z(const GEO::Mesh &M, GEO::index_t f, const GEO::vec3 &q, double &z) {
+	using namespace GEO;
+
+	index_t c = M.facets.corners_begin(f);
+	const vec3& p1 = Geom::mesh_vertex(M, M.facet_corners.vertex(c++));
+	const vec3& p2 = Geom::mesh_vertex(M, M.facet_corners.vertex(c++));
+	const vec3& p3 = Geom::mesh_vertex(M, M.facet_corners.vertex(c));
+
+	double u, v, w;
+	if (point_in_triangle_2d(
+		q[X], q[Y], p1[X], p1[Y], p2[X], p2[Y], p3[X], p3[Y], u, v, w))
+	{
+		z = u*p1[Z] + v*p2[Z] + w*p3[Z];
+		auto sign = orient_2d_inexact(vec2(p1[X], p1[Y]), vec2(p2[X], p2[Y]), vec2(p3[X], p3[Y]));
+		switch (sign) {
+		case GEO::POSITIVE: return 1;
+		case GEO::NEGATIVE: return -1;
+		default: return 0;
+		}
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Test whether a point lies inside the mesh, by casting a ray along Z from zmin to zmax
+bool point_is_inside(const GEO::Mesh &M, const MeshFacetsWideAABB &aabb_tree,
+	const GEO::vec3 &q, double zmin, double zmax);
+
+// Bounding box of an octree cell in world coordinates
+GEO::Box octree_cell_box(const OctreeGrid &octree, int cellId, GEO::vec3 origin, double spacing);
+
+// Compute inside/outside info for all the cells of an octree, in the "inside"
+// cell attribute, by casting one ray per cell
+void compute_sign(const GEO::Mesh &M, const MeshFacetsWideAABB &aabb_tree,
+	OctreeGrid &octree, GEO::vec3 origin, double spacing);
+
+// Same as compute_sign(), but rays are only cast from leaves touching the
+// surface and from one leaf per connected component of the other leaves
+void compute_sign_flood_fill(const GEO::Mesh &M, const MeshFacetsWideAABB &aabb_tree,
+	OctreeGrid &octree, GEO::vec3 origin, double spacing);
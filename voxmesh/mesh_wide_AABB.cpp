@@ -0,0 +1,292 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "mesh_wide_AABB.h"
+#include <geogram/mesh/mesh_geometry.h>
+#include <geogram/mesh/mesh_reorder.h>
+#include <geogram/mesh/mesh_repair.h>
+#include <algorithm>
+#include <limits>
+#include <utility>
+// The AVX2 kernels are compiled for their own functions only, and selected at
+// runtime, so that the binaries still run on CPUs without AVX2
+#if defined(VOXMESH_WITH_AVX2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VOXMESH_USE_AVX2
+#define VOXMESH_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+MeshFacetsWideAABB::MeshFacetsWideAABB(GEO::Mesh &M, bool reorder, int leafSize)
+	: m_Mesh(M)
+	, m_LeafSize(std::max(1, leafSize))
+{
+	if (!M.facets.are_simplices()) {
+		GEO::mesh_repair(M, GEO::MeshRepairMode(GEO::MESH_REPAIR_TRIANGULATE | GEO::MESH_REPAIR_QUIET));
+	}
+	if (reorder) {
+		GEO::mesh_reorder(M, GEO::MESH_ORDER_MORTON);
+	}
+	if (M.facets.nb() > 0) {
+		m_Nodes.reserve(2 * M.facets.nb() / (m_LeafSize * WIDTH) + 1);
+		buildNode(0, M.facets.nb());
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+void MeshFacetsWideAABB::facetBox(GEO::index_t f, GEO::Box &box) const {
+	const GEO::vec3 &p0 = GEO::Geom::mesh_vertex(m_Mesh, m_Mesh.facets.vertex(f, 0));
+	const GEO::vec3 &p1 = GEO::Geom::mesh_vertex(m_Mesh, m_Mesh.facets.vertex(f, 1));
+	const GEO::vec3 &p2 = GEO::Geom::mesh_vertex(m_Mesh, m_Mesh.facets.vertex(f, 2));
+	for (int c = 0; c < 3; ++c) {
+		box.xyz_min[c] = std::min(p0[c], std::min(p1[c], p2[c]));
+		box.xyz_max[c] = std::max(p0[c], std::max(p1[c], p2[c]));
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+// Split [b, e) in halves the same way as GEO::MeshFacetsAABB, always splitting
+// the largest range first, until there are WIDTH ranges or all of them fit in
+// a leaf. Returns the index of the new node.
+int MeshFacetsWideAABB::buildNode(GEO::index_t b, GEO::index_t e) {
+	std::vector<std::pair<GEO::index_t, GEO::index_t>> ranges(1, std::make_pair(b, e));
+	while ((int) ranges.size() < WIDTH) {
+		size_t largest = 0;
+		for (size_t i = 1; i < ranges.size(); ++i) {
+			if (ranges[i].second - ranges[i].first > ranges[largest].second - ranges[largest].first) {
+				largest = i;
+			}
+		}
+		const GEO::index_t rb = ranges[largest].first;
+		const GEO::index_t re = ranges[largest].second;
+		if (re - rb <= (GEO::index_t) m_LeafSize) { break; }
+		const GEO::index_t m = rb + (re - rb) / 2;
+		ranges[largest].second = m;
+		ranges.insert(ranges.begin() + largest + 1, std::make_pair(m, re));
+	}
+
+	const int nodeId = (int) m_Nodes.size();
+	m_Nodes.emplace_back();
+	m_Nodes[nodeId].numChildren = (int) ranges.size();
+	for (int k = 0; k < WIDTH; ++k) {
+		// Children are built first, since m_Nodes may be reallocated
+		GEO::Box box;
+		int child = -1;
+		GEO::index_t rb = 0, re = 0;
+		if (k < (int) ranges.size()) {
+			rb = ranges[k].first;
+			re = ranges[k].second;
+			if (re - rb > (GEO::index_t) m_LeafSize) {
+				child = buildNode(rb, re);
+				const Node &c = m_Nodes[child];
+				box.xyz_min[0] = *std::min_element(c.minX, c.minX + c.numChildren);
+				box.xyz_min[1] = *std::min_element(c.minY, c.minY + c.numChildren);
+				box.xyz_min[2] = *std::min_element(c.minZ, c.minZ + c.numChildren);
+				box.xyz_max[0] = *std::max_element(c.maxX, c.maxX + c.numChildren);
+				box.xyz_max[1] = *std::max_element(c.maxY, c.maxY + c.numChildren);
+				box.xyz_max[2] = *std::max_element(c.maxZ, c.maxZ + c.numChildren);
+			} else {
+				facetBox(rb, box);
+				for (GEO::index_t f = rb + 1; f < re; ++f) {
+					GEO::Box other;
+					facetBox(f, other);
+					GEO::bbox_union(box, box, other);
+				}
+			}
+		} else {
+			// Unused slot: empty box, never visited
+			const double inf = std::numeric_limits<double>::infinity();
+			for (int c = 0; c < 3; ++c) {
+				box.xyz_min[c] = inf;
+				box.xyz_max[c] = -inf;
+			}
+		}
+		Node &node = m_Nodes[nodeId];
+		node.minX[k] = box.xyz_min[0]; node.maxX[k] = box.xyz_max[0];
+		node.minY[k] = box.xyz_min[1]; node.maxY[k] = box.xyz_max[1];
+		node.minZ[k] = box.xyz_min[2]; node.maxZ[k] = box.xyz_max[2];
+		node.child[k] = child;
+		node.begin[k] = rb;
+		node.end[k] = re;
+	}
+	return nodeId;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef VOXMESH_USE_AVX2
+
+namespace {
+
+// Whether the CPU running the program supports AVX2
+const bool cpuHasAVX2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+
+} // anonymous namespace
+
+VOXMESH_TARGET_AVX2
+void MeshFacetsWideAABB::childDistancesAVX2(const Node &node, const GEO::vec3 &p, double *sqDist) {
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d px = _mm256_set1_pd(p[0]);
+	const __m256d py = _mm256_set1_pd(p[1]);
+	const __m256d pz = _mm256_set1_pd(p[2]);
+	for (int k = 0; k < WIDTH; k += 4) {
+		// max(min - p, 0, p - max) along each axis
+		const __m256d dx = _mm256_max_pd(zero, _mm256_max_pd(
+			_mm256_sub_pd(_mm256_loadu_pd(node.minX + k), px), _mm256_sub_pd(px, _mm256_loadu_pd(node.maxX + k))));
+		const __m256d dy = _mm256_max_pd(zero, _mm256_max_pd(
+			_mm256_sub_pd(_mm256_loadu_pd(node.minY + k), py), _mm256_sub_pd(py, _mm256_loadu_pd(node.maxY + k))));
+		const __m256d dz = _mm256_max_pd(zero, _mm256_max_pd(
+			_mm256_sub_pd(_mm256_loadu_pd(node.minZ + k), pz), _mm256_sub_pd(pz, _mm256_loadu_pd(node.maxZ + k))));
+		_mm256_storeu_pd(sqDist + k, _mm256_add_pd(_mm256_mul_pd(dx, dx),
+			_mm256_add_pd(_mm256_mul_pd(dy, dy), _mm256_mul_pd(dz, dz))));
+	}
+}
+
+VOXMESH_TARGET_AVX2
+unsigned MeshFacetsWideAABB::childOverlapsAVX2(const Node &node, const GEO::Box &box) {
+	unsigned mask = 0;
+	for (int k = 0; k < WIDTH; k += 4) {
+		__m256d ok = _mm256_set1_pd(-1.0);
+		const double *mins[3] = { node.minX + k, node.minY + k, node.minZ + k };
+		const double *maxs[3] = { node.maxX + k, node.maxY + k, node.maxZ + k };
+		for (int c = 0; c < 3; ++c) {
+			ok = _mm256_and_pd(ok, _mm256_cmp_pd(_mm256_loadu_pd(mins[c]), _mm256_set1_pd(box.xyz_max[c]), _CMP_LE_OQ));
+			ok = _mm256_and_pd(ok, _mm256_cmp_pd(_mm256_loadu_pd(maxs[c]), _mm256_set1_pd(box.xyz_min[c]), _CMP_GE_OQ));
+		}
+		mask |= (unsigned) _mm256_movemask_pd(ok) << k;
+	}
+	return mask;
+}
+
+#else
+
+void MeshFacetsWideAABB::childDistancesAVX2(const Node &, const GEO::vec3 &, double *) {
+}
+
+unsigned MeshFacetsWideAABB::childOverlapsAVX2(const Node &, const GEO::Box &) {
+	return 0;
+}
+
+#endif
+
+// -----------------------------------------------------------------------------
+
+void MeshFacetsWideAABB::childDistances(const Node &node, const GEO::vec3 &p, double *sqDist) {
+#ifdef VOXMESH_USE_AVX2
+	if (cpuHasAVX2) {
+		childDistancesAVX2(node, p, sqDist);
+		return;
+	}
+#endif
+	// Branch-free, so that the compiler can vectorize it
+	for (int k = 0; k < WIDTH; ++k) {
+		const double dx = std::max(0.0, std::max(node.minX[k] - p[0], p[0] - node.maxX[k]));
+		const double dy = std::max(0.0, std::max(node.minY[k] - p[1], p[1] - node.maxY[k]));
+		const double dz = std::max(0.0, std::max(node.minZ[k] - p[2], p[2] - node.maxZ[k]));
+		sqDist[k] = dx * dx + dy * dy + dz * dz;
+	}
+}
+
+unsigned MeshFacetsWideAABB::childOverlaps(const Node &node, const GEO::Box &box) {
+#ifdef VOXMESH_USE_AVX2
+	if (cpuHasAVX2) {
+		return childOverlapsAVX2(node, box);
+	}
+#endif
+	unsigned mask = 0;
+	for (int k = 0; k < WIDTH; ++k) {
+		const bool ok = node.minX[k] <= box.xyz_max[0] && node.maxX[k] >= box.xyz_min[0]
+			&& node.minY[k] <= box.xyz_max[1] && node.maxY[k] >= box.xyz_min[1]
+			&& node.minZ[k] <= box.xyz_max[2] && node.maxZ[k] >= box.xyz_min[2];
+		mask |= (unsigned) ok << k;
+	}
+	return mask;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void MeshFacetsWideAABB::leafNearestFacet(GEO::index_t b, GEO::index_t e, const GEO::vec3 &p,
+	GEO::index_t &nearest_facet, GEO::vec3 &nearest_point, double &sq_dist) const
+{
+	for (GEO::index_t f = b; f < e; ++f) {
+		const GEO::vec3 &p1 = GEO::Geom::mesh_vertex(m_Mesh, m_Mesh.facets.vertex(f, 0));
+		const GEO::vec3 &p2 = GEO::Geom::mesh_vertex(m_Mesh, m_Mesh.facets.vertex(f, 1));
+		const GEO::vec3 &p3 = GEO::Geom::mesh_vertex(m_Mesh, m_Mesh.facets.vertex(f, 2));
+		GEO::vec3 point;
+		double lambda1, lambda2, lambda3; // barycentric coords, not used
+		const double d = GEO::Geom::point_triangle_squared_distance(
+			p, p1, p2, p3, point, lambda1, lambda2, lambda3);
+		if (d < sq_dist) {
+			nearest_facet = f;
+			nearest_point = point;
+			sq_dist = d;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+void MeshFacetsWideAABB::nearest_facet_with_hint(const GEO::vec3 &p,
+	GEO::index_t &nearest_facet, GEO::vec3 &nearest_point, double &sq_dist) const
+{
+	if (m_Nodes.empty()) { return; }
+	double dist[WIDTH];
+
+	// Initial guess: descend towards the nearest child box, down to a leaf
+	if (nearest_facet == GEO::NO_FACET) {
+		sq_dist = std::numeric_limits<double>::max();
+		int nodeId = 0;
+		while (true) {
+			const Node &node = m_Nodes[nodeId];
+			childDistances(node, p, dist);
+			const int k = (int) (std::min_element(dist, dist + node.numChildren) - dist);
+			if (node.child[k] < 0) {
+				leafNearestFacet(node.begin[k], node.end[k], p, nearest_facet, nearest_point, sq_dist);
+				break;
+			}
+			nodeId = node.child[k];
+		}
+	}
+
+	// Stack of (node, child slot) pairs, with the squared distance to the box
+	// of the child when it was pushed
+	struct Entry {
+		int node;
+		int slot;
+		double sqDist;
+	};
+	Entry stack[STACK_SIZE];
+	int top = 0;
+	auto pushChildren = [&](int nodeId) {
+		const Node &node = m_Nodes[nodeId];
+		childDistances(node, p, dist);
+		// Sort the children that may contain a nearer facet, farthest first, so
+		// that the nearest one is popped first and prunes the others
+		int order[WIDTH];
+		int n = 0;
+		for (int k = 0; k < node.numChildren; ++k) {
+			if (dist[k] >= sq_dist) { continue; }
+			int i = n++;
+			for (; i > 0 && dist[order[i-1]] < dist[k]; --i) {
+				order[i] = order[i-1];
+			}
+			order[i] = k;
+		}
+		for (int i = 0; i < n; ++i) {
+			geo_debug_assert(top < STACK_SIZE);
+			stack[top++] = { nodeId, order[i], dist[order[i]] };
+		}
+	};
+	pushChildren(0);
+	while (top > 0) {
+		const Entry entry = stack[--top];
+		if (entry.sqDist >= sq_dist) { continue; }
+		const Node &node = m_Nodes[entry.node];
+		const int k = entry.slot;
+		if (node.child[k] >= 0) {
+			pushChildren(node.child[k]);
+		} else {
+			leafNearestFacet(node.begin[k], node.end[k], p, nearest_facet, nearest_point, sq_dist);
+		}
+	}
+}
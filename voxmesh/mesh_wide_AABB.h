@@ -0,0 +1,154 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <geogram/mesh/mesh.h>
+#include <geogram/basic/geometry.h>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief      Bounding volume hierarchy of mesh facets, with up to 8 children
+ *             per node.
+ *
+ * It is built by collapsing the first 3 levels below each node of the binary
+ * tree used by GEO::MeshFacetsAABB (facets in Morton order, split in halves),
+ * and stops at leaves of a few facets. The boxes of the children of a node are
+ * stored as structure-of-arrays, so that a query is tested against all of them
+ * at once. It serves the same queries as GEO::MeshFacetsAABB.
+ */
+class MeshFacetsWideAABB {
+
+public:
+	// Maximum number of children of a node
+	enum : int {
+		WIDTH = 8,
+	};
+
+	/**
+	 * @brief      { Build the hierarchy }
+	 *
+	 * @param      M          { Input mesh. It is triangulated if needed, and its
+	 *                        facets are reordered along a Morton curve }
+	 * @param[in]  reorder    { Skip the Morton reordering if false (the facets
+	 *                        must then already be in a spatially coherent order) }
+	 * @param[in]  leafSize   { Maximum number of facets in a leaf }
+	 */
+	MeshFacetsWideAABB(GEO::Mesh &M, bool reorder = true, int leafSize = 4);
+
+	const GEO::Mesh & mesh() const { return m_Mesh; }
+
+	/**
+	 * @brief      { Find the nearest facet from a query point }
+	 *
+	 * @param[in]  p              { Query point }
+	 * @param[out] nearest_point  { Nearest point on the surface }
+	 * @param[out] sq_dist        { Squared distance between p and the surface }
+	 *
+	 * @return     { Index of the nearest facet }
+	 */
+	GEO::index_t nearest_facet(const GEO::vec3 &p, GEO::vec3 &nearest_point, double &sq_dist) const {
+		GEO::index_t f = GEO::NO_FACET;
+		nearest_facet_with_hint(p, f, nearest_point, sq_dist);
+		return f;
+	}
+
+	// Same as above, starting from a known facet (or NO_FACET), see
+	// GEO::MeshFacetsAABB::nearest_facet_with_hint()
+	void nearest_facet_with_hint(const GEO::vec3 &p,
+		GEO::index_t &nearest_facet, GEO::vec3 &nearest_point, double &sq_dist) const;
+
+	// Squared distance between a query point and the surface
+	double squared_distance(const GEO::vec3 &p) const {
+		GEO::vec3 nearest_point;
+		double result;
+		nearest_facet(p, nearest_point, result);
+		return result;
+	}
+
+	/**
+	 * @brief      { Call action(f) for each facet f whose bounding box
+	 *             intersects a given box, in increasing order of f }
+	 *
+	 * @param[in]  box     { Query box }
+	 * @param[in]  action  { Callback taking a GEO::index_t }
+	 */
+	template<typename Action>
+	void compute_bbox_facet_bbox_intersections(const GEO::Box &box, Action &action) const;
+
+private:
+	struct Node {
+		double minX[WIDTH], minY[WIDTH], minZ[WIDTH];
+		double maxX[WIDTH], maxY[WIDTH], maxZ[WIDTH];
+		int child[WIDTH];               // Index of the child node, or -1 for a leaf
+		GEO::index_t begin[WIDTH];      // Facets [begin, end) under each child
+		GEO::index_t end[WIDTH];
+		int numChildren;
+	};
+
+	// Deep enough for 2^32 facets (each level collapses 3 binary levels)
+	enum : int {
+		STACK_SIZE = 16 * WIDTH,
+	};
+
+	int buildNode(GEO::index_t b, GEO::index_t e);
+	void facetBox(GEO::index_t f, GEO::Box &box) const;
+
+	// Squared distances from a point to the boxes of the children of a node
+	static void childDistances(const Node &node, const GEO::vec3 &p, double *sqDist);
+
+	// Bit k is set if the box of the k-th child of a node intersects the query box
+	static unsigned childOverlaps(const Node &node, const GEO::Box &box);
+
+	// AVX2 versions of the above, only called if the CPU supports AVX2
+	static void childDistancesAVX2(const Node &node, const GEO::vec3 &p, double *sqDist);
+	static unsigned childOverlapsAVX2(const Node &node, const GEO::Box &box);
+
+	void leafNearestFacet(GEO::index_t b, GEO::index_t e, const GEO::vec3 &p,
+		GEO::index_t &nearest_facet, GEO::vec3 &nearest_point, double &sq_dist) const;
+
+private:
+	GEO::Mesh &m_Mesh;
+	int m_LeafSize;
+	std::vector<Node> m_Nodes; // Root first
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+template<typename Action>
+void MeshFacetsWideAABB::compute_bbox_facet_bbox_intersections(
+	const GEO::Box &box, Action &action) const
+{
+	if (m_Nodes.empty()) { return; }
+
+	// Stack of (node, child slot) pairs, encoded as node * WIDTH + slot
+	int stack[STACK_SIZE];
+	int top = 0;
+	auto pushChildren = [&](int nodeId) {
+		const Node &node = m_Nodes[nodeId];
+		const unsigned overlaps = childOverlaps(node, box);
+		// Reverse order, so that facets come out sorted
+		for (int k = node.numChildren - 1; k >= 0; --k) {
+			if (overlaps & (1u << k)) {
+				geo_debug_assert(top < STACK_SIZE);
+				stack[top++] = nodeId * WIDTH + k;
+			}
+		}
+	};
+	pushChildren(0);
+	while (top > 0) {
+		const int code = stack[--top];
+		const Node &node = m_Nodes[code / WIDTH];
+		const int k = code % WIDTH;
+		if (node.child[k] >= 0) {
+			pushChildren(node.child[k]);
+			continue;
+		}
+		for (GEO::index_t f = node.begin[k]; f < node.end[k]; ++f) {
+			GEO::Box facet;
+			facetBox(f, facet);
+			if (GEO::bboxes_overlap(box, facet)) {
+				action(f);
+			}
+		}
+	}
+}
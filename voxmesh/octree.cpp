@@ -1,9 +1,14 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "octree.h"
 #include "common.h"
+#include <geogram/basic/algorithm.h>
 #include <geogram/basic/logger.h>
+#include <geogram/basic/process.h>
 #include <unsupported/Eigen/SparseExtra>
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
 #include <random>
 #include <stack>
 #include <queue>
@@ -14,6 +19,39 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 
+namespace {
+
+// Replace each entry by the sum of the previous ones, and return the total.
+// Chunks are summed in parallel, then offset by the total of previous chunks.
+int exclusivePrefixSum(std::vector<int> &values) {
+	const int n = (int) values.size();
+	const int numChunks = std::max(1, std::min(n / 4096, 4 * (int) GEO::Process::number_of_cores()));
+	const int chunkSize = (n + numChunks - 1) / numChunks;
+	std::vector<int> offset(numChunks + 1, 0);
+	GEO::parallel_for(0, numChunks, [&](int k) {
+		int sum = 0;
+		for (int i = k * chunkSize; i < std::min(n, (k + 1) * chunkSize); ++i) {
+			int x = values[i];
+			values[i] = sum;
+			sum += x;
+		}
+		offset[k+1] = sum;
+	});
+	for (int k = 0; k < numChunks; ++k) {
+		offset[k+1] += offset[k];
+	}
+	GEO::parallel_for(1, numChunks, [&](int k) {
+		for (int i = k * chunkSize; i < std::min(n, (k + 1) * chunkSize); ++i) {
+			values[i] += offset[k];
+		}
+	});
+	return offset[numChunks];
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
 OctreeGrid::OctreeGrid(Eigen::Vector3i fineCellGridSize, int maxNodeGuess, int maxCellGuess)
 	: m_NodeGridSize(fineCellGridSize.array() + 1)
 	, m_CellGridSize(fineCellGridSize)
@@ -26,6 +64,7 @@ OctreeGrid::OctreeGrid(Eigen::Vector3i fineCellGridSize, int maxNodeGuess, int m
 	oct_assert(Math::isPowerOfTwo(fineCellGridSize[0]));
 	oct_assert(Math::isPowerOfTwo(fineCellGridSize[1]));
 	oct_assert(Math::isPowerOfTwo(fineCellGridSize[2]));
+	oct_assert(fineCellGridSize.maxCoeff() < (1 << 21));
 
 	// Max depth depends on fineCellGridSize
 	int minFineCellSize = m_CellGridSize.minCoeff();
@@ -44,6 +83,9 @@ void OctreeGrid::createRootCells() {
 	// Clear current octree
 	m_Nodes.clear();
 	m_Cells.clear();
+	m_FreeNodes.clear();
+	m_FreeCells.clear();
+	m_NodeIndex.clear();
 
 	// Anisotropic grids: we need multiple root cells
 	int minFineCellSize = m_CellGridSize.minCoeff();
@@ -64,6 +106,7 @@ void OctreeGrid::createRootCells() {
 				newNode.neighNodeId[2*axis+c] = (j != i ? j : -1);
 			}
 		}
+		if (m_UseNodeIndex) { m_NodeIndex.insert(newNode.position, (int) m_Nodes.size()); }
 		m_Nodes.emplace_back(newNode);
 	}
 
@@ -175,7 +218,7 @@ bool OctreeGrid::isPaired() const {
 
 // Return true iff the cell cellId is paired (its children are either all leaves, or all internal nodes)
 bool OctreeGrid::cellIsPaired(int cellId) const {
-	if (cellIsLeaf(cellId)) {
+	if (cellIsLeaf(cellId) || cellIsFree(cellId)) {
 		return true;
 	} else {
 		const int firstChild = m_Cells[cellId].firstChild;
@@ -293,6 +336,36 @@ void OctreeGrid::updateSubcellLinks(int cell, int axis) {
 
 // Retrieve the index of the midnode of an edge, if it exists
 int OctreeGrid::getMidEdgeNode(int node1, int node2, int axis) const {
+	const Node &n1 = m_Nodes[node1];
+	const Node &n2 = m_Nodes[node2];
+	oct_debug(n1.position[axis] < n2.position[axis]);
+	if (n1.next(axis) == node2) {
+		oct_debug(n2.prev(axis) == node1);
+		return -1;
+	}
+	// Some node lies on the edge, so the edge has been split and its midpoint exists
+	const int c3 = (n1.position[axis] + n2.position[axis]) / 2;
+	int mid;
+	if (m_Nodes[n1.next(axis)].position[axis] == c3) {
+		mid = n1.next(axis);
+	} else if (m_Nodes[n2.prev(axis)].position[axis] == c3) {
+		mid = n2.prev(axis);
+	} else if (m_UseNodeIndex) {
+		Eigen::Vector3i pos = n1.position;
+		pos[axis] = c3;
+		mid = m_NodeIndex.find(pos);
+		oct_debug(mid == getMidEdgeNodeByWalk(node1, node2, axis));
+	} else {
+		mid = getMidEdgeNodeByWalk(node1, node2, axis);
+	}
+	oct_debug(mid != -1);
+	return mid;
+}
+
+// -----------------------------------------------------------------------------
+
+// Same as getMidEdgeNode(), walking the linked list of nodes along the edge
+int OctreeGrid::getMidEdgeNodeByWalk(int node1, int node2, int axis) const {
 	const Node &n1 = m_Nodes[node1];
 	const Node &n2 = m_Nodes[node2];
 	oct_debug(n1.position[axis] < n2.position[axis]);
@@ -335,8 +408,7 @@ int OctreeGrid::addMidEdgeNode(int node1, int node2, int axis) {
 	oct_debug((m_Nodes[node1].position[axis] + m_Nodes[node2].position[axis]) % 2 == 0);
 
 	// Setup node adjacency
-	int newId = (int) m_Nodes.size();
-	m_Nodes.emplace_back(newNode);
+	int newId = allocateNode(newNode);
 	updateNodeLinks(node1, node2, newId, axis);
 	return newId;
 }
@@ -532,8 +604,7 @@ int OctreeGrid::splitCell(int cellId, bool graded, bool paired) {
 	const int e37 = getMidEdgeNode(v3, v7, Z);
 
 	// Create a new cell for each subvolume
-	const int offset = (int) m_Cells.size();
-	m_Cells.resize(m_Cells.size() + 8);
+	const int offset = allocateCells();
 	m_Cells[offset+CORNER_X0_Y0_Z0].cornerNodeId = {{v0, e01, f4, e03, e04, f2, c0, f0}};
 	m_Cells[offset+CORNER_X1_Y0_Z0].cornerNodeId = {{e01, v1, e12, f4, f2, e15, f1, c0}};
 	m_Cells[offset+CORNER_X1_Y1_Z0].cornerNodeId = {{f4, e12, v2, e32, c0, f1, e26, f3}};
@@ -553,81 +624,553 @@ int OctreeGrid::splitCell(int cellId, bool graded, bool paired) {
 		updateSubcellLinks(prevCell(cellId, axis), cellId, axis);
 	}
 
-	// Ensure proper 2:1 grading
-	if (graded) {
-		makeCellGraded(cellId, paired);
+	// Ensure proper 2:1 grading and pairing
+	if (graded || paired) {
+		// Lists are all empty after balanceLevels(), only their capacity is kept
+		m_BalancePending.resize(m_MaxDepth + 1);
+		m_BalancePending[cellLevel(cellId)].push_back(cellId);
+		balanceLevels(m_BalancePending, graded, paired);
 	}
 
-	// Ensure children are either all leaves, or all internal cells
-	if (paired) {
-		makeCellPaired(cellId, graded);
+	return c0;
+}
 
-		if (cellId < m_NumRootCells) {
-			// Special case for root cells: if one gets split, then we need to split all root cells
-			for (int c = 0; c < m_NumRootCells; ++c) {
-				if (cellIsLeaf(c)) { splitCell(c, graded, paired); }
-			}
-		} else {
-			// Ensure sibling cells are also properly split
-			int firstSibling = m_NumRootCells + 8 * ((cellId - m_NumRootCells) / 8);
-			for (int c = firstSibling; c < firstSibling + 8; ++c) {
-				if (cellIsLeaf(c)) { splitCell(c, graded, paired); }
-			}
-		}
+////////////////////////////////////////////////////////////////////////////////
+// Balancing routines
+////////////////////////////////////////////////////////////////////////////////
+
+// Level of a cell (0 for the finest cells)
+int OctreeGrid::cellLevel(int cellId) const {
+	const int extent = cellExtent(cellId);
+	int level = 0;
+	while ((1 << level) < extent) { ++level; }
+	return level;
+}
+
+// -----------------------------------------------------------------------------
 
+// Range of cells sharing the same parent (all root cells are considered siblings)
+std::pair<int, int> OctreeGrid::cellSiblings(int cellId) const {
+	if (cellId < m_NumRootCells) {
+		return std::make_pair(0, m_NumRootCells);
+	} else {
+		const int firstSibling = m_NumRootCells + 8 * ((cellId - m_NumRootCells) / 8);
+		return std::make_pair(firstSibling, firstSibling + 8);
 	}
+}
 
-	return c0;
+// -----------------------------------------------------------------------------
+
+// Return true iff an internal cell violates the grading or pairing rules
+bool OctreeGrid::cellNeedsBalance(int cellId, bool graded, bool paired) const {
+	if (graded) {
+		for (int ax1 = 0; ax1 < 3; ++ax1) {
+			for (int d1 = 0; d1 < 2; ++d1) {
+				// Neighboring cells along a face must be as small as the cell
+				const int c1 = adjCell(cellId, ax1, d1);
+				if (c1 == -1) { continue; }
+				if (adjCell(c1, ax1, 1-d1) != cellId) { return true; }
+				// Neighboring cell along an edge
+				for (int ax2 = 0; ax2 < 3; ++ax2) {
+					if (ax1 == ax2) { continue; }
+					for (int d2 = 0; d2 < 2; ++d2) {
+						const int c2 = adjCell(c1, ax2, d2);
+						if (c2 != -1 && adjCell(c2, ax2, 1-d2) != c1) { return true; }
+					}
+				}
+			}
+		}
+	}
+	if (paired) {
+		// Siblings must all be internal cells
+		auto range = cellSiblings(cellId);
+		for (int c = range.first; c < range.second; ++c) {
+			if (cellIsLeaf(c)) { return true; }
+		}
+	}
+	return false;
 }
 
-////////////////////////////////////////////////////////////////////////////////
+// -----------------------------------------------------------------------------
 
-// Make the cell 2:1 graded
-bool OctreeGrid::makeCellGraded(int cellId, bool paired) {
-	bool splitOccured = false;
-	for (int ax1 = 0; ax1 < 3; ++ax1) {
-		for (int d1 = 0; d1 < 2; ++d1) {
-			// Neighboring cells along a face
-			if (adjCell(cellId, ax1, d1) != -1) {
+// Split the cells that make an internal cell violate the grading or pairing rules
+void OctreeGrid::balanceCell(int cellId, bool graded, bool paired,
+	std::vector<std::vector<int>> &pending, std::vector<int> *splitCells)
+{
+	auto split = [&](int id) {
+		splitCell(id, false, false);
+		pending[cellLevel(id)].push_back(id);
+		if (splitCells) { splitCells->push_back(id); }
+	};
+	if (graded) {
+		for (int ax1 = 0; ax1 < 3; ++ax1) {
+			for (int d1 = 0; d1 < 2; ++d1) {
+				// Neighboring cells along a face
+				if (adjCell(cellId, ax1, d1) == -1) { continue; }
 				while (adjCell(adjCell(cellId, ax1, d1), ax1, 1-d1) != cellId) {
 					oct_debug(cellExtent(adjCell(cellId, ax1, d1)) > cellExtent(cellId));
-					splitCell(adjCell(cellId, ax1, d1), true, paired);
-					splitOccured = true;
+					split(adjCell(cellId, ax1, d1));
 				}
 				// Neighboring cell along an edge
+				const int c1 = adjCell(cellId, ax1, d1);
 				for (int ax2 = 0; ax2 < 3; ++ax2) {
 					if (ax1 == ax2) { continue; }
-					const int c1 = adjCell(cellId, ax1, d1);
 					for (int d2 = 0; d2 < 2; ++d2) {
-						if (adjCell(c1, ax2, d2) != -1) {
-							while (adjCell(adjCell(c1, ax2, d2), ax2, 1-d2) != c1) {
-								oct_debug(cellExtent(adjCell(c1, ax2, d2)) > cellExtent(c1));
-								splitCell(adjCell(c1, ax2, d2), true, paired);
-								splitOccured = true;
-							}
+						if (adjCell(c1, ax2, d2) == -1) { continue; }
+						while (adjCell(adjCell(c1, ax2, d2), ax2, 1-d2) != c1) {
+							oct_debug(cellExtent(adjCell(c1, ax2, d2)) > cellExtent(c1));
+							split(adjCell(c1, ax2, d2));
 						}
 					}
 				}
 			}
 		}
 	}
-	return splitOccured;
+	if (paired) {
+		auto range = cellSiblings(cellId);
+		for (int c = range.first; c < range.second; ++c) {
+			if (cellIsLeaf(c)) { split(c); }
+		}
+	}
 }
 
 // -----------------------------------------------------------------------------
 
-// Make the cell Paired (its children are either all leaves, or all internal nodes)
-bool OctreeGrid::makeCellPaired(int cellId, bool graded) {
-	if (!cellIsPaired(cellId)) {
-		const int firstChild = m_Cells[cellId].firstChild;
-		for (int k = 0; k < 8; ++k) {
-			if (cellIsLeaf(firstChild + k)) {
-				splitCell(firstChild + k, graded, true);
+// Process pending internal cells from the finest level to the coarsest one.
+// Fixing a cell only splits cells of the same level or coarser, so each level
+// is final once its list is empty.
+void OctreeGrid::balanceLevels(std::vector<std::vector<int>> &pending, bool graded, bool paired,
+	std::vector<int> *splitCells)
+{
+	std::vector<int> &current = m_BalanceCurrent;
+	std::vector<char> &violates = m_BalanceViolates;
+	for (int level = 0; level < (int) pending.size(); ++level) {
+		while (!pending[level].empty()) {
+			current.clear();
+			std::swap(current, pending[level]);
+
+			// Detect violations in parallel (read-only), then fix them serially
+			violates.assign(current.size(), 0);
+			auto detect = [&](GEO::index_t i) {
+				violates[i] = cellNeedsBalance(current[i], graded, paired);
+			};
+			if (current.size() >= 1024) {
+				GEO::parallel_for(0, (GEO::index_t) current.size(), detect);
+			} else {
+				for (size_t i = 0; i < current.size(); ++i) { detect((GEO::index_t) i); }
+			}
+			for (size_t i = 0; i < current.size(); ++i) {
+				if (violates[i]) {
+					balanceCell(current[i], graded, paired, pending, splitCells);
+				}
 			}
 		}
-		return true;
 	}
-	return false;
+}
+
+// -----------------------------------------------------------------------------
+
+// Enforce grading and/or pairing on the whole octree
+void OctreeGrid::balance(bool graded, bool paired) {
+	int numNodesBefore = numNodes();
+	int numCellsBefore = numCells();
+
+	std::vector<std::vector<int>> pending(m_MaxDepth + 1);
+	for (int i = 0; i < numCells(); ++i) {
+		if (!cellIsLeaf(i) && !cellIsFree(i)) {
+			pending[cellLevel(i)].push_back(i);
+		}
+	}
+	balanceLevels(pending, graded, paired);
+
+	// Resize attribute vectors
+	nodeAttributes.resize(numNodes());
+	cellAttributes.resize(numCells());
+
+	GEO::Logger::out("OctreeGrid") << "Balance: num nodes: " << numNodesBefore << " -> " << numNodes() << "\n";
+	GEO::Logger::out("OctreeGrid") << "Balance: num cells: " << numCellsBefore << " -> " << numCells() << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Concurrent subdivision routines
+////////////////////////////////////////////////////////////////////////////////
+
+// Split the leaves recursively according to the predicate
+void OctreeGrid::splitRecursively(const std::function<bool(int, int, int, int)> &predicate) {
+	std::vector<int> pending;
+	for (int i = 0; i < numCells(); ++i) {
+		if (cellIsLeaf(i)) {
+			pending.push_back(i);
+		}
+	}
+	while (!pending.empty()) {
+		const int id = pending.back();
+		pending.pop_back();
+		const int extent = cellExtent(id);
+		auto pos = cellCornerPos(id, 0);
+		if (extent > 1 && predicate(pos[0], pos[1], pos[2], extent)) {
+			splitCell(id, false, false);
+			for (int k = 0; k < 8; ++k) {
+				pending.push_back(m_Cells[id].firstChild + k);
+			}
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+// Replace the leaf cells with the subtrees grown from them. Nodes inside a
+// subtree are simply copied. Nodes on its boundary are merged by position with
+// the existing nodes and with the other subtrees, and their links are merged
+// by keeping the closest neighbor in each direction.
+void OctreeGrid::graftSubtrees(const std::vector<int> &leaves,
+	const std::vector<std::unique_ptr<OctreeGrid>> &subtrees)
+{
+	const int numTasks = (int) leaves.size();
+	auto isBoundary = [](const Eigen::Vector3i &pos, int extent) {
+		return (pos.array() == 0).any() || (pos.array() == extent).any();
+	};
+
+	// Existing nodes, indexed by position
+	PositionIndex index;
+	index.reserve(numNodes());
+	for (int i = 0; i < numNodes(); ++i) {
+		if (!nodeIsFree(i)) { index.insert(m_Nodes[i].position, i); }
+	}
+
+	// Boundary nodes are merged serially, inner nodes and cells are given
+	// consecutive ids per subtree
+	std::vector<std::vector<int>> nodeMap(numTasks);
+	std::vector<int> nodeOffset(numTasks + 1, 0);
+	std::vector<int> cellOffset(numTasks + 1, 0);
+	for (int t = 0; t < numTasks; ++t) {
+		if (!subtrees[t]) { continue; }
+		const OctreeGrid &tree = *subtrees[t];
+		const Eigen::Vector3i origin = cellCornerPos(leaves[t], 0);
+		const int extent = cellExtent(leaves[t]);
+		nodeMap[t].assign(tree.numNodes(), -1);
+		for (int l = 0; l < tree.numNodes(); ++l) {
+			if (!isBoundary(tree.m_Nodes[l].position, extent)) {
+				++nodeOffset[t+1];
+				continue;
+			}
+			const Eigen::Vector3i pos = tree.m_Nodes[l].position + origin;
+			int id = index.find(pos);
+			if (id == -1) {
+				Node node;
+				node.position = pos;
+				id = numNodes();
+				m_Nodes.push_back(node);
+				index.insert(pos, id);
+			}
+			nodeMap[t][l] = id;
+		}
+		cellOffset[t+1] = tree.numCells() - 1;
+	}
+	nodeOffset[0] = numNodes();
+	cellOffset[0] = numCells();
+	for (int t = 0; t < numTasks; ++t) {
+		nodeOffset[t+1] += nodeOffset[t];
+		cellOffset[t+1] += cellOffset[t];
+	}
+	m_Nodes.resize(nodeOffset[numTasks]);
+	m_Cells.resize(cellOffset[numTasks]);
+
+	// Copy inner nodes and cells
+	GEO::parallel_for(0, numTasks, [&](int t) {
+		if (!subtrees[t]) { return; }
+		const OctreeGrid &tree = *subtrees[t];
+		const int leaf = leaves[t];
+		const Eigen::Vector3i origin = cellCornerPos(leaf, 0);
+		std::vector<int> &map = nodeMap[t];
+		for (int l = 0, next = nodeOffset[t]; l < tree.numNodes(); ++l) {
+			if (map[l] == -1) { map[l] = next++; }
+		}
+		for (int l = 0; l < tree.numNodes(); ++l) {
+			if (map[l] < nodeOffset[t]) { continue; }
+			Node &node = m_Nodes[map[l]];
+			node = tree.m_Nodes[l];
+			node.position += origin;
+			for (int &id : node.neighNodeId) { id = (id == -1 ? -1 : map[id]); }
+		}
+		auto mapCell = [&](int c) {
+			return (c == 0 ? leaf : cellOffset[t] + c - 1);
+		};
+		for (int c = 1; c < tree.numCells(); ++c) {
+			Cell &cell = m_Cells[mapCell(c)];
+			cell = tree.m_Cells[c];
+			if (cell.firstChild != -1) { cell.firstChild = mapCell(cell.firstChild); }
+			for (int &id : cell.cornerNodeId) { id = map[id]; }
+			// Links leaving the subtree start from the neighbors of the grafted leaf
+			for (int k = 0; k < 6; ++k) {
+				const int id = cell.neighCellId[k];
+				cell.neighCellId[k] = (id == -1 ? m_Cells[leaf].neighCellId[k] : mapCell(id));
+			}
+		}
+	});
+
+	// Merge the links of boundary nodes, keeping the closest neighbor
+	for (int t = 0; t < numTasks; ++t) {
+		if (!subtrees[t]) { continue; }
+		const OctreeGrid &tree = *subtrees[t];
+		for (int l = 0; l < tree.numNodes(); ++l) {
+			const int id = nodeMap[t][l];
+			if (id >= nodeOffset[t]) { continue; }
+			for (int axis = 0; axis < 3; ++axis) {
+				for (int dir = 0; dir < 2; ++dir) {
+					const int other = tree.m_Nodes[l].neighNodeId[2*axis+dir];
+					if (other == -1) { continue; }
+					const int candidate = nodeMap[t][other];
+					int &current = m_Nodes[id].neighNodeId[2*axis+dir];
+					if (current == -1
+						|| (dir == 1 && nodePos(candidate)[axis] < nodePos(current)[axis])
+						|| (dir == 0 && nodePos(candidate)[axis] > nodePos(current)[axis]))
+					{
+						current = candidate;
+					}
+				}
+			}
+		}
+	}
+
+	// Attach the subtrees to the grafted leaves, then update the links of the
+	// cells along their boundaries (on both sides)
+	for (int t = 0; t < numTasks; ++t) {
+		if (!subtrees[t]) { continue; }
+		m_Cells[leaves[t]].firstChild = cellOffset[t] + subtrees[t]->m_Cells[0].firstChild - 1;
+	}
+	GEO::parallel_for(0, numCells(), [&](int c) {
+		if (!cellIsFree(c)) { updateCellNeighbors(c); }
+	});
+	rebuildNodeIndex();
+}
+
+// -----------------------------------------------------------------------------
+
+// Point the links of a cell to the adjacent cell of the same size, or to the
+// smallest coarser one covering its face
+void OctreeGrid::updateCellNeighbors(int cellId) {
+	const Eigen::Vector3i corner = cellCornerPos(cellId, 0);
+	const int extent = cellExtent(cellId);
+	for (int axis = 0; axis < 3; ++axis) {
+		for (int dir = 0; dir < 2; ++dir) {
+			// Descend towards the unit cell right across the face
+			Eigen::Vector3i q = corner;
+			q[axis] += (dir ? extent : -1);
+			int neigh = adjCell(cellId, axis, dir);
+			while (neigh != -1 && !cellIsLeaf(neigh) && cellExtent(neigh) > extent) {
+				const int half = cellExtent(neigh) / 2;
+				const Eigen::Vector3i delta = ((q - cellCornerPos(neigh, 0)).array() >= half).cast<int>();
+				neigh = m_Cells[neigh].firstChild + Cube::invDelta(delta);
+			}
+			m_Cells[cellId].neighCellId[2*axis+dir] = neigh;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Coarsening routines
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Edges of a cell, as (corner, corner, axis) with the first corner lower along axis
+const int CELL_EDGES[12][3] = {
+	{OctreeGrid::CORNER_X0_Y0_Z0, OctreeGrid::CORNER_X1_Y0_Z0, OctreeGrid::X},
+	{OctreeGrid::CORNER_X0_Y1_Z0, OctreeGrid::CORNER_X1_Y1_Z0, OctreeGrid::X},
+	{OctreeGrid::CORNER_X0_Y0_Z1, OctreeGrid::CORNER_X1_Y0_Z1, OctreeGrid::X},
+	{OctreeGrid::CORNER_X0_Y1_Z1, OctreeGrid::CORNER_X1_Y1_Z1, OctreeGrid::X},
+	{OctreeGrid::CORNER_X0_Y0_Z0, OctreeGrid::CORNER_X0_Y1_Z0, OctreeGrid::Y},
+	{OctreeGrid::CORNER_X1_Y0_Z0, OctreeGrid::CORNER_X1_Y1_Z0, OctreeGrid::Y},
+	{OctreeGrid::CORNER_X0_Y0_Z1, OctreeGrid::CORNER_X0_Y1_Z1, OctreeGrid::Y},
+	{OctreeGrid::CORNER_X1_Y0_Z1, OctreeGrid::CORNER_X1_Y1_Z1, OctreeGrid::Y},
+	{OctreeGrid::CORNER_X0_Y0_Z0, OctreeGrid::CORNER_X0_Y0_Z1, OctreeGrid::Z},
+	{OctreeGrid::CORNER_X1_Y0_Z0, OctreeGrid::CORNER_X1_Y0_Z1, OctreeGrid::Z},
+	{OctreeGrid::CORNER_X1_Y1_Z0, OctreeGrid::CORNER_X1_Y1_Z1, OctreeGrid::Z},
+	{OctreeGrid::CORNER_X0_Y1_Z0, OctreeGrid::CORNER_X0_Y1_Z1, OctreeGrid::Z},
+};
+
+} // anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+// Get a node slot (reusing a free one if possible)
+int OctreeGrid::allocateNode(const Node &node) {
+	int id;
+	if (m_FreeNodes.empty()) {
+		id = (int) m_Nodes.size();
+		m_Nodes.emplace_back(node);
+	} else {
+		id = m_FreeNodes.back();
+		m_FreeNodes.pop_back();
+		m_Nodes[id] = node;
+	}
+	if (m_UseNodeIndex) { m_NodeIndex.insert(node.position, id); }
+	return id;
+}
+
+// Get a block of 8 consecutive cell slots (reusing a free one if possible)
+int OctreeGrid::allocateCells() {
+	if (m_FreeCells.empty()) {
+		m_Cells.resize(m_Cells.size() + 8);
+		return (int) m_Cells.size() - 8;
+	}
+	const int offset = m_FreeCells.back();
+	m_FreeCells.pop_back();
+	std::fill_n(m_Cells.begin() + offset, 8, Cell());
+	return offset;
+}
+
+// Rebuild the node index from the node array
+void OctreeGrid::rebuildNodeIndex() {
+	m_NodeIndex.clear();
+	if (!m_UseNodeIndex) { return; }
+	m_NodeIndex.reserve(m_Nodes.size());
+	for (int i = 0; i < numNodes(); ++i) {
+		if (!nodeIsFree(i)) { m_NodeIndex.insert(m_Nodes[i].position, i); }
+	}
+}
+
+// Enable/disable the hash table of node positions
+void OctreeGrid::setUseNodeIndex(bool enabled) {
+	m_UseNodeIndex = enabled;
+	rebuildNodeIndex();
+}
+
+// Scan the node and cell arrays for free slots
+void OctreeGrid::rebuildFreeLists() {
+	m_FreeNodes.clear();
+	m_FreeCells.clear();
+	for (int i = numNodes() - 1; i >= 0; --i) {
+		if (nodeIsFree(i)) { m_FreeNodes.push_back(i); }
+	}
+	for (int i = numCells() - 8; i >= m_NumRootCells; i -= 8) {
+		if (cellIsFree(i)) { m_FreeCells.push_back(i); }
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+// Return true iff the children of a cell are all leaves
+bool OctreeGrid::cellHasLeafChildren(int cellId) const {
+	if (cellIsLeaf(cellId) || cellIsFree(cellId)) {
+		return false;
+	}
+	const int firstChild = m_Cells[cellId].firstChild;
+	for (int k = 0; k < 8; ++k) {
+		if (!cellIsLeaf(firstChild + k)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Return true iff merging the children of a cell keeps the octree 2:1 graded
+bool OctreeGrid::cellCanMerge(int cellId) const {
+	// A neighbor smaller than half the merged cell would leave a node in the
+	// middle of one of the children's edges
+	const int firstChild = m_Cells[cellId].firstChild;
+	for (int k = 0; k < 8; ++k) {
+		const Cell &child = m_Cells[firstChild + k];
+		for (const auto &e : CELL_EDGES) {
+			if (nextNode(child.corner(e[0]), e[2]) != child.corner(e[1])) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// Merge the 8 leaf children of a cell, and free the unused nodes
+void OctreeGrid::mergeCell(int cellId, std::vector<int> &nodeRefs) {
+	oct_debug(cellHasLeafChildren(cellId));
+	const int offset = m_Cells[cellId].firstChild;
+
+	// Nodes which are no longer the corner of any cell
+	std::vector<int> removed;
+	for (int k = 0; k < 8; ++k) {
+		for (int c = 0; c < 8; ++c) {
+			const int v = m_Cells[offset + k].corner(c);
+			if (--nodeRefs[v] == 0) {
+				removed.push_back(v);
+			}
+		}
+	}
+
+	// Unlink removed nodes from the remaining ones
+	for (int v : removed) {
+		for (int axis = 0; axis < 3; ++axis) {
+			const int prev = prevNode(v, axis);
+			const int next = nextNode(v, axis);
+			if (prev != -1 && nodeRefs[prev] > 0) { m_Nodes[prev].setNext(axis, -1); }
+			if (next != -1 && nodeRefs[next] > 0) { m_Nodes[next].setPrev(axis, -1); }
+		}
+	}
+
+	// Reconnect the edges of the merged cell whose midpoint was removed
+	for (const auto &e : CELL_EDGES) {
+		createNodeLinks(m_Cells[cellId].corner(e[0]), m_Cells[cellId].corner(e[1]), e[2]);
+	}
+
+	// Free node and cell slots
+	Node freeNode;
+	freeNode.position.setConstant(FREE_SLOT);
+	for (int v : removed) {
+		if (m_UseNodeIndex) { m_NodeIndex.erase(m_Nodes[v].position); }
+		m_Nodes[v] = freeNode;
+		m_FreeNodes.push_back(v);
+	}
+	for (int k = 0; k < 8; ++k) {
+		m_Cells[offset + k].firstChild = FREE_SLOT;
+	}
+	m_FreeCells.push_back(offset);
+	m_Cells[cellId].firstChild = -1;
+
+	// Neighbors that were linked to the children now link to the merged cell
+	for (int axis = 0; axis < 3; ++axis) {
+		updateSubcellLinks(cellId, nextCell(cellId, axis), axis);
+		updateSubcellLinks(prevCell(cellId, axis), cellId, axis);
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+// Renumber nodes and cells (-1 to drop a slot)
+void OctreeGrid::applyRenumbering(const std::vector<int> &cellMap, int newNumCells,
+	const std::vector<int> &nodeMap, int newNumNodes)
+{
+	auto mapId = [](const std::vector<int> &map, int id) {
+		return (id < 0 ? id : map[id]);
+	};
+
+	// Each slot is written by a single source, so both loops run in parallel
+	std::vector<Node> nodes(newNumNodes);
+	GEO::parallel_for(0, numNodes(), [&](int i) {
+		if (nodeMap[i] == -1) { return; }
+		Node &node = nodes[nodeMap[i]];
+		node = m_Nodes[i];
+		for (int &id : node.neighNodeId) { id = mapId(nodeMap, id); }
+	});
+
+	std::vector<Cell> cells(newNumCells);
+	GEO::parallel_for(0, numCells(), [&](int i) {
+		if (cellMap[i] == -1) { return; }
+		Cell &cell = cells[cellMap[i]];
+		cell = m_Cells[i];
+		cell.firstChild = mapId(cellMap, cell.firstChild);
+		for (int &id : cell.cornerNodeId) { id = mapId(nodeMap, id); }
+		for (int &id : cell.neighCellId) { id = mapId(cellMap, id); }
+	});
+
+	m_Nodes.swap(nodes);
+	m_Cells.swap(cells);
+	rebuildFreeLists();
+	rebuildNodeIndex();
+
+	nodeAttributes.remap(nodeMap, newNumNodes);
+	cellAttributes.remap(cellMap, newNumCells);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -677,6 +1220,609 @@ void OctreeGrid::subdivide(std::function<bool(int, int, int, int)> predicate,
 	GEO::Logger::out("OctreeGrid") << "Num cells: " << numCellsBefore << " -> " << numCells() << std::endl;
 }
 
+// -----------------------------------------------------------------------------
+
+// Traverse the leaf cells level by level, evaluate the predicate in parallel
+// on each level, and split the selected cells
+void OctreeGrid::subdivideParallel(std::function<bool(int, int, int, int)> predicate,
+	bool graded, bool paired, int maxCells)
+{
+	std::vector<int> pending, next;
+	for (int i = 0; i < (int) m_Cells.size(); ++i) {
+		if (cellIsLeaf(i)) {
+			pending.push_back(i);
+		}
+	}
+
+	int numNodesBefore = numNodes();
+	int numCellsBefore = numCells();
+	int numSubdivided = 0;
+	if (maxCells < 0) {
+		maxCells = std::numeric_limits<int>::max();
+	}
+	std::vector<char> shouldSplit;
+	while (!pending.empty() && numCells() + 8 <= maxCells) {
+		// Evaluate the predicate on the current level (read-only)
+		shouldSplit.assign(pending.size(), 0);
+		GEO::parallel_for(0, (GEO::index_t) pending.size(), [&](GEO::index_t i) {
+			const int id = pending[i];
+			auto pos = cellCornerPos(id, 0);
+			shouldSplit[i] = predicate(pos[0], pos[1], pos[2], cellExtent(id));
+		});
+
+		// Split selected cells and gather the next level
+		next.clear();
+		for (size_t i = 0; i < pending.size() && numCells() + 8 <= maxCells; ++i) {
+			if (!shouldSplit[i]) { continue; }
+			const int id = pending[i];
+			if (cellExtent(id) == 1) {
+				std::cerr << "[OctreeGrid] Cannot subdivide cell of length 1." << std::endl;
+				continue;
+			}
+			if (cellIsLeaf(id)) {
+				splitCell(id, graded, paired);
+				++numSubdivided;
+			}
+			for (int k = 0; k < 8; ++k) {
+				next.push_back(m_Cells[id].firstChild + k);
+			}
+		}
+		std::swap(pending, next);
+	}
+
+	// Resize attribute vectors
+	nodeAttributes.resize(numNodes());
+	cellAttributes.resize(numCells());
+
+	GEO::Logger::out("OctreeGrid") << "Subdivide has split " << numSubdivided << " cells\n";
+	GEO::Logger::out("OctreeGrid") << "Num nodes: " << numNodesBefore << " -> " << numNodes() << "\n";
+	GEO::Logger::out("OctreeGrid") << "Num cells: " << numCellsBefore << " -> " << numCells() << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+
+// Refine the leaves breadth-first until there are enough cells to keep all
+// threads busy, then grow one subtree per cell in parallel and graft them
+void OctreeGrid::subdivideConcurrent(std::function<bool(int, int, int, int)> predicate,
+	bool graded, bool paired)
+{
+	int numNodesBefore = numNodes();
+	int numCellsBefore = numCells();
+
+	const int minTasks = 8 * (int) GEO::Process::number_of_cores();
+	std::vector<int> pending, next;
+	std::vector<char> wasLeaf(numCells(), 0);
+	for (int i = 0; i < numCells(); ++i) {
+		if (cellIsLeaf(i)) {
+			pending.push_back(i);
+			wasLeaf[i] = 1;
+		}
+	}
+	while (!pending.empty() && (int) pending.size() < minTasks) {
+		next.clear();
+		for (int id : pending) {
+			const int extent = cellExtent(id);
+			auto pos = cellCornerPos(id, 0);
+			if (extent > 1 && predicate(pos[0], pos[1], pos[2], extent)) {
+				splitCell(id, false, false);
+				for (int k = 0; k < 8; ++k) {
+					next.push_back(m_Cells[id].firstChild + k);
+				}
+			}
+		}
+		std::swap(pending, next);
+	}
+
+	// Subtree sizes vary a lot, so they are interleaved between threads
+	std::vector<std::unique_ptr<OctreeGrid>> subtrees(pending.size());
+	GEO::parallel_for(0, (GEO::index_t) pending.size(), [&](GEO::index_t t) {
+		const Eigen::Vector3i origin = cellCornerPos(pending[t], 0);
+		std::unique_ptr<OctreeGrid> tree(new OctreeGrid(Eigen::Vector3i::Constant(cellExtent(pending[t]))));
+		tree->splitRecursively([&](int x, int y, int z, int extent) {
+			return predicate(x + origin[0], y + origin[1], z + origin[2], extent);
+		});
+		if (tree->numCells() > 1) { subtrees[t] = std::move(tree); }
+	}, 1, true);
+	graftSubtrees(pending, subtrees);
+
+	// Balance the cells split by this call, finest first
+	if (graded || paired) {
+		std::vector<std::vector<int>> split(m_MaxDepth + 1);
+		for (int i = 0; i < numCells(); ++i) {
+			if (!cellIsLeaf(i) && (i >= numCellsBefore || wasLeaf[i])) {
+				split[cellLevel(i)].push_back(i);
+			}
+		}
+		balanceLevels(split, graded, paired);
+	}
+
+	// Resize attribute vectors
+	nodeAttributes.resize(numNodes());
+	cellAttributes.resize(numCells());
+
+	GEO::Logger::out("OctreeGrid") << "Num nodes: " << numNodesBefore << " -> " << numNodes() << "\n";
+	GEO::Logger::out("OctreeGrid") << "Num cells: " << numCellsBefore << " -> " << numCells() << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+
+// Split the leaves with the highest priority first, until the budget of cells
+// is spent. Leaves split to restore the grading/pairing stay in the queue, and
+// are skipped when popped, since their children have been queued instead.
+void OctreeGrid::subdivideByPriority(std::function<double(int, int, int, int)> priority,
+	int maxCells, bool graded, bool paired)
+{
+	std::priority_queue<std::pair<double, int>> queue;
+	std::vector<int> fresh;
+	std::vector<double> score;
+	auto pushFresh = [&]() {
+		score.assign(fresh.size(), 0.0);
+		auto eval = [&](GEO::index_t i) {
+			const int id = fresh[i];
+			const int extent = cellExtent(id);
+			if (extent > 1) {
+				auto pos = cellCornerPos(id, 0);
+				score[i] = priority(pos[0], pos[1], pos[2], extent);
+			}
+		};
+		if (fresh.size() >= 64) {
+			GEO::parallel_for(0, (GEO::index_t) fresh.size(), eval);
+		} else {
+			for (size_t i = 0; i < fresh.size(); ++i) { eval((GEO::index_t) i); }
+		}
+		for (size_t i = 0; i < fresh.size(); ++i) {
+			if (score[i] > 0) { queue.emplace(score[i], fresh[i]); }
+		}
+		fresh.clear();
+	};
+	for (int i = 0; i < numCells(); ++i) {
+		if (cellIsLeaf(i)) {
+			fresh.push_back(i);
+		}
+	}
+	pushFresh();
+
+	int numNodesBefore = numNodes();
+	int numCellsBefore = numCells();
+	int numSubdivided = 0;
+	std::vector<int> split;
+	std::vector<std::vector<int>> pending(m_MaxDepth + 1);
+	if (maxCells < 0) {
+		maxCells = std::numeric_limits<int>::max();
+	}
+	while (!queue.empty() && numCells() + 8 <= maxCells) {
+		const int id = queue.top().second;
+		queue.pop();
+		if (!cellIsLeaf(id)) { continue; }
+
+		// Split the cell, then restore the grading/pairing around it
+		split.assign(1, id);
+		splitCell(id, false, false);
+		if (graded || paired) {
+			pending[cellLevel(id)].push_back(id);
+			balanceLevels(pending, graded, paired, &split);
+		}
+		numSubdivided += (int) split.size();
+
+		// Queue the new leaves
+		for (int c : split) {
+			for (int k = 0; k < 8; ++k) {
+				if (cellIsLeaf(m_Cells[c].firstChild + k)) {
+					fresh.push_back(m_Cells[c].firstChild + k);
+				}
+			}
+		}
+		pushFresh();
+	}
+
+	// Resize attribute vectors
+	nodeAttributes.resize(numNodes());
+	cellAttributes.resize(numCells());
+
+	GEO::Logger::out("OctreeGrid") << "Subdivide has split " << numSubdivided << " cells\n";
+	GEO::Logger::out("OctreeGrid") << "Num nodes: " << numNodesBefore << " -> " << numNodes() << "\n";
+	GEO::Logger::out("OctreeGrid") << "Num cells: " << numCellsBefore << " -> " << numCells() << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+
+// Build the octree bottom-up from dense arrays over the finest cells
+void OctreeGrid::buildBottomUp(const std::vector<char> &refine, const std::vector<uint8_t> &labels,
+	std::vector<int> &cellLabels, bool graded, bool paired)
+{
+	oct_assert(refine.size() == (size_t) m_CellGridSize.prod());
+	oct_assert(labels.size() == (size_t) m_CellGridSize.prod());
+	const uint8_t MIXED = 255;
+
+	// pyramid[level] holds the common label of each block of (2^level)^3
+	// finest cells, or MIXED if the block needs to be split
+	std::vector<std::vector<uint8_t>> pyramid(m_MaxDepth + 1);
+	for (int level = 1; level <= m_MaxDepth; ++level) {
+		const Eigen::Vector3i size = m_CellGridSize / (1 << level);
+		const Eigen::Vector3i fineSize = 2 * size;
+		pyramid[level].resize(size.prod());
+		GEO::parallel_for(0, size.prod(), [&](int i) {
+			const Eigen::Vector3i pos = Layout3D::toGrid(i, size);
+			uint8_t value = 0;
+			for (int k = 0; k < 8; ++k) {
+				const int j = Layout3D::toIndex(2 * pos + Cube::delta(k), fineSize);
+				const uint8_t v = (level == 1 ? (refine[j] ? MIXED : labels[j]) : pyramid[level-1][j]);
+				value = (k == 0 || v == value ? v : MIXED);
+			}
+			pyramid[level][i] = value;
+		});
+	}
+
+	// Label of a cell (MIXED if it is not uniform)
+	auto cellValue = [&](int cellId) {
+		const int level = cellLevel(cellId);
+		const Eigen::Vector3i pos = cellCornerPos(cellId, 0) / (1 << level);
+		const int i = Layout3D::toIndex(pos, m_CellGridSize / (1 << level));
+		return (level == 0 ? labels[i] : pyramid[level][i]);
+	};
+
+	// Split non-uniform cells, from the root cells down to the finest level
+	createRootCells();
+	int numCellsBefore = numCells();
+	std::vector<int> pending, next;
+	for (int i = 0; i < m_NumRootCells; ++i) {
+		pending.push_back(i);
+	}
+	while (!pending.empty()) {
+		next.clear();
+		for (int id : pending) {
+			if (cellExtent(id) == 1 || cellValue(id) != MIXED) { continue; }
+			splitCell(id, false, false);
+			for (int k = 0; k < 8; ++k) {
+				next.push_back(m_Cells[id].firstChild + k);
+			}
+		}
+		std::swap(pending, next);
+	}
+	GEO::Logger::out("OctreeGrid") << "Bottom-up build: num cells: " << numCellsBefore << " -> " << numCells() << std::endl;
+
+	if (graded || paired) {
+		balance(graded, paired);
+	}
+
+	// Resize attribute vectors
+	nodeAttributes.resize(numNodes());
+	cellAttributes.resize(numCells());
+
+	// Cells created by balancing lie inside uniform blocks, so every cell can
+	// read its label from the pyramid
+	cellLabels.resize(numCells());
+	GEO::parallel_for(0, numCells(), [&](int c) {
+		const uint8_t v = cellValue(c);
+		cellLabels[c] = (v == MIXED ? -1 : v);
+	});
+}
+
+// -----------------------------------------------------------------------------
+
+// Merge the children of cells for which the predicate is true
+void OctreeGrid::coarsen(std::function<bool(int, int, int, int)> predicate,
+	bool graded, bool paired)
+{
+	// Number of live cells using each node as a corner
+	std::vector<int> nodeRefs(numNodes(), 0);
+	for (int i = 0; i < numCells(); ++i) {
+		if (cellIsFree(i)) { continue; }
+		for (int k = 0; k < 8; ++k) {
+			++nodeRefs[cellCornerId(i, k)];
+		}
+	}
+
+	// Predicate is evaluated at most once per cell (-1: not evaluated yet)
+	std::vector<signed char> accepted(numCells(), -1);
+	auto canMerge = [&](int cellId) {
+		if (!cellHasLeafChildren(cellId)) { return false; }
+		if (accepted[cellId] == -1) {
+			auto pos = cellCornerPos(cellId, 0);
+			accepted[cellId] = predicate(pos[0], pos[1], pos[2], cellExtent(cellId));
+		}
+		return accepted[cellId] && (!graded || cellCanMerge(cellId));
+	};
+
+	// Try to merge the children of a group of cells (all or nothing)
+	int numMerged = 0;
+	auto tryMerge = [&](int first, int count) {
+		for (int c = first; c < first + count; ++c) {
+			if (!canMerge(c)) { return false; }
+		}
+		for (int c = first; c < first + count; ++c) {
+			mergeCell(c, nodeRefs);
+			++numMerged;
+		}
+		return true;
+	};
+
+	// Keep going until nothing changes, as merging a cell may allow its
+	// parent (or its neighbors when graded) to be merged in turn
+	int numNodesBefore = numNodes() - (int) m_FreeNodes.size();
+	int numCellsBefore = numCells() - 8 * (int) m_FreeCells.size();
+	for (bool changed = true; changed; ) {
+		changed = false;
+		if (paired) {
+			// Siblings must become leaves together, and so do root cells
+			changed |= tryMerge(0, m_NumRootCells);
+			for (int i = m_NumRootCells; i < numCells(); i += 8) {
+				if (!cellIsFree(i)) { changed |= tryMerge(i, 8); }
+			}
+		} else {
+			for (int i = 0; i < numCells(); ++i) {
+				changed |= tryMerge(i, 1);
+			}
+		}
+	}
+
+	GEO::Logger::out("OctreeGrid") << "Coarsen has merged " << numMerged << " cells\n";
+	GEO::Logger::out("OctreeGrid") << "Num nodes: " << numNodesBefore << " -> " << numNodes() - m_FreeNodes.size() << "\n";
+	GEO::Logger::out("OctreeGrid") << "Num cells: " << numCellsBefore << " -> " << numCells() - 8 * m_FreeCells.size() << std::endl;
+}
+
+// -----------------------------------------------------------------------------
+
+// Remove free node and cell slots, keeping the relative order of the others
+void OctreeGrid::compact() {
+	std::vector<int> cellMap(numCells(), -1);
+	int newNumCells = 0;
+	for (int i = 0; i < m_NumRootCells; ++i) {
+		cellMap[i] = newNumCells++;
+	}
+	for (int i = m_NumRootCells; i < numCells(); i += 8) {
+		if (cellIsFree(i)) { continue; }
+		for (int k = 0; k < 8; ++k) {
+			cellMap[i + k] = newNumCells++;
+		}
+	}
+
+	std::vector<int> nodeMap(numNodes(), -1);
+	int newNumNodes = 0;
+	for (int i = 0; i < numNodes(); ++i) {
+		if (!nodeIsFree(i)) { nodeMap[i] = newNumNodes++; }
+	}
+
+	applyRenumbering(cellMap, newNumCells, nodeMap, newNumNodes);
+}
+
+// -----------------------------------------------------------------------------
+
+// Renumber cells and nodes along a Morton curve
+void OctreeGrid::reorder() {
+	// Local index of the k-th child in Morton order (x first, then y, then z)
+	int mortonChild[8];
+	for (int k = 0; k < 8; ++k) {
+		mortonChild[k] = Cube::invDelta(Eigen::Vector3i(k & 1, (k >> 1) & 1, (k >> 2) & 1));
+	}
+
+	// Cells: depth-first traversal from the root cells, visiting children in
+	// Morton order. A sibling block gets its ids when its parent is visited.
+	std::vector<int> cellMap(numCells(), -1);
+	int newNumCells = m_NumRootCells;
+	std::vector<int> stack;
+	for (int i = m_NumRootCells - 1; i >= 0; --i) {
+		cellMap[i] = i;
+		stack.push_back(i);
+	}
+	while (!stack.empty()) {
+		const int id = stack.back();
+		stack.pop_back();
+		if (cellIsLeaf(id)) { continue; }
+		const int firstChild = m_Cells[id].firstChild;
+		for (int k = 0; k < 8; ++k) {
+			cellMap[firstChild + k] = newNumCells + k;
+		}
+		newNumCells += 8;
+		for (int k = 7; k >= 0; --k) {
+			stack.push_back(firstChild + mortonChild[k]);
+		}
+	}
+
+	// Nodes: sorted by the Morton code of their position
+	std::vector<std::pair<uint64_t, int>> order;
+	order.reserve(numNodes());
+	for (int i = 0; i < numNodes(); ++i) {
+		if (!nodeIsFree(i)) {
+			order.emplace_back(Morton::encode(m_Nodes[i].position), i);
+		}
+	}
+	GEO::sort(order.begin(), order.end());
+	std::vector<int> nodeMap(numNodes(), -1);
+	for (int i = 0; i < (int) order.size(); ++i) {
+		nodeMap[order[i].second] = i;
+	}
+
+	applyRenumbering(cellMap, newNumCells, nodeMap, (int) order.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Queries
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Return true iff the point lies in the box [0, size]
+bool isInside(const Eigen::Vector3d &p, const Eigen::Vector3i &size) {
+	return (p.array() >= 0).all() && (p.array() <= size.cast<double>().array()).all();
+}
+
+// Unit cell containing a point (points on the upper faces belong to the last cell).
+// Coordinates are clamped before the conversion to int, which is undefined for
+// NaN and out-of-range values (NaN is mapped to the first cell).
+Eigen::Vector3i unitCell(const Eigen::Vector3d &p, const Eigen::Vector3i &size) {
+	Eigen::Vector3i q;
+	for (int c = 0; c < 3; ++c) {
+		const double x = std::floor(p[c]);
+		q[c] = (x >= 0.0 ? (int) std::min(x, (double) (size[c] - 1)) : 0);
+	}
+	return q;
+}
+
+// Trilinear interpolation of the corner values of a cell at local coordinates t \in [0,1]^3
+template<typename Values>
+double trilinear(const Eigen::Vector3d &t, Values &&cornerValue) {
+	double val = 0.0;
+	for (int k = 0; k < 8; ++k) {
+		const Eigen::Vector3i d = Cube::delta(k);
+		val += (d[0] ? t[0] : 1.0 - t[0])
+			* (d[1] ? t[1] : 1.0 - t[1])
+			* (d[2] ? t[2] : 1.0 - t[2])
+			* cornerValue(k);
+	}
+	return val;
+}
+
+} // anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+// Leaf cell containing a point given in grid coordinates
+int OctreeGrid::locate(const Eigen::Vector3d &p) const {
+	if (!isInside(p, m_CellGridSize)) {
+		return -1;
+	}
+	Eigen::Vector3i corner;
+	int extent;
+	return locate(unitCell(p, m_CellGridSize), corner, extent);
+}
+
+// -----------------------------------------------------------------------------
+
+// Descend from the root cell containing q. The box of the current cell is
+// computed on the fly, so only the firstChild fields are read.
+int OctreeGrid::locate(const Eigen::Vector3i &q, Eigen::Vector3i &corner, int &extent) const {
+	extent = 1 << m_MaxDepth;
+	const Eigen::Vector3i coarseCellGridSize = m_CellGridSize / extent;
+	const Eigen::Vector3i coarsePos = q / extent;
+	int cellId = Layout3D::toIndex(coarsePos, coarseCellGridSize);
+	corner = coarsePos * extent;
+	while (!cellIsLeaf(cellId)) {
+		extent /= 2;
+		const Eigen::Vector3i delta = ((q - corner).array() >= extent).cast<int>();
+		corner += delta * extent;
+		cellId = m_Cells[cellId].firstChild + Cube::invDelta(delta);
+	}
+	return cellId;
+}
+
+// -----------------------------------------------------------------------------
+
+// Replace the values at hanging nodes by interpolating the coarser leaf
+void OctreeGrid::constrainHangingNodes(Eigen::VectorXd &values) const {
+	// Process leaves from the coarsest to the finest, so that the corners of a
+	// leaf have their final value when it is used to interpolate
+	std::vector<std::vector<int>> leaves(m_MaxDepth + 1);
+	for (int i = 0; i < numCells(); ++i) {
+		if (cellIsLeaf(i)) {
+			leaves[cellLevel(i)].push_back(i);
+		}
+	}
+
+	std::vector<int> stack;
+	for (int level = m_MaxDepth; level > 0; --level) {
+		for (int cellId : leaves[level]) {
+			const Eigen::Vector3i corner = cellCornerPos(cellId, 0);
+			const int extent = cellExtent(cellId);
+			auto interpolate = [&](int v) {
+				const Eigen::Vector3d t = (nodePos(v) - corner).cast<double>() / extent;
+				values[v] = trilinear(t, [&](int k) { return values[cellCornerId(cellId, k)]; });
+			};
+
+			// Nodes inside the edges of the cell
+			for (const auto &e : CELL_EDGES) {
+				const int v2 = cellCornerId(cellId, e[1]);
+				for (int v = nextNode(cellCornerId(cellId, e[0]), e[2]); v != v2; v = nextNode(v, e[2])) {
+					interpolate(v);
+				}
+			}
+
+			// Nodes inside the faces, which are corners of finer cells on the other side
+			for (int axis = 0; axis < 3; ++axis) {
+				for (int dir = 0; dir < 2; ++dir) {
+					const int neigh = adjCell(cellId, axis, dir);
+					if (neigh == -1 || cellIsLeaf(neigh) || cellExtent(neigh) != extent) { continue; }
+					const int side = corner[axis] + dir * extent;
+					stack.assign(1, neigh);
+					while (!stack.empty()) {
+						const int c = stack.back();
+						stack.pop_back();
+						if (cellIsLeaf(c)) {
+							for (int k = 0; k < 8; ++k) {
+								const int v = cellCornerId(c, k);
+								if (nodePos(v)[axis] == side) { interpolate(v); }
+							}
+						} else {
+							for (int k = 0; k < 8; ++k) {
+								if (Cube::delta(k)[axis] != dir) {
+									stack.push_back(m_Cells[c].firstChild + k);
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+// Evaluate an attribute at a batch of points
+Eigen::VectorXd OctreeGrid::sample(const Eigen::MatrixXd &points, const std::string &attribute) const {
+	const int n = (int) points.rows();
+	Eigen::VectorXd result = Eigen::VectorXd::Constant(n, std::numeric_limits<double>::quiet_NaN());
+	if (points.cols() != 3) {
+		std::cerr << "[OctreeGrid] Expected one 3D point per row." << std::endl;
+		return result;
+	}
+
+	Eigen::VectorXd values;
+	const bool onNodes = nodeAttributes.exists(attribute);
+	if (!(onNodes ? nodeAttributes : cellAttributes).getAsDouble(attribute, values)) {
+		std::cerr << "[OctreeGrid] No numeric attribute named [" << attribute << "]." << std::endl;
+		return result;
+	}
+	if (onNodes) {
+		constrainHangingNodes(values);
+	}
+
+	// Sort points along a Morton curve, so that consecutive points fall in
+	// the same leaves and descend through the same cells
+	std::vector<std::pair<uint64_t, int>> order(n);
+	GEO::parallel_for(0, n, [&](int i) {
+		const Eigen::Vector3d p = points.row(i).transpose();
+		order[i] = std::make_pair(Morton::encode(unitCell(p, m_CellGridSize)), i);
+	});
+	GEO::sort(order.begin(), order.end());
+
+	// Process chunks of consecutive points in parallel, and only descend
+	// again when a point leaves the current leaf
+	const int chunkSize = 4096;
+	const int numChunks = (n + chunkSize - 1) / chunkSize;
+	GEO::parallel_for(0, numChunks, [&](int chunk) {
+		int leaf = -1;
+		Eigen::Vector3i corner;
+		int extent = 0;
+		for (int j = chunk * chunkSize; j < std::min(n, (chunk + 1) * chunkSize); ++j) {
+			const int i = order[j].second;
+			const Eigen::Vector3d p = points.row(i).transpose();
+			if (!isInside(p, m_CellGridSize)) { continue; }
+			const Eigen::Vector3i q = unitCell(p, m_CellGridSize);
+			if (leaf == -1 || (q.array() < corner.array()).any() || (q.array() >= corner.array() + extent).any()) {
+				leaf = locate(q, corner, extent);
+			}
+			if (onNodes) {
+				const Eigen::Vector3d t = (p - corner.cast<double>()) / extent;
+				result[i] = trilinear(t, [&](int k) { return values[cellCornerId(leaf, k)]; });
+			} else {
+				result[i] = values[leaf];
+			}
+		}
+	});
+	return result;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Mesh export
 ////////////////////////////////////////////////////////////////////////////////
@@ -687,24 +1833,23 @@ void OctreeGrid::createMesh(
 {
 	mesh.clear(false, false);
 
-	// logger_debug("OctreeGrid", "createMesh(): Allocate vertices and cells");
+	// Only export leaf cells and the nodes they use
+	std::vector<int> cellToHex, nodeToVertex;
+	int numHexes, numVertices;
+	computeExportMaps(cellToHex, nodeToVertex, numHexes, numVertices);
 
-	// Create the mesh of regular grid
-	mesh.vertices.create_vertices(numNodes());
-	for (int idx = 0; idx < numNodes(); ++idx) {
-		Eigen::Vector3d pos = origin + nodePos(idx).cast<double>().cwiseProduct(spacing);
-		mesh.vertices.point(idx) = GEO::vec3(pos[0], pos[1], pos[2]);
-	}
+	mesh.vertices.create_vertices(numVertices);
+	GEO::parallel_for(0, numNodes(), [&](int idx) {
+		if (nodeToVertex[idx] != -1) {
+			Eigen::Vector3d pos = origin + nodePos(idx).cast<double>().cwiseProduct(spacing);
+			mesh.vertices.point(nodeToVertex[idx]) = GEO::vec3(pos[0], pos[1], pos[2]);
+		}
+	});
 
-	// Count num of leaf cells
-	int numLeaves = 0;
-	for (int c = 0; c < numCells(); ++c) {
-		if (cellIsLeaf(c)) { ++numLeaves; }
-	}
-	GEO::index_t firstCube = mesh.cells.create_hexes(numLeaves);
-	for (int q = 0, c = 0; q < numCells(); ++q) {
-		if (!cellIsLeaf(q)) {
-			continue;
+	GEO::index_t firstCube = mesh.cells.create_hexes(numHexes);
+	GEO::parallel_for(0, numCells(), [&](int q) {
+		if (cellToHex[q] == -1) {
+			return;
 		}
 		Eigen::Vector3i diff[8] = {
 			{0,0,0}, {1,0,0}, {0,1,0}, {1,1,0},
@@ -712,11 +1857,10 @@ void OctreeGrid::createMesh(
 		};
 		for (GEO::index_t lv = 0; lv < 8; ++lv) {
 			int cornerId = Cube::invDelta(diff[lv]);
-			int v = cellCornerId(q, cornerId);
-			mesh.cells.set_vertex(firstCube + c, lv, v);
+			int v = nodeToVertex[cellCornerId(q, cornerId)];
+			mesh.cells.set_vertex(firstCube + cellToHex[q], lv, v);
 		}
-		++c;
-	}
+	});
 
 	// logger_debug("OctreeGrid", "createMesh(): Connecting cells");
 	//GEO::Logger::out("OctreeGrid") << "Computing borders..." << std::endl;
@@ -725,26 +1869,61 @@ void OctreeGrid::createMesh(
 	//mesh.cells.connect();
 
 	// logger_debug("OctreeGrid", "createMesh(): Creating attributes...");
-	updateMeshAttributes(mesh);
+	updateMeshAttributes(mesh, cellToHex, nodeToVertex);
+}
+
+// -----------------------------------------------------------------------------
+
+void OctreeGrid::computeExportMaps(std::vector<int> &cellToHex, std::vector<int> &nodeToVertex,
+	int &numHexes, int &numVertices) const
+{
+	// Number leaf cells
+	cellToHex.resize(numCells());
+	GEO::parallel_for(0, numCells(), [&](int q) {
+		cellToHex[q] = (cellIsLeaf(q) ? 1 : 0);
+	});
+	numHexes = exclusivePrefixSum(cellToHex);
+
+	// Flag and number nodes used by at least one leaf
+	std::vector<std::atomic<char>> used(numNodes());
+	GEO::parallel_for(0, numCells(), [&](int q) {
+		if (cellIsLeaf(q)) {
+			for (int k = 0; k < 8; ++k) {
+				used[cellCornerId(q, k)].store(1, std::memory_order_relaxed);
+			}
+		} else {
+			cellToHex[q] = -1;
+		}
+	});
+	nodeToVertex.resize(numNodes());
+	GEO::parallel_for(0, numNodes(), [&](int v) {
+		nodeToVertex[v] = used[v].load(std::memory_order_relaxed);
+	});
+	numVertices = exclusivePrefixSum(nodeToVertex);
+	GEO::parallel_for(0, numNodes(), [&](int v) {
+		if (!used[v].load(std::memory_order_relaxed)) {
+			nodeToVertex[v] = -1;
+		}
+	});
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 // Shortcut macro to make life easier
-#define CHECK_TYPE(T, id, name, grid, mesh, cth)                   \
-	do {                                                           \
-		if ((id) == std::type_index(typeid(T))) {                  \
-			setGeogramAttribute<T>((name), (grid), (mesh), (cth)); \
-			return;                                                \
-		}                                                          \
+#define CHECK_TYPE(T, id, name, attrs, meshAttrs, map)                   \
+	do {                                                                 \
+		if ((id) == std::type_index(typeid(T))) {                        \
+			setGeogramAttribute<T>((name), (attrs), (meshAttrs), (map)); \
+			return;                                                      \
+		}                                                                \
 	} while (0)
 
-#define CHECK_ALL_TYPE(id, name, grid, mesh, cth)        \
-	do {                                                 \
-		CHECK_TYPE(unsigned, id, name, grid, mesh, cth); \
-		CHECK_TYPE(int, id, name, grid, mesh, cth);      \
-		CHECK_TYPE(float, id, name, grid, mesh, cth);    \
-		CHECK_TYPE(double, id, name, grid, mesh, cth);   \
+#define CHECK_ALL_TYPE(id, name, attrs, meshAttrs, map)        \
+	do {                                                       \
+		CHECK_TYPE(unsigned, id, name, attrs, meshAttrs, map); \
+		CHECK_TYPE(int, id, name, attrs, meshAttrs, map);      \
+		CHECK_TYPE(float, id, name, attrs, meshAttrs, map);    \
+		CHECK_TYPE(double, id, name, attrs, meshAttrs, map);   \
 	} while (0)
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -754,28 +1933,26 @@ namespace {
 // -----------------------------------------------------------------------------
 
 template<typename T>
-void setGeogramAttribute(const std::string &name, const OctreeGrid &grid, GEO::Mesh &mesh,
-	const std::vector<int> &cellToHex)
+void setGeogramAttribute(const std::string &name, const AttributeManager &attrs,
+	GEO::AttributesManager &meshAttrs, const std::vector<int> &gridToMesh)
 {
-	typedef Eigen::Matrix<T, Eigen::Dynamic, 1> VectorT;
-
-	const VectorT &gridCellAttr = grid.cellAttributes.get<T>(name);
-	GEO::Attribute<T> meshCellAttr(mesh.cells.attributes(), name);
+	const T *gridAttr = attrs.handle<T>(name).data();
+	GEO::Attribute<T> meshAttr(meshAttrs, name);
 
-	for (size_t q = 0; q < cellToHex.size(); ++q) {
-		if (cellToHex[q] != -1) {
-			meshCellAttr[cellToHex[q]] = gridCellAttr(q);
+	GEO::parallel_for(0, (GEO::index_t) gridToMesh.size(), [&](GEO::index_t q) {
+		if (gridToMesh[q] != -1) {
+			meshAttr[gridToMesh[q]] = gridAttr[q];
 		}
-	}
+	});
 }
 
 // -----------------------------------------------------------------------------
 
-void setGeogramAttribute(const std::string &name, const OctreeGrid &grid, GEO::Mesh &mesh,
-	const std::vector<int> &cellToHex)
+void setGeogramAttribute(const std::string &name, const AttributeManager &attrs,
+	GEO::AttributesManager &meshAttrs, const std::vector<int> &gridToMesh)
 {
-	std::type_index id = grid.cellAttributes.type(name);
-	CHECK_ALL_TYPE(id, name, grid, mesh, cellToHex);
+	std::type_index id = attrs.type(name);
+	CHECK_ALL_TYPE(id, name, attrs, meshAttrs, gridToMesh);
 }
 
 // -----------------------------------------------------------------------------
@@ -786,15 +1963,22 @@ void setGeogramAttribute(const std::string &name, const OctreeGrid &grid, GEO::M
 
 // Update attributes of a geogram mesh according to the current grid
 void OctreeGrid::updateMeshAttributes(GEO::Mesh &mesh) const {
-	// Map octree cell to hex in the final mesh (keeping only the leaves)
-	std::vector<int> cellToHex(numCells(), -1);
-	for (int q = 0, c = 0; q < numCells(); ++q) {
-		if (cellIsLeaf(q)) {
-			cellToHex[q] = c++;
-		}
-	}
+	std::vector<int> cellToHex, nodeToVertex;
+	int numHexes, numVertices;
+	computeExportMaps(cellToHex, nodeToVertex, numHexes, numVertices);
+	updateMeshAttributes(mesh, cellToHex, nodeToVertex);
+}
+
+// -----------------------------------------------------------------------------
+
+void OctreeGrid::updateMeshAttributes(GEO::Mesh &mesh,
+	const std::vector<int> &cellToHex, const std::vector<int> &nodeToVertex) const
+{
 	for (auto name : cellAttributes.keys()) {
-		setGeogramAttribute(name, *this, mesh, cellToHex);
+		setGeogramAttribute(name, cellAttributes, mesh.cells.attributes(), cellToHex);
+	}
+	for (auto name : nodeAttributes.keys()) {
+		setGeogramAttribute(name, nodeAttributes, mesh.vertices.attributes(), nodeToVertex);
 	}
 }
 
@@ -805,6 +1989,7 @@ void OctreeGrid::updateMeshAttributes(GEO::Mesh &mesh) const {
 void OctreeGrid::assertIsValid() {
 	// Check node adjacency relations
 	for (int node1 = 0; node1 < (int) m_Nodes.size(); ++node1) {
+		if (nodeIsFree(node1)) { continue; }
 		for (int axis = 0; axis < 3; ++axis) {
 			int node0 = prevNode(node1, axis);
 			int node2 = nextNode(node1, axis);
@@ -822,6 +2007,21 @@ void OctreeGrid::assertIsValid() {
 	}
 	// Check cell adjacency relations
 	for (int cell1 = 0; cell1 < (int) m_Cells.size(); ++cell1) {
+		if (cellIsFree(cell1)) { continue; }
+		for (int k = 0; k < 8; ++k) {
+			oct_debug(!nodeIsFree(cellCornerId(cell1, k)));
+		}
+		// Each edge of a cell is a chain of linked nodes
+		for (const auto &e : CELL_EDGES) {
+			const int last = cellCornerId(cell1, e[1]);
+			int node = cellCornerId(cell1, e[0]);
+			while (node != last) {
+				int next = nextNode(node, e[2]);
+				oct_debug(next != -1);
+				oct_debug(m_Nodes[next].position[e[2]] > m_Nodes[node].position[e[2]]);
+				node = next;
+			}
+		}
 		for (int axis = 0; axis < 3; ++axis) {
 			int cell0 = prevCell(cell1, axis);
 			int cell2 = nextCell(cell1, axis);
@@ -872,8 +2072,8 @@ void OctreeGrid::testSubdivideRandom(bool graded, bool paired) {
 		leaves.pop_back();
 		if (depth < m_MaxDepth) {
 			if (distr(gen) > 0.2 && cellIsLeaf(id)) {
-				int newId = (int) m_Cells.size();
 				splitCell(id, graded, paired);
+				int newId = m_Cells[id].firstChild;
 				for (int k = 0; k < 8; ++k) {
 					if (bfs) {
 						next.emplace_back(depth + 1, newId++);
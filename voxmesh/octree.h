@@ -2,11 +2,15 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 #include "attributes.h"
+#include "position_index.h"
 #include "geogram/mesh/mesh.h"
 #include <Eigen/Dense>
 #include <Eigen/SparseCore>
+#include <cstdint>
 #include <vector>
 #include <array>
+#include <memory>
+#include <string>
 #include <utility>
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -49,6 +53,11 @@ public:
 
 	typedef Eigen::Matrix<bool, Eigen::Dynamic, 1> VectorXb;
 
+	// Marker for unused cell/node slots (firstChild of a free cell, position of a free node)
+	enum : int {
+		FREE_SLOT = -2,
+	};
+
 private:
 	/////////////////
 	// Octree Node //
@@ -117,6 +126,19 @@ private:
 	std::vector<Node> m_Nodes;
 	std::vector<Cell> m_Cells;
 
+	// Free slots left by coarsening (single nodes, and blocks of 8 sibling cells)
+	std::vector<int> m_FreeNodes;
+	std::vector<int> m_FreeCells;
+
+	// Live nodes indexed by their position in the lattice (if enabled)
+	bool          m_UseNodeIndex = false;
+	PositionIndex m_NodeIndex;
+
+	// Scratch lists of balanceLevels(), reused across graded splits
+	std::vector<std::vector<int>> m_BalancePending;
+	std::vector<int>              m_BalanceCurrent;
+	std::vector<char>             m_BalanceViolates;
+
 public:
 	/////////////////
 	// Constructor //
@@ -162,9 +184,23 @@ public:
 	// Size of a cell
 	int cellExtent(int cellId) const;
 
+	// Adjacent cell along axis in direction dir (\in {0, 1}), or -1 on the border
+	int cellNeighId(int cellId, int axis, int dir) const { return adjCell(cellId, axis, dir); }
+
 	// Return true iff the cell has no children
 	bool cellIsLeaf(int cellId) const { assert(cellId != -1); return m_Cells[cellId].firstChild == -1; }
 
+	// Return true iff the cell slot is unused (neither a leaf nor an internal cell)
+	bool cellIsFree(int cellId) const { assert(cellId != -1); return m_Cells[cellId].firstChild == FREE_SLOT; }
+
+	// Return true iff the node slot is unused
+	bool nodeIsFree(int nodeId) const { assert(nodeId != -1); return m_Nodes[nodeId].position[0] == FREE_SLOT; }
+
+	// Maintain a hash table of node positions, so that finding the midpoint of
+	// an edge does not depend on the number of nodes along that edge. This
+	// only pays off for strongly ungraded trees.
+	void setUseNodeIndex(bool enabled);
+
 	// Returns true iff the octree is 2:1 graded
 	bool is2to1Graded() const;
 
@@ -217,9 +253,15 @@ private:
 	// Update links between the direct children of a cell along axis
 	void updateSubcellLinks(int cell, int axis);
 
+	// Rebuild the node index from the node array
+	void rebuildNodeIndex();
+
 	// Retrieve the index of the midnode of an edge, if it exists
 	int getMidEdgeNode(int node1, int node2, int axis) const;
 
+	// Same as getMidEdgeNode(), walking the linked list of nodes along the edge
+	int getMidEdgeNodeByWalk(int node1, int node2, int axis) const;
+
 	// Add a node at the middle of an edge
 	int addMidEdgeNode(int node1, int node2, int axis);
 
@@ -235,19 +277,167 @@ private:
 	// @return     { id of the new node in the middle of the cell }
 	int splitCell(int cellId, bool graded, bool paired);
 
-	// Make the cell 2:1 graded
-	// @return     { true if a subdivision occurred }
-	bool makeCellGraded(int cellId, bool paired);
+private:
+	////////////////////////
+	// Balancing routines //
+	////////////////////////
+
+	// Level of a cell (0 for the finest cells)
+	int cellLevel(int cellId) const;
+
+	// Range [first, last) of cells sharing the same parent (all root cells are siblings)
+	std::pair<int, int> cellSiblings(int cellId) const;
+
+	// Return true iff an internal cell violates the grading or pairing rules
+	bool cellNeedsBalance(int cellId, bool graded, bool paired) const;
+
+	// Split the cells that make an internal cell violate the grading or pairing
+	// rules, and add them to the pending lists (indexed by level). The split
+	// cells are also appended to splitCells (if not null).
+	void balanceCell(int cellId, bool graded, bool paired, std::vector<std::vector<int>> &pending,
+		std::vector<int> *splitCells = nullptr);
+
+	// Process pending internal cells level by level, from the finest to the coarsest
+	void balanceLevels(std::vector<std::vector<int>> &pending, bool graded, bool paired,
+		std::vector<int> *splitCells = nullptr);
+
+private:
+	/////////////////////////////////////
+	// Concurrent subdivision routines //
+	/////////////////////////////////////
+
+	// Split the leaves recursively according to the predicate (no grading, no logging)
+	void splitRecursively(const std::function<bool(int, int, int, int)> &predicate);
+
+	// Replace the leaf cells with the subtrees grown from them (nullptr: leave
+	// the leaf as is), merging the nodes on their boundaries
+	void graftSubtrees(const std::vector<int> &leaves, const std::vector<std::unique_ptr<OctreeGrid>> &subtrees);
+
+	// Point the links of a cell to the adjacent cell of the same size, or to
+	// the smallest coarser one covering its face
+	void updateCellNeighbors(int cellId);
+
+private:
+	/////////////////////////
+	// Coarsening routines //
+	/////////////////////////
+
+	// Get a node slot (reusing a free one if possible)
+	int allocateNode(const Node &node);
+
+	// Get a block of 8 consecutive cell slots (reusing a free one if possible)
+	int allocateCells();
+
+	// Scan the node and cell arrays for free slots
+	void rebuildFreeLists();
+
+	// Return true iff the children of a cell are all leaves
+	bool cellHasLeafChildren(int cellId) const;
+
+	// Return true iff merging the children of a cell keeps the octree 2:1 graded
+	bool cellCanMerge(int cellId) const;
+
+	// Merge the 8 leaf children of a cell, and free the unused nodes
+	// (nodeRefs counts the live cells using each node as a corner)
+	void mergeCell(int cellId, std::vector<int> &nodeRefs);
 
-	// Make the cell paired (its children are either all leaves, or all internal nodes)
-	// @return     { true if a subdivision occurred }
-	bool makeCellPaired(int cellId, bool graded);
+	// Renumber nodes and cells (-1 to drop a slot). Sibling cells must be
+	// mapped to consecutive ids, and root cells must keep their ids.
+	void applyRenumbering(const std::vector<int> &cellMap, int newNumCells,
+		const std::vector<int> &nodeMap, int newNumNodes);
 
 public:
 	// Traverse the leaf cells recursively and split them according to the predicate function
 	void subdivide(std::function<bool(int, int, int, int)> predicate,
 		bool graded = false, bool paired = false, int maxCells = -1);
 
+	// Same as subdivide(), but the (thread-safe) predicate is evaluated in parallel one level at a time
+	void subdivideParallel(std::function<bool(int, int, int, int)> predicate,
+		bool graded = false, bool paired = false, int maxCells = -1);
+
+	// Same as subdivide(), but the topology is built in parallel: the leaves
+	// are refined until there is enough work for all threads, then each of
+	// them grows its own subtree, and the subtrees are stitched along their
+	// shared faces. The predicate must be thread-safe.
+	void subdivideConcurrent(std::function<bool(int, int, int, int)> predicate,
+		bool graded = false, bool paired = false);
+
+	// Split the leaves with the highest priority first, until the budget of
+	// cells is spent (-1 for no limit) or no leaf has a positive priority left.
+	// Cells needed to restore the grading/pairing are counted in the budget
+	// (the last split may exceed it). The (thread-safe) priority is evaluated
+	// in parallel.
+	void subdivideByPriority(std::function<double(int, int, int, int)> priority,
+		int maxCells, bool graded = false, bool paired = false);
+
+	// Build the octree bottom-up from dense arrays over the finest cells (in
+	// Layout3D order). A cell is split iff one of the finest cells it covers is
+	// flagged in `refine`, or if they do not all have the same label (< 255).
+	// Uniform blocks are merged level by level in parallel (min/max pyramid),
+	// then the hierarchy is created from the root cells and balanced. The label
+	// of each cell (-1 if not uniform) is returned in cellLabels.
+	void buildBottomUp(const std::vector<char> &refine, const std::vector<uint8_t> &labels,
+		std::vector<int> &cellLabels, bool graded = false, bool paired = false);
+
+	// Merge the children of cells for which the predicate is true, as long
+	// as they are all leaves (and the grading/pairing rules are preserved).
+	// Freed slots are reused by later subdivisions.
+	void coarsen(std::function<bool(int, int, int, int)> predicate,
+		bool graded = false, bool paired = false);
+
+	// Remove free node and cell slots (attributes are renumbered accordingly)
+	void compact();
+
+	// Renumber cells and nodes along a Morton curve, so that adjacent cells
+	// and nodes are close in memory. Sibling cells stay contiguous, root cells
+	// keep their ids, free slots are removed and attributes are renumbered.
+	void reorder();
+
+	// Split cells until the octree is graded and/or paired. This is the same
+	// refinement as the one enforced by splitCell(), so it is cheaper to
+	// subdivide without grading and to balance once at the end.
+	void balance(bool graded, bool paired);
+
+public:
+	/////////////
+	// Queries //
+	/////////////
+
+	// Leaf cell containing a point given in grid coordinates (the frame of
+	// nodePos()), or -1 if the point lies outside the grid
+	int locate(const Eigen::Vector3d &p) const;
+
+	// Evaluate an attribute at a batch of points in grid coordinates (one per
+	// row). Node attributes are interpolated trilinearly, with hanging nodes
+	// constrained by the coarser side so that the result is continuous. Cell
+	// attributes are constant over each leaf. Points outside the grid get NaN.
+	Eigen::VectorXd sample(const Eigen::MatrixXd &points, const std::string &attribute) const;
+
+private:
+	// Leaf cell containing the unit cell at position q, with its lower corner and extent
+	int locate(const Eigen::Vector3i &q, Eigen::Vector3i &corner, int &extent) const;
+
+	// Replace the values at hanging nodes by interpolating the values on the
+	// coarser leaf they lie on
+	void constrainHangingNodes(Eigen::VectorXd &values) const;
+
+public:
+	////////////////////////
+	// Surface extraction //
+	////////////////////////
+
+	// Extract the surface {value = 0} by dual contouring over the leaves, with
+	// negative values inside. The attribute is either a node attribute (e.g. a
+	// signed distance), or a cell attribute flagging the leaves inside the
+	// shape (e.g. "inside"). Each leaf crossed by the surface gets a vertex
+	// minimizing a quadric built from the crossings on its edges and their
+	// normals. Normals are given in grid coordinates by the callback, or taken
+	// from the gradient of the interpolated field. Returns false if the
+	// attribute is missing.
+	bool extractSurface(GEO::Mesh &mesh, const std::string &attribute,
+		const Eigen::Vector3d &origin, const Eigen::Vector3d &spacing,
+		std::function<Eigen::Vector3d(const Eigen::Vector3d &)> normal = nullptr) const;
+
 public:
 	/////////////////
 	// Mesh export //
@@ -259,6 +449,26 @@ public:
 	// Update attributes of a geogram mesh according to the current grid
 	void updateMeshAttributes(GEO::Mesh &mesh) const;
 
+private:
+	// Map leaf cells to hexes and used nodes to mesh vertices (-1 if not exported)
+	void computeExportMaps(std::vector<int> &cellToHex, std::vector<int> &nodeToVertex,
+		int &numHexes, int &numVertices) const;
+
+	// Copy cell and node attributes to the geogram mesh
+	void updateMeshAttributes(GEO::Mesh &mesh,
+		const std::vector<int> &cellToHex, const std::vector<int> &nodeToVertex) const;
+
+public:
+	///////////////////
+	// Serialization //
+	///////////////////
+
+	// Save the octree and its attributes in a binary file (see octree_io.h)
+	bool save(const std::string &filename) const;
+
+	// Replace the current octree with the content of a binary file
+	bool load(const std::string &filename);
+
 public:
 	///////////
 	// Debug //
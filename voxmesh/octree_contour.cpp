@@ -0,0 +1,244 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "octree.h"
+#include "common.h"
+#include <geogram/basic/logger.h>
+#include <geogram/basic/process.h>
+#include <Eigen/SVD>
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// -----------------------------------------------------------------------------
+
+// The 12 edges of a cell, as (first corner, second corner, axis)
+std::vector<std::array<int, 3>> cubeEdges() {
+	std::vector<std::array<int, 3>> edges;
+	for (int k = 0; k < 8; ++k) {
+		const Eigen::Vector3i d = Cube::delta(k);
+		for (int axis = 0; axis < 3; ++axis) {
+			if (d[axis] == 0) {
+				const int other = Cube::invDelta(d + Eigen::Vector3i::Unit(axis));
+				edges.push_back({{k, other, axis}});
+			}
+		}
+	}
+	return edges;
+}
+
+// Gradient of the trilinear interpolation of the corner values of a cell, at
+// local coordinates t \in [0,1]^3
+template<typename Values>
+Eigen::Vector3d trilinearGradient(const Eigen::Vector3d &t, Values &&cornerValue) {
+	Eigen::Vector3d grad = Eigen::Vector3d::Zero();
+	for (int k = 0; k < 8; ++k) {
+		const Eigen::Vector3i d = Cube::delta(k);
+		const double v = cornerValue(k);
+		const Eigen::Vector3d w(d[0] ? t[0] : 1.0 - t[0], d[1] ? t[1] : 1.0 - t[1], d[2] ? t[2] : 1.0 - t[2]);
+		for (int axis = 0; axis < 3; ++axis) {
+			double dw = (d[axis] ? 1.0 : -1.0);
+			for (int other = 0; other < 3; ++other) {
+				if (other != axis) { dw *= w[other]; }
+			}
+			grad[axis] += dw * v;
+		}
+	}
+	return grad;
+}
+
+// Point minimizing the sum of squared distances to the planes (p_i, n_i),
+// pulled towards the mass point along the directions the planes leave free
+Eigen::Vector3d solveQuadric(const std::vector<Eigen::Vector3d> &points,
+	const std::vector<Eigen::Vector3d> &normals)
+{
+	Eigen::Vector3d massPoint = Eigen::Vector3d::Zero();
+	for (const auto &p : points) { massPoint += p; }
+	massPoint /= (double) points.size();
+
+	Eigen::Matrix3d AtA = Eigen::Matrix3d::Zero();
+	Eigen::Vector3d Atb = Eigen::Vector3d::Zero();
+	for (size_t i = 0; i < points.size(); ++i) {
+		const Eigen::Vector3d &n = normals[i];
+		AtA += n * n.transpose();
+		Atb += n * n.dot(points[i] - massPoint);
+	}
+
+	// Truncated pseudo-inverse, so that nearly parallel planes do not throw
+	// the vertex far away
+	Eigen::JacobiSVD<Eigen::Matrix3d> svd(AtA, Eigen::ComputeFullU | Eigen::ComputeFullV);
+	const Eigen::Vector3d sigma = svd.singularValues();
+	Eigen::Vector3d inv = Eigen::Vector3d::Zero();
+	for (int i = 0; i < 3; ++i) {
+		if (sigma[i] > 0.1 * sigma[0]) { inv[i] = 1.0 / sigma[i]; }
+	}
+	return massPoint + svd.matrixV() * inv.asDiagonal() * svd.matrixU().transpose() * Atb;
+}
+
+// -----------------------------------------------------------------------------
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Dual contouring (Ju et al. 2002). A polygon is created for each minimal edge
+// crossed by the surface, i.e. for each pair of consecutive nodes along an
+// axis with values of opposite signs. It connects the vertices of the (3 or 4
+// distinct) leaves around the edge.
+bool OctreeGrid::extractSurface(GEO::Mesh &mesh, const std::string &attribute,
+	const Eigen::Vector3d &origin, const Eigen::Vector3d &spacing,
+	std::function<Eigen::Vector3d(const Eigen::Vector3d &)> normal) const
+{
+	mesh.clear(false, false);
+
+	// Scalar field at the nodes (negative inside)
+	Eigen::VectorXd values;
+	if (nodeAttributes.getAsDouble(attribute, values)) {
+		// Use as is
+	} else if (cellAttributes.getAsDouble(attribute, values)) {
+		// Fraction of the leaves around each node that are outside, minus one half
+		Eigen::VectorXd inside = values;
+		Eigen::VectorXd count = Eigen::VectorXd::Zero(numNodes());
+		values = Eigen::VectorXd::Zero(numNodes());
+		for (int c = 0; c < numCells(); ++c) {
+			if (cellIsFree(c) || !cellIsLeaf(c)) { continue; }
+			for (int k = 0; k < 8; ++k) {
+				values[cellCornerId(c, k)] += (inside[c] > 0.5 ? 0.0 : 1.0);
+				count[cellCornerId(c, k)] += 1.0;
+			}
+		}
+		for (int v = 0; v < numNodes(); ++v) {
+			values[v] = (count[v] > 0 ? values[v] / count[v] - 0.5 : 0.5);
+		}
+	} else {
+		std::cerr << "[OctreeGrid] No numeric attribute named [" << attribute << "]." << std::endl;
+		return false;
+	}
+	constrainHangingNodes(values);
+	auto isInside = [&](int v) { return values[v] < 0; };
+
+	// Place one vertex in each leaf crossed by the surface
+	std::vector<int> leaves;
+	for (int c = 0; c < numCells(); ++c) {
+		if (!cellIsFree(c) && cellIsLeaf(c)) {
+			leaves.push_back(c);
+		}
+	}
+	const std::vector<std::array<int, 3>> edges = cubeEdges();
+	std::vector<Eigen::Vector3d> leafVertex(leaves.size());
+	std::vector<char> leafCrossed(leaves.size(), 0);
+	GEO::parallel_for(0, (GEO::index_t) leaves.size(), [&](GEO::index_t i) {
+		const int cellId = leaves[i];
+		const Eigen::Vector3i corner = cellCornerPos(cellId, 0);
+		const int extent = cellExtent(cellId);
+		auto cornerValue = [&](int k) { return values[cellCornerId(cellId, k)]; };
+
+		// Hermite data: edge crossings and normals
+		std::vector<Eigen::Vector3d> points, normals;
+		for (const auto &e : edges) {
+			const double v0 = cornerValue(e[0]);
+			const double v1 = cornerValue(e[1]);
+			if ((v0 < 0) == (v1 < 0)) { continue; }
+			Eigen::Vector3d p = cellCornerPos(cellId, e[0]).cast<double>();
+			p[e[2]] += extent * v0 / (v0 - v1);
+			Eigen::Vector3d n = (normal ? normal(p)
+				: trilinearGradient((p - corner.cast<double>()) / extent, cornerValue));
+			if (n.squaredNorm() > 0) {
+				points.push_back(p);
+				normals.push_back(n.normalized());
+			}
+		}
+		if (points.empty()) { return; }
+
+		const Eigen::Vector3d lower = corner.cast<double>();
+		const Eigen::Vector3d upper = lower.array() + extent;
+		leafVertex[i] = solveQuadric(points, normals).cwiseMax(lower).cwiseMin(upper);
+		leafCrossed[i] = 1;
+	});
+
+	// Number the vertices
+	std::vector<int> cellToVertex(numCells(), -1);
+	int numVertices = 0;
+	for (size_t i = 0; i < leaves.size(); ++i) {
+		if (leafCrossed[i]) {
+			cellToVertex[leaves[i]] = numVertices++;
+		}
+	}
+
+	// Polygon around the minimal edge starting at a node along an axis. The
+	// leaves are listed counterclockwise around the axis, and the polygon is
+	// oriented so that its normal points outside.
+	auto edgePolygon = [&](int v, int axis, std::array<int, 4> &poly) {
+		const int b = (axis + 1) % 3;
+		const int c = (axis + 2) % 3;
+		const int db[4] = { -1, 0, 0, -1 };
+		const int dc[4] = { -1, -1, 0, 0 };
+		int n = 0;
+		for (int k = 0; k < 4; ++k) {
+			Eigen::Vector3i q = nodePos(v);
+			q[b] += db[k];
+			q[c] += dc[k];
+			if ((q.array() < 0).any() || (q.array() >= m_CellGridSize.array()).any()) {
+				return 0;
+			}
+			Eigen::Vector3i leafCorner;
+			int leafExtent;
+			const int vertex = cellToVertex[locate(q, leafCorner, leafExtent)];
+			if (vertex == -1) { return 0; }
+			if (n == 0 || poly[n-1] != vertex) { poly[n++] = vertex; }
+		}
+		if (n > 1 && poly[n-1] == poly[0]) { --n; }
+		if (!isInside(v)) { std::reverse(poly.begin(), poly.begin() + n); }
+		return (n >= 3 ? n : 0);
+	};
+
+	// Count the triangles created from each node, then fill them in parallel
+	auto isCrossed = [&](int v, int axis) {
+		const int next = nextNode(v, axis);
+		return next != -1 && isInside(v) != isInside(next);
+	};
+	std::vector<int> offset(numNodes() + 1, 0);
+	GEO::parallel_for(0, numNodes(), [&](int v) {
+		if (nodeIsFree(v)) { return; }
+		std::array<int, 4> poly;
+		for (int axis = 0; axis < 3; ++axis) {
+			if (isCrossed(v, axis)) {
+				const int n = edgePolygon(v, axis, poly);
+				offset[v+1] += (n == 0 ? 0 : n - 2);
+			}
+		}
+	});
+	for (int v = 0; v < numNodes(); ++v) {
+		offset[v+1] += offset[v];
+	}
+
+	mesh.vertices.create_vertices(numVertices);
+	GEO::parallel_for(0, (GEO::index_t) leaves.size(), [&](GEO::index_t i) {
+		const int vertex = cellToVertex[leaves[i]];
+		if (vertex != -1) {
+			const Eigen::Vector3d pos = origin + leafVertex[i].cwiseProduct(spacing);
+			mesh.vertices.point(vertex) = GEO::vec3(pos[0], pos[1], pos[2]);
+		}
+	});
+	const GEO::index_t firstTriangle = mesh.facets.create_triangles(offset.back());
+	GEO::parallel_for(0, numNodes(), [&](int v) {
+		if (nodeIsFree(v)) { return; }
+		GEO::index_t f = firstTriangle + offset[v];
+		std::array<int, 4> poly;
+		for (int axis = 0; axis < 3; ++axis) {
+			if (!isCrossed(v, axis)) { continue; }
+			const int n = edgePolygon(v, axis, poly);
+			for (int k = 1; k + 1 < n; ++k, ++f) {
+				mesh.facets.set_vertex(f, 0, poly[0]);
+				mesh.facets.set_vertex(f, 1, poly[k]);
+				mesh.facets.set_vertex(f, 2, poly[k+1]);
+			}
+		}
+	});
+
+	GEO::Logger::out("OctreeGrid") << "Extracted " << numVertices << " vertices and "
+		<< offset.back() << " triangles" << std::endl;
+	return true;
+}
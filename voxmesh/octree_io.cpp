@@ -0,0 +1,361 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "octree_io.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace OctreeFormat;
+
+size_t OctreeFormat::typeSize(uint32_t type) {
+	switch (type) {
+		case TYPE_UINT32:  return 4;
+		case TYPE_INT32:   return 4;
+		case TYPE_FLOAT32: return 4;
+		case TYPE_FLOAT64: return 8;
+		default:           return 0;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// -----------------------------------------------------------------------------
+
+uint64_t alignOffset(uint64_t offset) {
+	return (offset + 7) & ~uint64_t(7);
+}
+
+// -----------------------------------------------------------------------------
+
+// Type tag of an attribute, and pointer to its raw data
+uint32_t attributeData(const AttributeManager &attrs, const std::string &name, const char * &data) {
+	std::type_index id = attrs.type(name);
+	if (id == std::type_index(typeid(unsigned))) {
+		data = reinterpret_cast<const char *>(attrs.get<unsigned>(name).data());
+		return TYPE_UINT32;
+	} else if (id == std::type_index(typeid(int))) {
+		data = reinterpret_cast<const char *>(attrs.get<int>(name).data());
+		return TYPE_INT32;
+	} else if (id == std::type_index(typeid(float))) {
+		data = reinterpret_cast<const char *>(attrs.get<float>(name).data());
+		return TYPE_FLOAT32;
+	} else if (id == std::type_index(typeid(double))) {
+		data = reinterpret_cast<const char *>(attrs.get<double>(name).data());
+		return TYPE_FLOAT64;
+	}
+	data = nullptr;
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+// Create an attribute from its type tag, and return a pointer to its raw data
+char * createAttribute(AttributeManager &attrs, const std::string &name, uint32_t type) {
+	switch (type) {
+		case TYPE_UINT32:  return reinterpret_cast<char *>(attrs.create<unsigned>(name).data());
+		case TYPE_INT32:   return reinterpret_cast<char *>(attrs.create<int>(name).data());
+		case TYPE_FLOAT32: return reinterpret_cast<char *>(attrs.create<float>(name).data());
+		case TYPE_FLOAT64: return reinterpret_cast<char *>(attrs.create<double>(name).data());
+		default:           return nullptr;
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+// Check header and section bounds of a buffer holding a whole file
+bool checkFile(const char *data, size_t size, const std::string &filename) {
+	if (size < sizeof(FileHeader)) {
+		std::cerr << "[OctreeGrid] File too small: " << filename << std::endl;
+		return false;
+	}
+	const FileHeader *header = reinterpret_cast<const FileHeader *>(data);
+	if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0) {
+		std::cerr << "[OctreeGrid] Not an octree file: " << filename << std::endl;
+		return false;
+	}
+	if (header->version != VERSION || header->headerSize != sizeof(FileHeader)) {
+		std::cerr << "[OctreeGrid] Unsupported file version " << header->version << ": " << filename << std::endl;
+		return false;
+	}
+	// Sections are read in place: they must be aligned, and their bounds are
+	// checked without overflowing on a corrupted header
+	auto fits = [size](uint64_t offset, uint64_t count, uint64_t recordSize) {
+		return offset % 8 == 0 && offset <= size && count <= (size - offset) / recordSize;
+	};
+	const uint64_t numAttrs = (uint64_t) header->numNodeAttributes + header->numCellAttributes;
+	bool valid = fits(header->nodesOffset, header->numNodes, sizeof(NodeRecord))
+		&& fits(header->cellsOffset, header->numCells, sizeof(CellRecord))
+		&& fits(header->attributesOffset, numAttrs, sizeof(AttributeRecord));
+	for (uint64_t k = 0; valid && k < numAttrs; ++k) {
+		const AttributeRecord &rec = reinterpret_cast<const AttributeRecord *>(data + header->attributesOffset)[k];
+		valid = typeSize(rec.type) > 0
+			&& fits(rec.offset, rec.count, typeSize(rec.type))
+			&& rec.count == (rec.location == ON_NODES ? header->numNodes : header->numCells);
+	}
+	if (!valid) {
+		std::cerr << "[OctreeGrid] Corrupted octree file: " << filename << std::endl;
+	}
+	return valid;
+}
+
+// -----------------------------------------------------------------------------
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+// OctreeGrid
+////////////////////////////////////////////////////////////////////////////////
+
+// Save the octree and its attributes in a binary file
+bool OctreeGrid::save(const std::string &filename) const {
+	std::vector<std::string> nodeKeys = nodeAttributes.keys();
+	std::vector<std::string> cellKeys = cellAttributes.keys();
+
+	FileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.headerSize = sizeof(FileHeader);
+	for (int c = 0; c < 3; ++c) {
+		header.nodeGridSize[c] = m_NodeGridSize[c];
+		header.cellGridSize[c] = m_CellGridSize[c];
+	}
+	header.maxDepth = m_MaxDepth;
+	header.numRootCells = m_NumRootCells;
+	header.numNodes = m_Nodes.size();
+	header.numCells = m_Cells.size();
+	header.numNodeAttributes = (uint32_t) nodeKeys.size();
+	header.numCellAttributes = (uint32_t) cellKeys.size();
+	header.nodesOffset = alignOffset(sizeof(FileHeader));
+	header.cellsOffset = alignOffset(header.nodesOffset + header.numNodes * sizeof(NodeRecord));
+	header.attributesOffset = alignOffset(header.cellsOffset + header.numCells * sizeof(CellRecord));
+
+	// Attribute table
+	std::vector<AttributeRecord> records;
+	std::vector<const char *> payloads;
+	uint64_t offset = header.attributesOffset + (nodeKeys.size() + cellKeys.size()) * sizeof(AttributeRecord);
+	auto addRecords = [&](const AttributeManager &attrs, const std::vector<std::string> &keys,
+		uint32_t location, uint64_t count)
+	{
+		for (const auto &name : keys) {
+			AttributeRecord rec;
+			std::memset(&rec, 0, sizeof(rec));
+			if (name.size() >= sizeof(rec.name)) {
+				std::cerr << "[OctreeGrid] Attribute name too long: " << name << std::endl;
+				return false;
+			}
+			std::strncpy(rec.name, name.c_str(), sizeof(rec.name) - 1);
+			const char *data;
+			rec.type = attributeData(attrs, name, data);
+			if (rec.type == 0) {
+				std::cerr << "[OctreeGrid] Unsupported type for attribute: " << name << std::endl;
+				return false;
+			}
+			rec.location = location;
+			rec.count = count;
+			rec.offset = offset = alignOffset(offset);
+			offset += count * typeSize(rec.type);
+			records.push_back(rec);
+			payloads.push_back(data);
+		}
+		return true;
+	};
+	if (!addRecords(nodeAttributes, nodeKeys, ON_NODES, header.numNodes)
+		|| !addRecords(cellAttributes, cellKeys, ON_CELLS, header.numCells))
+	{
+		return false;
+	}
+
+	// Node and cell arrays
+	std::vector<NodeRecord> nodes(m_Nodes.size());
+	for (size_t i = 0; i < m_Nodes.size(); ++i) {
+		std::copy_n(m_Nodes[i].neighNodeId.begin(), 6, nodes[i].neighNodeId);
+		std::copy_n(m_Nodes[i].position.data(), 3, nodes[i].position);
+	}
+	std::vector<CellRecord> cells(m_Cells.size());
+	for (size_t i = 0; i < m_Cells.size(); ++i) {
+		cells[i].firstChild = m_Cells[i].firstChild;
+		std::copy_n(m_Cells[i].cornerNodeId.begin(), 8, cells[i].cornerNodeId);
+		std::copy_n(m_Cells[i].neighCellId.begin(), 6, cells[i].neighCellId);
+	}
+
+	std::ofstream out(filename, std::ios::binary);
+	if (!out) {
+		std::cerr << "[OctreeGrid] Cannot open file for writing: " << filename << std::endl;
+		return false;
+	}
+	auto write = [&out](uint64_t at, const void *data, uint64_t size) {
+		static const char zeros[8] = { 0 };
+		out.write(zeros, at - (uint64_t) out.tellp());
+		out.write(reinterpret_cast<const char *>(data), size);
+	};
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	write(header.nodesOffset, nodes.data(), nodes.size() * sizeof(NodeRecord));
+	write(header.cellsOffset, cells.data(), cells.size() * sizeof(CellRecord));
+	write(header.attributesOffset, records.data(), records.size() * sizeof(AttributeRecord));
+	for (size_t k = 0; k < records.size(); ++k) {
+		write(records[k].offset, payloads[k], records[k].count * typeSize(records[k].type));
+	}
+	return (bool) out;
+}
+
+// -----------------------------------------------------------------------------
+
+// Replace the current octree with the content of a binary file
+bool OctreeGrid::load(const std::string &filename) {
+	std::ifstream in(filename, std::ios::binary | std::ios::ate);
+	if (!in) {
+		std::cerr << "[OctreeGrid] Cannot open file: " << filename << std::endl;
+		return false;
+	}
+	std::vector<uint64_t> buffer((size_t(in.tellg()) + 7) / 8);
+	const char *data = reinterpret_cast<const char *>(buffer.data());
+	const size_t size = (size_t) in.tellg();
+	in.seekg(0);
+	in.read(reinterpret_cast<char *>(buffer.data()), size);
+	if (!in || !checkFile(data, size, filename)) {
+		return false;
+	}
+
+	const FileHeader &header = *reinterpret_cast<const FileHeader *>(data);
+	m_NodeGridSize = Eigen::Vector3i(header.nodeGridSize[0], header.nodeGridSize[1], header.nodeGridSize[2]);
+	m_CellGridSize = Eigen::Vector3i(header.cellGridSize[0], header.cellGridSize[1], header.cellGridSize[2]);
+	m_MaxDepth = header.maxDepth;
+	m_NumRootCells = header.numRootCells;
+
+	const NodeRecord *nodes = reinterpret_cast<const NodeRecord *>(data + header.nodesOffset);
+	m_Nodes.resize(header.numNodes);
+	for (size_t i = 0; i < m_Nodes.size(); ++i) {
+		std::copy_n(nodes[i].neighNodeId, 6, m_Nodes[i].neighNodeId.begin());
+		std::copy_n(nodes[i].position, 3, m_Nodes[i].position.data());
+	}
+	const CellRecord *cells = reinterpret_cast<const CellRecord *>(data + header.cellsOffset);
+	m_Cells.resize(header.numCells);
+	for (size_t i = 0; i < m_Cells.size(); ++i) {
+		m_Cells[i].firstChild = cells[i].firstChild;
+		std::copy_n(cells[i].cornerNodeId, 8, m_Cells[i].cornerNodeId.begin());
+		std::copy_n(cells[i].neighCellId, 6, m_Cells[i].neighCellId.begin());
+	}
+	rebuildFreeLists();
+	rebuildNodeIndex();
+
+	nodeAttributes = AttributeManager(m_Nodes.size());
+	cellAttributes = AttributeManager(m_Cells.size());
+	const AttributeRecord *records = reinterpret_cast<const AttributeRecord *>(data + header.attributesOffset);
+	for (uint32_t k = 0; k < header.numNodeAttributes + header.numCellAttributes; ++k) {
+		const AttributeRecord &rec = records[k];
+		std::string name(rec.name, strnlen(rec.name, sizeof(rec.name)));
+		AttributeManager &attrs = (rec.location == ON_NODES ? nodeAttributes : cellAttributes);
+		char *dst = createAttribute(attrs, name, rec.type);
+		std::memcpy(dst, data + rec.offset, rec.count * typeSize(rec.type));
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// OctreeGridView
+////////////////////////////////////////////////////////////////////////////////
+
+// Map a file in memory, and check its header
+bool OctreeGridView::open(const std::string &filename) {
+	close();
+
+#ifndef _WIN32
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::cerr << "[OctreeGridView] Cannot open file: " << filename << std::endl;
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		std::cerr << "[OctreeGridView] Cannot read file: " << filename << std::endl;
+		return false;
+	}
+	m_Size = (size_t) st.st_size;
+	void *ptr = mmap(nullptr, m_Size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (ptr == MAP_FAILED) {
+		std::cerr << "[OctreeGridView] Cannot map file: " << filename << std::endl;
+		m_Size = 0;
+		return false;
+	}
+	m_Mapping = ptr;
+	m_Data = static_cast<const char *>(ptr);
+#else
+	// No mmap: read the whole file in an 8-byte aligned buffer
+	std::ifstream in(filename, std::ios::binary | std::ios::ate);
+	if (!in) {
+		std::cerr << "[OctreeGridView] Cannot open file: " << filename << std::endl;
+		return false;
+	}
+	m_Size = (size_t) in.tellg();
+	m_Buffer.resize((m_Size + 7) / 8);
+	in.seekg(0);
+	in.read(reinterpret_cast<char *>(m_Buffer.data()), m_Size);
+	m_Data = reinterpret_cast<const char *>(m_Buffer.data());
+#endif
+
+	if (!checkFile(m_Data, m_Size, filename)) {
+		close();
+		return false;
+	}
+	m_Header = reinterpret_cast<const FileHeader *>(m_Data);
+	m_Nodes = reinterpret_cast<const NodeRecord *>(m_Data + m_Header->nodesOffset);
+	m_Cells = reinterpret_cast<const CellRecord *>(m_Data + m_Header->cellsOffset);
+	m_Attrs = reinterpret_cast<const AttributeRecord *>(m_Data + m_Header->attributesOffset);
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+
+// Unmap the current file
+void OctreeGridView::close() {
+#ifndef _WIN32
+	if (m_Mapping) {
+		munmap(m_Mapping, m_Size);
+	}
+#endif
+	m_Buffer.clear();
+	m_Mapping = nullptr;
+	m_Data = nullptr;
+	m_Size = 0;
+	m_Header = nullptr;
+	m_Nodes = nullptr;
+	m_Cells = nullptr;
+	m_Attrs = nullptr;
+}
+
+// -----------------------------------------------------------------------------
+
+std::vector<std::string> OctreeGridView::keys(uint32_t location) const {
+	std::vector<std::string> res;
+	for (uint32_t k = 0; k < m_Header->numNodeAttributes + m_Header->numCellAttributes; ++k) {
+		if (m_Attrs[k].location == location) {
+			res.emplace_back(m_Attrs[k].name, strnlen(m_Attrs[k].name, sizeof(m_Attrs[k].name)));
+		}
+	}
+	return res;
+}
+
+// -----------------------------------------------------------------------------
+
+const AttributeRecord * OctreeGridView::findAttribute(const std::string &name, uint32_t location) const {
+	for (uint32_t k = 0; k < m_Header->numNodeAttributes + m_Header->numCellAttributes; ++k) {
+		if (m_Attrs[k].location == location
+			&& name.compare(0, std::string::npos, m_Attrs[k].name, strnlen(m_Attrs[k].name, sizeof(m_Attrs[k].name))) == 0)
+		{
+			return &m_Attrs[k];
+		}
+	}
+	return nullptr;
+}
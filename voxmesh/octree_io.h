@@ -0,0 +1,223 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "octree.h"
+#include <Eigen/Dense>
+#include <cstdint>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+// Binary octree format (native little-endian). All sections start at an
+// offset aligned on 8 bytes, so that the file can be memory-mapped and the
+// arrays accessed in place:
+//
+//   FileHeader
+//   NodeRecord[numNodes]
+//   CellRecord[numCells]
+//   AttributeRecord[numNodeAttributes + numCellAttributes]
+//   raw attribute data (one aligned block per attribute)
+//
+// Slots freed by OctreeGrid::coarsen() are stored as is: free cells have
+// firstChild == -2, and free nodes have a position of (-2, -2, -2).
+namespace OctreeFormat {
+
+	const char     MAGIC[8] = { 'O', 'C', 'T', 'G', 'R', 'I', 'D', '\0' };
+	const uint32_t VERSION  = 1;
+
+	// Attribute value types
+	enum : uint32_t {
+		TYPE_UINT32  = 1,
+		TYPE_INT32   = 2,
+		TYPE_FLOAT32 = 3,
+		TYPE_FLOAT64 = 4,
+	};
+
+	// Attribute location
+	enum : uint32_t {
+		ON_NODES = 0,
+		ON_CELLS = 1,
+	};
+
+	struct FileHeader {
+		char     magic[8];
+		uint32_t version;
+		uint32_t headerSize;
+		int32_t  nodeGridSize[3];
+		int32_t  cellGridSize[3];
+		int32_t  maxDepth;
+		int32_t  numRootCells;
+		uint64_t numNodes;
+		uint64_t numCells;
+		uint64_t nodesOffset;
+		uint64_t cellsOffset;
+		uint64_t attributesOffset;
+		uint32_t numNodeAttributes;
+		uint32_t numCellAttributes;
+	};
+
+	struct NodeRecord {
+		int32_t neighNodeId[6];
+		int32_t position[3];
+	};
+
+	struct CellRecord {
+		int32_t firstChild;
+		int32_t cornerNodeId[8];
+		int32_t neighCellId[6];
+	};
+
+	struct AttributeRecord {
+		char     name[64];
+		uint32_t type;
+		uint32_t location;
+		uint64_t count;
+		uint64_t offset;
+	};
+
+	static_assert(sizeof(NodeRecord) == 36, "Unexpected padding in NodeRecord");
+	static_assert(sizeof(CellRecord) == 60, "Unexpected padding in CellRecord");
+	static_assert(sizeof(AttributeRecord) == 88, "Unexpected padding in AttributeRecord");
+
+	// Size of a value of the given type (0 if unknown)
+	size_t typeSize(uint32_t type);
+
+} // namespace OctreeFormat
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief      Read-only view of an octree saved with OctreeGrid::save(). The
+ *             file is memory-mapped and queried in place, without building
+ *             an OctreeGrid.
+ */
+class OctreeGridView {
+
+public:
+	template<typename T> using ConstMap = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>>;
+
+private:
+	const char *m_Data = nullptr;
+	size_t      m_Size = 0;
+	void *      m_Mapping = nullptr;    // Start of the mmap region (if any)
+	std::vector<uint64_t> m_Buffer;     // Fallback storage when mmap is not available
+
+	const OctreeFormat::FileHeader      *m_Header = nullptr;
+	const OctreeFormat::NodeRecord      *m_Nodes = nullptr;
+	const OctreeFormat::CellRecord      *m_Cells = nullptr;
+	const OctreeFormat::AttributeRecord *m_Attrs = nullptr;
+
+public:
+	OctreeGridView() = default;
+	OctreeGridView(const OctreeGridView &) = delete;
+	OctreeGridView & operator=(const OctreeGridView &) = delete;
+	~OctreeGridView() { close(); }
+
+	// Map a file in memory, and check its header
+	bool open(const std::string &filename);
+
+	// Unmap the current file
+	void close();
+
+	// Whether a file is currently mapped
+	bool isOpen() const { return m_Header != nullptr; }
+
+public:
+	//////////////////////
+	// Public accessors //
+	//////////////////////
+
+	// Maximum depth of a cell
+	int maxDepth() const { return m_Header->maxDepth; }
+
+	// Number of root cells (stored first in the cell array)
+	int numRootCells() const { return m_Header->numRootCells; }
+
+	// Number of nodes
+	int numNodes() const { return (int) m_Header->numNodes; }
+
+	// Number of cells
+	int numCells() const { return (int) m_Header->numCells; }
+
+	// Node position
+	Eigen::Vector3i nodePos(int nodeId) const {
+		const int32_t *p = m_Nodes[nodeId].position;
+		return Eigen::Vector3i(p[0], p[1], p[2]);
+	}
+
+	// Adjacent node along axis in direction dir (\in {0, 1}), or -1
+	int nodeNeighId(int nodeId, int axis, int dir) const { return m_Nodes[nodeId].neighNodeId[2*axis+dir]; }
+
+	// Position of a cell corner
+	Eigen::Vector3i cellCornerPos(int cellId, int localCornerId) const {
+		return nodePos(cellCornerId(cellId, localCornerId));
+	}
+
+	// Return the id of the corner nodes of a cell
+	int cellCornerId(int cellId, int cornerId) const { return m_Cells[cellId].cornerNodeId[cornerId]; }
+
+	// Size of a cell
+	int cellExtent(int cellId) const { return cellCornerPos(cellId, 1)[0] - cellCornerPos(cellId, 0)[0]; }
+
+	// Adjacent cell along axis in direction dir (\in {0, 1}), or -1 on the border
+	int cellNeighId(int cellId, int axis, int dir) const { return m_Cells[cellId].neighCellId[2*axis+dir]; }
+
+	// First of the 8 consecutive children of a cell, or -1 for a leaf
+	int cellFirstChild(int cellId) const { return m_Cells[cellId].firstChild; }
+
+	// Return true iff the cell has no children
+	bool cellIsLeaf(int cellId) const { return m_Cells[cellId].firstChild == -1; }
+
+public:
+	////////////////
+	// Attributes //
+	////////////////
+
+	// Names of the attributes stored on nodes or cells
+	std::vector<std::string> nodeAttributeKeys() const { return keys(OctreeFormat::ON_NODES); }
+	std::vector<std::string> cellAttributeKeys() const { return keys(OctreeFormat::ON_CELLS); }
+
+	// Retrieve an attribute by name (empty map if absent or of a different type)
+	template<typename T> ConstMap<T> nodeAttribute(const std::string &name) const;
+	template<typename T> ConstMap<T> cellAttribute(const std::string &name) const;
+
+private:
+	std::vector<std::string> keys(uint32_t location) const;
+
+	const OctreeFormat::AttributeRecord * findAttribute(const std::string &name, uint32_t location) const;
+
+	template<typename T>
+	ConstMap<T> attribute(const std::string &name, uint32_t location) const;
+};
+
+// -----------------------------------------------------------------------------
+
+namespace OctreeFormat {
+
+	template<typename T> struct TypeTag;
+	template<> struct TypeTag<unsigned> { enum : uint32_t { value = TYPE_UINT32 }; };
+	template<> struct TypeTag<int>      { enum : uint32_t { value = TYPE_INT32 }; };
+	template<> struct TypeTag<float>    { enum : uint32_t { value = TYPE_FLOAT32 }; };
+	template<> struct TypeTag<double>   { enum : uint32_t { value = TYPE_FLOAT64 }; };
+
+} // namespace OctreeFormat
+
+template<typename T>
+OctreeGridView::ConstMap<T> OctreeGridView::attribute(const std::string &name, uint32_t location) const {
+	const OctreeFormat::AttributeRecord *rec = findAttribute(name, location);
+	if (rec == nullptr || rec->type != OctreeFormat::TypeTag<T>::value) {
+		std::cerr << "[OctreeGridView] Attribute [" << name << "] not found with the requested type." << std::endl;
+		return ConstMap<T>(nullptr, 0);
+	}
+	return ConstMap<T>(reinterpret_cast<const T *>(m_Data + rec->offset), (Eigen::Index) rec->count);
+}
+
+template<typename T>
+OctreeGridView::ConstMap<T> OctreeGridView::nodeAttribute(const std::string &name) const {
+	return attribute<T>(name, OctreeFormat::ON_NODES);
+}
+
+template<typename T>
+OctreeGridView::ConstMap<T> OctreeGridView::cellAttribute(const std::string &name) const {
+	return attribute<T>(name, OctreeFormat::ON_CELLS);
+}
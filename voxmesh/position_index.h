@@ -0,0 +1,124 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief      Hash table mapping lattice positions to ids (open addressing with
+ *             linear probing, backward-shift deletion). Coordinates must fit
+ *             on 21 bits.
+ */
+class PositionIndex {
+
+private:
+	// Key of empty slots. An enumerator needs no out-of-class definition when
+	// bound to a reference (std::fill, std::vector), unlike a static member.
+	enum : uint64_t { EMPTY = ~uint64_t(0) };
+
+	std::vector<uint64_t> m_Keys;
+	std::vector<int>      m_Values;
+	size_t                m_Size = 0;
+	int                   m_Shift = 64;
+
+public:
+	PositionIndex() { reserve(16); }
+
+	// Number of entries
+	size_t size() const { return m_Size; }
+
+	// Remove all entries
+	void clear() { std::fill(m_Keys.begin(), m_Keys.end(), EMPTY); m_Size = 0; }
+
+	// Make room for n entries
+	void reserve(size_t n);
+
+	// Insert or replace an entry
+	void insert(const Eigen::Vector3i &pos, int id);
+
+	// Remove an entry (if present)
+	void erase(const Eigen::Vector3i &pos);
+
+	// Retrieve an entry (-1 if absent)
+	int find(const Eigen::Vector3i &pos) const;
+
+private:
+	static uint64_t key(const Eigen::Vector3i &pos) {
+		assert(pos.minCoeff() >= 0 && pos.maxCoeff() < (1 << 21));
+		return (uint64_t(pos[0]) << 42) | (uint64_t(pos[1]) << 21) | uint64_t(pos[2]);
+	}
+
+	size_t slot(uint64_t k) const { return (size_t) ((k * 0x9E3779B97F4A7C15ull) >> m_Shift); }
+
+	size_t mask() const { return m_Keys.size() - 1; }
+
+	void rehash(size_t capacity);
+};
+
+// -----------------------------------------------------------------------------
+
+inline void PositionIndex::reserve(size_t n) {
+	size_t capacity = m_Keys.size();
+	if (capacity == 0) { capacity = 16; }
+	while (capacity < 2 * n) { capacity *= 2; }
+	if (capacity != m_Keys.size()) { rehash(capacity); }
+}
+
+inline void PositionIndex::rehash(size_t capacity) {
+	std::vector<uint64_t> keys(capacity, EMPTY);
+	std::vector<int> values(capacity);
+	m_Shift = 64;
+	for (size_t c = capacity; c > 1; c /= 2) { --m_Shift; }
+	m_Keys.swap(keys);
+	m_Values.swap(values);
+	for (size_t i = 0; i < keys.size(); ++i) {
+		if (keys[i] == EMPTY) { continue; }
+		size_t s = slot(keys[i]);
+		while (m_Keys[s] != EMPTY) { s = (s + 1) & mask(); }
+		m_Keys[s] = keys[i];
+		m_Values[s] = values[i];
+	}
+}
+
+inline void PositionIndex::insert(const Eigen::Vector3i &pos, int id) {
+	if (2 * (m_Size + 1) > m_Keys.size()) { rehash(2 * m_Keys.size()); }
+	const uint64_t k = key(pos);
+	size_t s = slot(k);
+	while (m_Keys[s] != EMPTY && m_Keys[s] != k) { s = (s + 1) & mask(); }
+	if (m_Keys[s] == EMPTY) { ++m_Size; }
+	m_Keys[s] = k;
+	m_Values[s] = id;
+}
+
+inline void PositionIndex::erase(const Eigen::Vector3i &pos) {
+	const uint64_t k = key(pos);
+	size_t s = slot(k);
+	while (m_Keys[s] != k) {
+		if (m_Keys[s] == EMPTY) { return; }
+		s = (s + 1) & mask();
+	}
+	// Shift back the following entries of the probe sequence
+	size_t hole = s;
+	for (size_t i = (s + 1) & mask(); m_Keys[i] != EMPTY; i = (i + 1) & mask()) {
+		const size_t home = slot(m_Keys[i]);
+		if (((i - home) & mask()) >= ((i - hole) & mask())) {
+			m_Keys[hole] = m_Keys[i];
+			m_Values[hole] = m_Values[i];
+			hole = i;
+		}
+	}
+	m_Keys[hole] = EMPTY;
+	--m_Size;
+}
+
+inline int PositionIndex::find(const Eigen::Vector3i &pos) const {
+	const uint64_t k = key(pos);
+	for (size_t s = slot(k); m_Keys[s] != EMPTY; s = (s + 1) & mask()) {
+		if (m_Keys[s] == k) { return m_Values[s]; }
+	}
+	return -1;
+}